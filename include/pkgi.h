@@ -29,6 +29,10 @@
 #define PKGI_TMP_FOLDER "/PKG"
 #define PKGI_INSTALL_FOLDER "/PSP/GAME"
 
+#define PKGI_CSO_LEVEL 9 // zlib level for cso conversion, 1 (fastest) to 9 (smallest)
+
+#define PKGI_THREAD_STACK_SIZE   (64 * 1024)
+#define PKGI_DOWNLOAD_STACK_SIZE (128 * 1024) // download + install, big installer buffers come from pkgi_scratch_get()
 
 #define PKGI_COUNTOF(arr) (sizeof(arr)/sizeof(0[arr]))
 
@@ -51,8 +55,39 @@ int64_t pkgi_strtoll(const char* str);
 void pkgi_memcpy(void* dst, const void* src, uint32_t size);
 void pkgi_memmove(void* dst, const void* src, uint32_t size);
 int pkgi_memequ(const void* a, const void* b, uint32_t size);
+// heap memory is counted per subsystem, current and peak bytes
+typedef enum {
+    MemOther,
+    MemDb,
+    MemFonts,
+    MemTextures,
+    MemHttp,
+    MemInstall,
+    MemTagCount,
+} MemTag;
+
 void* pkgi_malloc(uint32_t size);
+void* pkgi_malloc_tag(MemTag tag, uint32_t size);
+void* pkgi_calloc_tag(MemTag tag, uint32_t count, uint32_t size);
+// ptr must come from a pkgi_*alloc function, it keeps the tag it was allocated with
+void* pkgi_realloc_tag(MemTag tag, void* ptr, uint32_t size);
+char* pkgi_strdup_tag(MemTag tag, const char* str);
+// frees memory from any of the above
 void pkgi_free(void* ptr);
+// counts memory pkgi_malloc doesn't see, like textures, size is negative when released
+void pkgi_mem_add(MemTag tag, int32_t size);
+typedef struct
+{
+    uint32_t current;
+    uint32_t peak;
+    uint32_t blocks;
+} MemUsage;
+
+// copies the counters of every tag at one point in time
+void pkgi_mem_snapshot(MemUsage usage[MemTagCount]);
+const char* pkgi_mem_tag_name(MemTag tag);
+// writes the usage of all tags as text
+int pkgi_mem_dump(const char* path);
 
 int pkgi_ok_button(void);
 int pkgi_cancel_button(void);
@@ -72,12 +107,12 @@ const char* pkgi_get_temp_folder(void);
 const char* pkgi_get_app_folder(void);
 int pkgi_is_incomplete(const char* titleid);
 int pkgi_is_installed(const char* titleid);
-int pkgi_install(int iso_mode, int remove_pkg);
+int pkgi_install(int iso_mode, int cso_level, int remove_pkg);
 
 uint32_t pkgi_time_msec(void);
 
 typedef void pkgi_thread_entry(void);
-void pkgi_start_thread(const char* name, pkgi_thread_entry* start);
+void pkgi_start_thread(const char* name, pkgi_thread_entry* start, uint32_t stack_size);
 void pkgi_thread_exit(void);
 void pkgi_sleep(uint32_t msec);
 
@@ -98,14 +133,28 @@ int pkgi_check_free_space(uint64_t http_length);
 
 typedef struct pkgi_http pkgi_http;
 
+#define PKGI_HTTP_VALIDATOR_MAX 128
+
 int pkgi_validate_url(const char* url);
 pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset);
 int pkgi_http_response_length(pkgi_http* http, int64_t* length);
 int pkgi_http_read(pkgi_http* http, void* write_func, void* xferinfo_func);
+// checks if the last request failed on a network error that a reconnect may fix
+int pkgi_http_can_retry(pkgi_http* http);
+// strong ETag of the response, or its Last-Modified date, empty if the server sent neither
+const char* pkgi_http_validator(pkgi_http* http);
 void pkgi_http_close(pkgi_http* http);
+// warms up a connection to url in the background, pkgi_http_get() picks it up later
+void pkgi_http_prefetch(const char* url);
+void pkgi_http_prefetch_cancel(void);
 
 int pkgi_mkdirs(const char* path);
 void pkgi_rm(const char* file);
+// removes file and then its folders while they are empty, the first keep folder levels
+// below the device are never removed
+void pkgi_rm_with_folders(const char* file, int keep);
+int pkgi_rename(const char* from, const char* to);
+int pkgi_truncate(const char* path, uint64_t size);
 int64_t pkgi_get_size(const char* path);
 
 // creates file (if it exists, truncates size to 0)
@@ -119,6 +168,8 @@ void pkgi_close(void* f);
 
 int pkgi_read(void* f, void* buffer, uint32_t size);
 int pkgi_write(void* f, const void* buffer, uint32_t size);
+// pushes buffered writes down to the storage device
+int pkgi_flush(void* f);
 
 // UI stuff
 struct pkgi_texture_s
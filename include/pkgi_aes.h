@@ -1,17 +1,29 @@
 #pragma once
 
 #include "pkgi_utils.h"
-#include <mbedtls/aes.h>
+#include <stddef.h>
 
+// the AES block cipher comes from mbedtls, or from the built-in table implementation
+// when building with PKGI_AES_BUILTIN (the PKGI_AES_BUILTIN cmake option, on by default)
+#ifdef PKGI_AES_BUILTIN
+typedef struct
+{
+    uint32_t rk[44];    // round keys, for encryption or decryption depending on the init call
+} aes128_ctx;
+#else
+#include <mbedtls/aes.h>
+typedef mbedtls_aes_context aes128_ctx;
+#endif
 
-void aes128_init(mbedtls_aes_context* ctx, const uint8_t* key);
-void aes128_init_dec(mbedtls_aes_context* ctx, const uint8_t* key);
+void aes128_init(aes128_ctx* ctx, const uint8_t* key);
+void aes128_init_dec(aes128_ctx* ctx, const uint8_t* key);
+void aes128_free(aes128_ctx* ctx);
 
-void aes128_ecb_encrypt(mbedtls_aes_context* ctx, const uint8_t* input, uint8_t* output);
-void aes128_ecb_decrypt(mbedtls_aes_context* ctx, const uint8_t* input, uint8_t* output);
+void aes128_ecb_encrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output);
+void aes128_ecb_decrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output);
 
-void aes128_ctr_xor(mbedtls_aes_context* ctx, const uint8_t* iv, uint64_t block, uint8_t* buffer, size_t size);
+void aes128_ctr_xor(aes128_ctx* ctx, const uint8_t* iv, uint64_t block, uint8_t* buffer, size_t size);
 
 void aes128_cmac(const uint8_t* key, const uint8_t* buffer, uint32_t size, uint8_t* mac);
 
-void aes128_psp_decrypt(mbedtls_aes_context* ctx, const uint8_t* iv, uint32_t index, uint8_t* buffer, uint32_t size);
+void aes128_psp_decrypt(aes128_ctx* ctx, const uint8_t* iv, uint32_t index, uint8_t* buffer, uint32_t size);
@@ -89,6 +89,7 @@ typedef struct Config {
     uint8_t content;
     uint8_t version_check;
     uint8_t install_mode_iso;
+    uint8_t cso_level;
     uint8_t keep_pkg;
     uint8_t allow_refresh;
     uint8_t storage;
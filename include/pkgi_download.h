@@ -5,11 +5,44 @@
 
 #define PKGI_RAP_SIZE 16
 
-int pkgi_download(const DbItem* item);
+// image formats for pkg2iso, install_mode_iso - 1
+typedef enum {
+    ImageIso,
+    ImageCso,
+    ImageZso,
+    ImageCso2,
+    ImageFormatCount,
+} ImageFormat;
+
+// what pkgi_download() may install while it downloads, without keeping the file
+#define PKGI_STREAM_ZIP 0x01
+#define PKGI_STREAM_PKG 0x02
+
+int pkgi_download(const DbItem* item, int stream_flags);
 char * pkgi_http_download_buffer(const char* url, uint32_t* buf_size);
 
-void progress_screen_refresh(void);
+// called from the UI loop, picks up the latest progress published by the download thread
+void pkgi_download_update_dialog(void);
 void update_install_progress(const char *filename, int64_t progress);
 int install_psp_pkg(const char *file);
-int convert_psp_pkg_iso(const char* pkg_arg, int cso);
+// level is the zlib level for the deflate based formats
+int convert_psp_pkg_iso(const char* pkg_arg, ImageFormat format, int level);
+// takes the checksums of the last converted iso, returns 0 if there are none
+int convert_psp_pkg_hashes(char* text, uint32_t size);
 int extract_zip(const char* zip_file);
+
+// zip extraction fed from the download as the data arrives
+typedef struct zip_stream zip_stream;
+zip_stream* zip_stream_open(void);
+// returns 1 when the data was taken, 0 on errors, and -1 if the archive needs extract_zip()
+int zip_stream_write(zip_stream* zs, const uint8_t* data, uint32_t size);
+// returns the number of extracted entries, 0 if the archive was incomplete. the files written
+// are removed again unless keep is set and the archive was complete
+int zip_stream_close(zip_stream* zs, int keep);
+
+// pkg install fed from the download, same return values as the zip stream
+typedef struct pkg_stream pkg_stream;
+pkg_stream* pkg_stream_open(void);
+int pkg_stream_write(pkg_stream* ps, const uint8_t* data, uint32_t size);
+// returns 1 if every item was installed, same keep as the zip stream
+int pkg_stream_close(pkg_stream* ps, int keep);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// largest input pkgi_lz4_compress() accepts, match offsets are kept in 16 bits
+#define PKGI_LZ4_MAX_INPUT 0xffff
+
+// compresses one raw LZ4 block (no frame header), returns compressed size
+// or 0 if the result would not fit in dst_size bytes
+uint32_t pkgi_lz4_compress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t dst_size);
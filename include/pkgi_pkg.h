@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include "pkgi_aes.h"
+
+#define PKG_HEADER_SIZE     192
+#define PKG_HEADER_EXT_SIZE 64
+#define PKG_ITEM_SIZE       32
+
+#define PKG_TYPE_PSP 0x0001
+#define PKG_TYPE_PSX 0x0002
+#define PKG_TYPE_PTF 0x0003
+
+#define PKG_ITEM_PSP 0x90   // items encrypted with the psp key
+
+typedef struct
+{
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint64_t data_offset;   // relative to the encrypted area
+    uint64_t data_size;
+    uint8_t psp_type;
+    uint8_t flags;
+} PkgItem;
+
+typedef struct
+{
+    int fd;
+    uint64_t size;          // file size
+    uint8_t header[PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE];
+
+    uint64_t total_size;
+    uint64_t enc_offset;
+    uint64_t enc_size;
+    uint32_t item_count;
+    uint32_t items_offset;
+    uint32_t content_type;
+    int type;               // PKG_TYPE_*, 0 if unknown
+    char content_id[0x25];
+    char title_id[10];
+
+    aes128_ctx key;
+    aes128_ctx ps3_key;
+
+    // decrypted item table, a batch of entries at a time
+    uint8_t* table;
+    uint32_t table_start;
+    uint32_t table_count;
+
+    // read-ahead cache of raw pkg data, two slots borrowed from the scratch pool
+    uint8_t* cache;
+    uint32_t cache_slot;
+    uint64_t cache_offset[2];
+    uint32_t cache_size[2];
+    uint32_t cache_last;
+
+    uint32_t read_count;    // file reads issued, logged on close
+
+    // start of a pkg held in memory instead of fd, see pkgi_pkg_open_memory()
+    const uint8_t* mem;
+    uint32_t mem_size;
+} PkgFile;
+
+// parses header and metadata, the item table and data are read on demand
+int pkgi_pkg_open(PkgFile* pkg, const char* path);
+// same for the first size bytes of a pkg of total_size bytes, like a download in progress.
+// mem and mem_size may be updated as more of it arrives, reads past mem_size fail
+int pkgi_pkg_open_memory(PkgFile* pkg, const uint8_t* data, uint32_t size, uint64_t total_size);
+void pkgi_pkg_close(PkgFile* pkg);
+// sets the read-ahead size (0 for the default), reads of this size or more go straight to the file
+void pkgi_pkg_readahead(PkgFile* pkg, uint32_t size);
+
+int pkgi_pkg_get_item(PkgFile* pkg, uint32_t index, PkgItem* item);
+int pkgi_pkg_item_name(PkgFile* pkg, const PkgItem* item, char* name, uint32_t size);
+
+// decrypting read at offset inside the item data
+int pkgi_pkg_read(PkgFile* pkg, const PkgItem* item, uint64_t offset, void* buffer, uint32_t size);
+// decrypts item data the caller already read from pkg->fd, offset must be 16 byte aligned
+void pkgi_pkg_decrypt(PkgFile* pkg, const PkgItem* item, uint64_t offset, void* buffer, uint32_t size);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PKGI_SCRATCH_BUDGET (1024 * 1024)   // all buffers borrowed at the same time
+#define PKGI_SCRATCH_ALIGN  64
+
+// large i/o and conversion buffers of the installers, borrowed from one block of
+// PKGI_SCRATCH_BUDGET bytes instead of the heap or the thread stack. only used from
+// the download thread, there is no locking
+
+// buffer of at least size bytes aligned to PKGI_SCRATCH_ALIGN, NULL if it doesn't fit in
+// what is left of the budget
+void* pkgi_scratch_get(uint32_t size);
+void pkgi_scratch_put(void* ptr);
+// frees the block if nothing is borrowed, called once a download and install are done
+void pkgi_scratch_trim(void);
+
+// size of one read/write block for installs to the current storage device
+uint32_t pkgi_scratch_io_block(void);
@@ -1,6 +1,21 @@
 #pragma once
 
 #include "pkgi_utils.h"
-#include <mbedtls/sha256.h>
+#include <stddef.h>
 
 #define SHA256_DIGEST_SIZE 32
+
+// same layout as mbedtls 2.x mbedtls_sha256_context, the state is saved as is in .resume files
+typedef struct
+{
+    uint32_t total[2];      // bytes hashed, low and high word
+    uint32_t state[8];
+    uint8_t buffer[64];     // partial block, total[0] % 64 bytes
+    int is224;              // always 0, kept for the layout
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const uint8_t* data, size_t size);
+void sha256_finish(sha256_ctx* ctx, uint8_t* digest);
+
+void sha256(const uint8_t* data, size_t size, uint8_t* digest);
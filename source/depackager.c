@@ -6,13 +6,21 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <mbedtls/aes.h>
 
 #include "pkgi.h"
+#include "pkgi_pkg.h"
+#include "pkgi_utils.h"
+#include "pkgi_scratch.h"
 #include "pkgi_download.h"
 
 #define DEPACKAGER_VER 3
 
+#define PKG_NAME_MAX    1024
+
+#define PKG_IO_BUFFERS  3       // one reading, one decrypting, one writing, pkgi_scratch_io_block() each
+
+#define PKG_STREAM_PREFIX_MAX	(4 * 1024 * 1024)	// header, item table and names kept in memory
+
 /*
 typedef struct {
 	u32 magic;
@@ -47,275 +55,556 @@ typedef struct {
 */
 
 
-static u8 static_public_key[16];
-
-static const u8 PSPAESKey[16] __attribute__((aligned(16))) = {
-	0x07, 0xF2, 0xC6, 0x82, 0x90, 0xB5, 0x0D, 0x2C, 0x33, 0x81, 0x8D, 0x70, 0x9B, 0x60, 0xE6, 0x2B
-};
-
-
-static void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output)
-{
-	mbedtls_aes_context ctx;
-
-	mbedtls_aes_init(&ctx);
-	mbedtls_aes_setkey_enc(&ctx, key, 128);
-	mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, input, output);
-}
-
-static void AES128_ECB_decrypt(uint8_t* input, const uint8_t* key, uint8_t *output)
+static void view_pkg_info(const PkgFile *pkg)
 {
-	mbedtls_aes_context ctx;
+	u8 version = pkg->header[4];
 
-	mbedtls_aes_init(&ctx);
-	mbedtls_aes_setkey_dec(&ctx, key, 128);
-	mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_DECRYPT, input, output);
+	LOG("PKG info viewer");
+	LOG("PKG type:       %s", pkg->header[7] == 1 ? "PS3 (currently unsupported)" : pkg->header[7] == 2 ? "PSP" : "unknown");
+	LOG("PKG version:    %s", (version == 0x80) ? "retail" : (version == 0x90) ? "debug (currently unsupported)" : "unknown");
+	LOG("Content ID:     %s", pkg->content_id);
+	LOG("PKG file count: %d", pkg->item_count);
+	LOG("PKG size:       %lld bytes", pkg->total_size);
+	LOG("Encrypted size: %lld bytes", pkg->enc_size);
+	PKGI_UNUSED(version);
 }
 
-static u32 toU32(char *_buf)
+static int check_pkg_type(const u8 *header)
 {
-	u8 *buf = (u8 *)_buf;
-	u32 b1 = buf[0] << 24;
-	u32 b2 = buf[1] << 16;
-	u32 b3 = buf[2] << 8;
-	u32 size = b1 | b2 | b3 | buf[3];
-
-	return size;
+	return (memcmp(header, "\x7FPKG\x80\x00\x00\x02", 8) == 0);
 }
 
-static int is_pkg_supported(const char *file)
+static u32 io_block_size(const PkgItem *item, u32 block, u32 io_block)
 {
-	char buf[16];
-
-	SceUID fd = sceIoOpen(file, PSP_O_RDONLY, 0777);
-	if (fd >= 0) {
-		sceIoRead(fd, buf, 4);
-		sceIoClose(fd);
-
-		return memcmp(buf, "\x7FPKG", 4) == 0;
-	} else
-		return 0;
+	return (u32)min64(item->data_size - (u64)block * io_block, io_block);
 }
 
-static int is_pkg_type_supported(const char *file)
+// while block N is decrypted, block N+1 is read and block N-1 written in the background
+static int extract_item_data(PkgFile *pkg, const PkgItem *item, SceUID dstfd, char *buf, u32 io_block, SceOff progress)
 {
-	char buf[16];
-
-	SceUID fd = sceIoOpen(file, PSP_O_RDONLY, 0777);
-	if (fd >= 0) {
-		sceIoRead(fd, buf, 8);
-		sceIoClose(fd);
-
-		return memcmp(buf, "\x7FPKG\x80\x00\x00\x02", 8) == 0;
-	} else
+	SceUID fd = pkg->fd;
+	u32 blocks = (item->data_size + io_block - 1) / io_block;
+	u32 n, size, pending = 0;
+	u64 written = 0;
+	int reading = 0, writing = 0, ok = 1;
+	SceInt64 res;
+
+	if (sceIoLseek(fd, pkg->enc_offset + item->data_offset, PSP_SEEK_SET) < 0)
 		return 0;
-}
-
-static void view_pkg_info(const char *file)
-{
-	char buf[256];
 
-	LOG("PKG info viewer");
-
-	SceUID fd = sceIoOpen(file, PSP_O_RDONLY, 0777);
-	sceIoRead(fd, buf, sizeof(buf));
-	sceIoClose(fd);
-
-	u8 version = (u8)buf[4];
+	if (blocks)
+		reading = (sceIoReadAsync(fd, buf, io_block_size(item, 0, io_block)) >= 0);
 
-	LOG("PKG type:       %s", buf[7] == 1 ? "PS3 (currently unsupported)" : buf[7] == 2 ? "PSP" : "unknown");
-	LOG("PKG version:    %s", (version == 0x80) ? "retail" : (version == 0x90) ? "debug (currently unsupported)" : "unknown");
-	LOG("Content ID:     %s", buf + 0x30);
-	LOG("PKG file count: %d", toU32(buf + 0x14));
-	LOG("PKG size:       %d bytes", toU32(buf + 0x1C));
-	LOG("Encrypted size: %d bytes", toU32(buf + 0x2C));
-}
+	for (n = 0; n < blocks && reading; n++) {
+		char *cur = buf + (n % PKG_IO_BUFFERS) * io_block;
+		size = io_block_size(item, n, io_block);
 
-static void xor128(u8 *dst, u8 *xor1, u8 *xor2)
-{
-	int i;
+		reading = 0;
+		if (sceIoWaitAsync(fd, &res) < 0 || res != size) {
+			LOG("Error reading %d bytes at %lld", size, item->data_offset + (u64)n * io_block);
+			ok = 0;
+			break;
+		}
 
-	for (i = 0; i < 16; i++)
-		dst[i] = xor1[i] ^ xor2[i];
-}
+		// the buffer after this one was last written two blocks ago, that write has completed
+		if (n + 1 < blocks) {
+			char *next = buf + ((n + 1) % PKG_IO_BUFFERS) * io_block;
+			reading = (sceIoReadAsync(fd, next, io_block_size(item, n + 1, io_block)) >= 0);
+			ok = reading;
+		}
 
-static void iter128(u8 *buf)
-{
-	int i;
+		pkgi_pkg_decrypt(pkg, item, (u64)n * io_block, cur, size);
 
-	for (i = 15; i >= 0; i--) {
-		buf[i]++;
+		if (writing) {
+			writing = 0;
+			if (sceIoWaitAsync(dstfd, &res) < 0 || res != pending) {
+				LOG("Error writing block %d", n - 1);
+				ok = 0;
+				break;
+			}
+			written += pending;
+			update_install_progress(NULL, progress + written);
+		}
 
-		if (buf[i])
+		writing = (sceIoWriteAsync(dstfd, cur, size) >= 0);
+		pending = size;
+		if (!writing) {
+			ok = 0;
 			break;
+		}
 	}
-}
 
-static void setiter128(u8 *dst, int size)
-{
-	memcpy(dst, static_public_key, 16);
+	// drain whatever is still in flight before the buffers get reused
+	if (reading)
+		sceIoWaitAsync(fd, &res);
 
-	int i;
+	if (writing) {
+		if (sceIoWaitAsync(dstfd, &res) < 0 || res != pending) {
+			LOG("Error writing last block");
+			ok = 0;
+		}
+		else
+			written += pending;
+	}
+
+	update_install_progress(NULL, progress + written);
+	LOG("%lld/%lld bytes", written, item->data_size);
 
-	for (i = 0; i < size; i++)
-		iter128(dst);
+	return (ok && written == item->data_size);
 }
 
 int install_psp_pkg(const char *file)
 {
 	char *tmpBuf;
-	char gameid[10];
-	char pkgBuf[256];
-	u8 public_key[16], xor_key[16];
+	u32 io_block = pkgi_scratch_io_block();
+	PkgFile pkg;
+	PkgItem item;
 	SceOff progress = 0;
 
 	LOG("PSP depackager v%d", DEPACKAGER_VER);
 	LOG("PSP PKG installer");
 
-	if(is_pkg_supported(file))
-		view_pkg_info(file);
-
-	if (!is_pkg_type_supported(file)) {
+	if (!pkgi_pkg_open(&pkg, file)) {
 		LOG("Unsupported PKG type detected.");
 		return 0;
 	}
 
-	SceUID fd = sceIoOpen(file, PSP_O_RDONLY, 0777);
-	SceSize fdsize = sceIoLseek(fd, 0, PSP_SEEK_END);
-	sceIoLseek(fd, 0, PSP_SEEK_SET);
-	sceIoRead(fd, pkgBuf, 256);
+	view_pkg_info(&pkg);
 
-	if (toU32(pkgBuf + 0x1C) != fdsize) {
-		sceIoClose(fd);
-		LOG("Corrupt PKG detected");
-		LOG("detected size: %d bytes", fdsize);
-		LOG("expected size: %d bytes", toU32(pkgBuf + 0x1C));
+	if (!check_pkg_type(pkg.header)) {
+		pkgi_pkg_close(&pkg);
+		LOG("Unsupported PKG type detected.");
 		return 0;
 	}
 
-	sceIoLseek(fd, toU32(pkgBuf + 8) + 0x14, PSP_SEEK_SET);
-	sceIoRead(fd, gameid, 4);
+	if (pkg.total_size != pkg.size) {
+		pkgi_pkg_close(&pkg);
+		LOG("Corrupt PKG detected");
+		LOG("detected size: %lld bytes", pkg.size);
+		LOG("expected size: %lld bytes", pkg.total_size);
+		return 0;
+	}
 
-	if (toU32(gameid) == 9) {
-		sceIoClose(fd);
+	if (pkg.type == PKG_TYPE_PTF) {
+		pkgi_pkg_close(&pkg);
 		LOG("Theme PKG detected");
-		return (convert_psp_pkg_iso(file, 0));
+		return (convert_psp_pkg_iso(file, ImageIso, 0));
 	}
 
-	//1 MiB buffer
-	tmpBuf = (char *)malloc(1024 * 1024);
+	// rotating i/o buffers, the first one also holds item names
+	tmpBuf = (char *)pkgi_scratch_get(PKG_IO_BUFFERS * io_block);
 	if (!tmpBuf) {
-		LOG("Error allocating memory: 0x%08X", 1024 * 1024);
+		LOG("Error allocating memory: 0x%08X", PKG_IO_BUFFERS * io_block);
+		pkgi_pkg_close(&pkg);
 		return 0;
 	}
 
-	sceIoLseek(fd, toU32(pkgBuf + 8) + 0x48, PSP_SEEK_SET);
-	sceIoRead(fd, gameid, 9);
-	gameid[9] = 0;
+	int res = 0, files_extracted = 0;
+	u32 i;
+
+	for (i = 0; i < pkg.item_count; i++) {
+		if (!pkgi_pkg_get_item(&pkg, i, &item)) {
+			res = -1;
+			break;
+		}
 
-	memcpy(public_key, pkgBuf + 0x70, 16);
-	memcpy(static_public_key, pkgBuf + 0x70, 16);
+		if (item.psp_type != PKG_ITEM_PSP)
+			continue;
+
+		if (item.name_size <= 15 || !pkgi_pkg_item_name(&pkg, &item, tmpBuf, PKG_NAME_MAX)) {
+			LOG("Skipping item with bad name size (%d)", item.name_size);
+			continue;
+		}
+
+		char path[256];
+		snprintf(path, sizeof(path), "%s%s/%s/%s", pkgi_get_storage_device(), PKGI_INSTALL_FOLDER, pkg.title_id, tmpBuf + 15);
+		char* slash = strrchr(path, '/');
+		*slash = 0;
+		pkgi_mkdirs(path);
+		*slash = '/';
 
-	u32 enc_start = toU32(pkgBuf + 0x24);
-	u32 files = toU32(pkgBuf + 0x14);
+		if (item.flags != 4 && item.data_size) {
+			LOG("Currently extracting: %s", path);
+			files_extracted++;
 
-	sceIoLseek(fd, enc_start, PSP_SEEK_SET);
-	sceIoRead(fd, tmpBuf, files * 32);
+			progress = pkg.enc_offset + item.data_offset;
+			update_install_progress(path + 14, progress);
 
-	int i, j, pspcount = 0;
-	u32 file_name[files], file_name_len[files], file_offset[files], file_size[files], is_file[files];
+			SceUID dstfd = sceIoOpen(path, 0x602, 0777);
+			if (dstfd < 0) {
+				LOG("Error creating %s", path);
+				res = -1;
+				break;
+			}
 
-	for (i = 0; i < (int)(files * 2); i++) {
-		AES128_ECB_encrypt(public_key, PSPAESKey, xor_key);
-		xor128((u8 *)(tmpBuf + (i * 16)), (u8 *)(tmpBuf + (i * 16)), xor_key);
-		iter128(public_key);
-	}
+			int ok = extract_item_data(&pkg, &item, dstfd, tmpBuf, io_block, progress);
+			sceIoClose(dstfd);
 
-	for (i = 0; i < (int)files; i++) {
-		if (((u8 *)tmpBuf)[(i * 32) + 24] == 0x90) {
-			file_name[pspcount] = toU32(tmpBuf + i * 32);
-			file_name_len[pspcount] = toU32(tmpBuf + i * 32 + 4);
-			file_offset[pspcount] = toU32(tmpBuf + i * 32 + 12);
-			file_size[pspcount] = toU32(tmpBuf + i * 32 + 20);
-			is_file[pspcount] = ((tmpBuf[i * 32 + 27] != 4) && file_size[pspcount]);
-			pspcount++;
+			if (!ok) {
+				res = -1;
+				break;
+			}
 		}
 	}
 
-	int files_extracted = 0;
+	update_install_progress(file + 9, pkg.size);
+	pkgi_pkg_close(&pkg);
+	pkgi_scratch_put(tmpBuf);
 
-	for (i = 0; i < pspcount; i++) {
-		sceIoLseek(fd, enc_start + file_name[i], PSP_SEEK_SET);
-		int namesize = (file_name_len[i] + 15) & -16;
-		sceIoRead(fd, tmpBuf, namesize);
-		memcpy(public_key, pkgBuf + 0x70, 16);
+	LOG("files extracted: %d", files_extracted);
+	if (res < 0)
+		return 0;
+
+	LOG("Installation complete");
+
+	return 1;
+}
+
+// installs a pkg while it downloads: the start of it is kept until the item table and names
+// are known, then the data of each item is decrypted and written as it passes by. pkgs that
+// don't fit that (themes, overlapping items, huge tables) make pkg_stream_write() return -1
+// before anything is written, so the caller can download the file and use install_psp_pkg()
+typedef struct {
+	PkgItem item;
+	char *path;
+} stream_item;
+
+struct pkg_stream {
+	PkgFile pkg;
+	int opened;		// pkg was parsed from the prefix
+	int step;
+	u8 *prefix;		// pkg start, up to the end of the item names
+	u32 have;
+	u32 need;		// prefix bytes needed for the next step
+
+	stream_item *items;	// items with data, in pkg order
+	u32 count;
+	u32 next;		// item receiving data
+	u64 offset;		// pkg bytes received once the items are known
+
+	SceUID fd;		// file of items[next], -1 until its data starts
+	u64 written;	// bytes of items[next] passed to the file
+	char *buf;		// two blocks, one filling while the other is written
+	u32 block;		// size of each
+	u32 fill;
+	u32 cur;
+	int writing;
+	u32 pending;
+};
+
+pkg_stream* pkg_stream_open(void)
+{
+	pkg_stream *ps = pkgi_calloc_tag(MemInstall, 1, sizeof(pkg_stream));
+	if (!ps)
+		return NULL;
+
+	ps->fd = -1;
+	ps->need = PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE;
+	ps->block = pkgi_scratch_io_block();
+	ps->prefix = pkgi_malloc_tag(MemInstall, ps->need);
+	ps->buf = pkgi_scratch_get(2 * ps->block);
+	if (!ps->prefix || !ps->buf) {
+		pkgi_free(ps->prefix);
+		pkgi_scratch_put(ps->buf);
+		pkgi_free(ps);
+		return NULL;
+	}
+
+	LOG("PSP PKG stream installer");
+	return ps;
+}
 
-		setiter128(public_key, file_name[i] >> 4);
+static int compare_items(const void *a, const void *b)
+{
+	const stream_item *x = a, *y = b;
+	return (x->item.data_offset > y->item.data_offset) - (x->item.data_offset < y->item.data_offset);
+}
+
+static int stream_need(pkg_stream *ps, u64 size)
+{
+	if (size > PKG_STREAM_PREFIX_MAX) {
+		LOG("pkg tables are too big to stream (%lld bytes)", size);
+		return -1;
+	}
+	if (size <= ps->need)
+		return 1;
+
+	u8 *prefix = pkgi_realloc_tag(MemInstall, ps->prefix, size);
+	if (!prefix)
+		return 0;
 
-		for (j = 0; j < (namesize >> 4); j++) {
-			AES128_ECB_encrypt(public_key, PSPAESKey, xor_key);
-			xor128((u8 *)(tmpBuf + (j * 16)), (u8 *)(tmpBuf + (j * 16)), xor_key);
-			iter128(public_key);
+	ps->prefix = prefix;
+	ps->need = size;
+	return 1;
+}
+
+// the table is in, find where the names end
+static int stream_parse_table(pkg_stream *ps)
+{
+	PkgFile *pkg = &ps->pkg;
+	PkgItem item;
+	u64 names_end = ps->have;
+
+	if (!pkgi_pkg_open_memory(pkg, ps->prefix, ps->have, get64be(ps->prefix + 24)))
+		return -1;
+	ps->opened = 1;
+	view_pkg_info(pkg);
+
+	if (pkg->type == PKG_TYPE_PTF) {
+		LOG("Theme PKG detected");
+		return -1;
+	}
+
+	ps->items = pkgi_calloc_tag(MemInstall, pkg->item_count, sizeof(stream_item));
+	if (pkg->item_count && !ps->items)
+		return 0;
+
+	for (u32 i = 0; i < pkg->item_count; i++) {
+		if (!pkgi_pkg_get_item(pkg, i, &item))
+			return -1;
+		if (item.psp_type == PKG_ITEM_PSP)
+			names_end = max64(names_end, pkg->enc_offset + item.name_offset + item.name_size);
+	}
+
+	return stream_need(ps, names_end);
+}
+
+// install path of a psp item, 0 if it is not one or its name is bad
+static int stream_item_path(PkgFile *pkg, const PkgItem *item, char *path, size_t size)
+{
+	char name[PKG_NAME_MAX];
+
+	if (item->psp_type != PKG_ITEM_PSP)
+		return 0;
+
+	if (item->name_size <= 15 || !pkgi_pkg_item_name(pkg, item, name, sizeof(name))) {
+		LOG("Skipping item with bad name size (%d)", item->name_size);
+		return 0;
+	}
+
+	snprintf(path, size, "%s%s/%s/%s", pkgi_get_storage_device(), PKGI_INSTALL_FOLDER, pkg->title_id, name + 15);
+	return 1;
+}
+
+// the names are in, collect the items to write and create their folders once the
+// whole table is known to be streamable
+static int stream_parse_names(pkg_stream *ps)
+{
+	PkgFile *pkg = &ps->pkg;
+	PkgItem item;
+	char path[256];
+
+	for (u32 i = 0; i < pkg->item_count; i++) {
+		stream_item *e = &ps->items[ps->count];
+
+		if (!pkgi_pkg_get_item(pkg, i, &e->item))
+			return -1;
+
+		if (!stream_item_path(pkg, &e->item, path, sizeof(path)))
+			continue;
+
+		if (e->item.flags == 4 || !e->item.data_size)
+			continue;
+
+		if ((e->path = pkgi_strdup_tag(MemInstall, path)) == NULL)
+			return 0;
+		ps->count++;
+	}
+
+	qsort(ps->items, ps->count, sizeof(stream_item), compare_items);
+
+	for (u32 i = 0; i + 1 < ps->count; i++) {
+		if (ps->items[i].item.data_offset + ps->items[i].item.data_size > ps->items[i + 1].item.data_offset) {
+			LOG("pkg items overlap, cannot stream");
+			return -1;
 		}
+	}
+
+	for (u32 i = 0; i < pkg->item_count; i++) {
+		if (!pkgi_pkg_get_item(pkg, i, &item))
+			return -1;
+
+		if (!stream_item_path(pkg, &item, path, sizeof(path)))
+			continue;
 
-		char path[256];
-		snprintf(path, sizeof(path), "%s%s/%s/%s", pkgi_get_storage_device(), PKGI_INSTALL_FOLDER, gameid, tmpBuf + 15);
 		char* slash = strrchr(path, '/');
 		*slash = 0;
 		pkgi_mkdirs(path);
-		*slash = '/';
+	}
 
-		if (is_file[i]) {
-			LOG("Currently extracting: %s", path);
-			files_extracted++;
+	LOG("streaming %d files", ps->count);
+	return 1;
+}
 
-			progress = sceIoLseek(fd, enc_start + file_offset[i], PSP_SEEK_SET);
-			sceIoRead(fd, tmpBuf, 1024 * 1024);
-			update_install_progress(path + 14, progress);
+static int stream_setup(pkg_stream *ps)
+{
+	int res = 1;
+
+	while (res > 0 && ps->have == ps->need && ps->step < 3) {
+		switch (ps->step++) {
+		case 0:
+			if (!check_pkg_type(ps->prefix)) {
+				LOG("Unsupported PKG type detected.");
+				return -1;
+			}
+			res = stream_need(ps, get64be(ps->prefix + 32) + (u64)get32be(ps->prefix + 20) * PKG_ITEM_SIZE);
+			break;
+		case 1:
+			res = stream_parse_table(ps);
+			break;
+		case 2:
+			res = stream_parse_names(ps);
+			break;
+		}
+		ps->pkg.mem = ps->prefix;
+	}
 
-			setiter128(public_key, file_offset[i] >> 4);
+	return res;
+}
 
-			SceUID dstfd = sceIoOpen(path, 0x602, 0777);
+static int stream_wait_write(pkg_stream *ps)
+{
+	SceInt64 res;
 
-			u32 szcheck = 0, mincheck = 0;
+	if (!ps->writing)
+		return 1;
 
-			LOG("%d/%d bytes", mincheck, file_size[i]);
+	ps->writing = 0;
+	if (sceIoWaitAsync(ps->fd, &res) < 0 || res != ps->pending) {
+		LOG("Error writing %s", ps->items[ps->next].path);
+		return 0;
+	}
+	return 1;
+}
 
-			for (j = 0; j < (int)(file_size[i] >> 4); j++) {
-				if (szcheck == 1024 * 1024) {
-					szcheck = 0;
-					mincheck += 1024 * 1024;
+// decrypts the filled block and writes it in the background, blocks start 16 byte aligned
+static int stream_flush(pkg_stream *ps)
+{
+	stream_item *e = &ps->items[ps->next];
+	char *block = ps->buf + ps->cur * ps->block;
 
-					sceIoWrite(dstfd, tmpBuf, 1024 * 1024);
-					sceIoRead(fd, tmpBuf, 1024 * 1024);
-					update_install_progress(NULL, progress + mincheck);
+	pkgi_pkg_decrypt(&ps->pkg, &e->item, ps->written, block, ps->fill);
 
-					LOG("%d/%d bytes", mincheck, file_size[i]);
-				}
+	if (!stream_wait_write(ps))
+		return 0;
 
-				AES128_ECB_encrypt(public_key, PSPAESKey, xor_key);
-				xor128((u8 *)((tmpBuf + (j * 16)) - mincheck), (u8 *)((tmpBuf + (j * 16)) - mincheck), xor_key);
-				iter128(public_key);
+	ps->writing = (sceIoWriteAsync(ps->fd, block, ps->fill) >= 0);
+	ps->pending = ps->fill;
+	ps->written += ps->fill;
+	ps->fill = 0;
+	ps->cur ^= 1;
 
-				szcheck += 16;
-			}
+	return ps->writing;
+}
+
+static int stream_data(pkg_stream *ps, const u8 *data, u32 size)
+{
+	while (size && ps->next < ps->count) {
+		stream_item *e = &ps->items[ps->next];
+		u64 start = ps->pkg.enc_offset + e->item.data_offset;
+
+		// gaps between items, like the table and names
+		if (ps->offset < start) {
+			u32 skip = (u32)min64(start - ps->offset, size);
+			ps->offset += skip;
+			data += skip;
+			size -= skip;
+			continue;
+		}
 
-			if (mincheck < file_size[i])
-			{
-				sceIoWrite(dstfd, tmpBuf, file_size[i] - mincheck);
-				update_install_progress(NULL, progress + file_size[i]);
+		if (ps->fd < 0) {
+			LOG("Currently extracting: %s", e->path);
+			ps->fd = sceIoOpen(e->path, 0x602, 0777);
+			ps->written = 0;
+			if (ps->fd < 0) {
+				LOG("Error creating %s", e->path);
+				return 0;
 			}
+		}
 
-			sceIoClose(dstfd);
+		u64 done = ps->written + ps->fill;
+		u32 n = (u32)min64(min64(e->item.data_size - done, size), ps->block - ps->fill);
+
+		memcpy(ps->buf + ps->cur * ps->block + ps->fill, data, n);
+		ps->fill += n;
+		ps->offset += n;
+		data += n;
+		size -= n;
+
+		int last = (done + n == e->item.data_size);
+		if ((ps->fill == ps->block || last) && !stream_flush(ps))
+			return 0;
+
+		if (last) {
+			int ok = stream_wait_write(ps);
+			sceIoClose(ps->fd);
+			ps->fd = -1;
+			if (!ok)
+				return 0;
+			ps->next++;
 		}
 	}
 
-	update_install_progress(file + 9, fdsize);
-	sceIoClose(fd);
-	free(tmpBuf);
+	ps->offset += size;
+	return 1;
+}
 
-	LOG("files extracted: %d", files_extracted);
-	LOG("Installation complete");
+int pkg_stream_write(pkg_stream *ps, const uint8_t *data, uint32_t size)
+{
+	while (ps->step < 3 && size) {
+		u32 n = min32(ps->need - ps->have, size);
+		memcpy(ps->prefix + ps->have, data, n);
+		ps->have += n;
+		ps->pkg.mem_size = ps->have;
+		data += n;
+		size -= n;
+
+		int res = stream_setup(ps);
+		if (res <= 0)
+			return res;
+
+		// the data of the first items may already be in the prefix
+		if (ps->step == 3 && !stream_data(ps, ps->prefix, ps->have))
+			return 0;
+	}
 
-	return 1;
+	return (size ? stream_data(ps, data, size) : 1);
+}
+
+int pkg_stream_close(pkg_stream *ps, int keep)
+{
+	int ok = (ps->step == 3 && ps->next == ps->count && ps->offset == ps->pkg.total_size);
+	// items before next are complete, next itself was created if its file is open
+	u32 created = ps->next + (ps->fd >= 0);
+
+	if (ps->fd >= 0) {
+		stream_wait_write(ps);
+		sceIoClose(ps->fd);
+	}
+
+	if (!keep || !ok) {
+		LOG("removing %d installed files", created);
+		for (u32 i = 0; i < created; i++)
+			pkgi_rm_with_folders(ps->items[i].path, 2);
+	}
+
+	if (ps->step == 3)
+		LOG("files extracted: %d/%d", ps->next, ps->count);
+
+	if (ok)
+		LOG("Installation complete");
+	else if (ps->step == 3)
+		LOG("pkg stream ended at %lld of %lld bytes", ps->offset, ps->pkg.total_size);
+
+	for (u32 i = 0; i < ps->count; i++)
+		pkgi_free(ps->items[i].path);
+
+	if (ps->opened)
+		pkgi_pkg_close(&ps->pkg);
+	pkgi_free(ps->items);
+	pkgi_free(ps->prefix);
+	pkgi_scratch_put(ps->buf);
+	pkgi_free(ps);
+
+	return ok;
 }
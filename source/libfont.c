@@ -187,6 +187,9 @@ uint8_t * AddFontFromBitmapArray(uint8_t *font, uint8_t *texture, uint8_t first_
 
     texture = (uint8_t *) ((((long) texture) + 15) & ~15);
 
+    // black and white texture per char
+    pkgi_mem_add(MemFonts, (last_char - first_char + 1) * 2 * w * h * 4);
+
     font_datas.number_of_fonts++;
 
     return texture;
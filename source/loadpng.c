@@ -22,13 +22,13 @@ extern SDL_Renderer* renderer;
 static rawImage_t * imgCreateEmptyTexture(unsigned int w, unsigned int h)
 {
 	rawImage_t *img=NULL;
-	img=malloc(sizeof(rawImage_t));
+	img=pkgi_malloc_tag(MemTextures, sizeof(rawImage_t));
 	if(img!=NULL)
 	{
-		img->datap=malloc(w*h*4);
+		img->datap=pkgi_malloc_tag(MemTextures, w*h*4);
 		if(img->datap==NULL)
 		{
-			free(img);
+			pkgi_free(img);
 			return NULL;
 		}
 		img->width=w;
@@ -156,7 +156,7 @@ static rawImage_t *imgLoadPngFromFile(const char *path)
     if (size < 0)
         return NULL;
 
-    buf = malloc(size);
+    buf = pkgi_malloc_tag(MemTextures, size);
     if (!buf)
         return NULL;
 
@@ -164,7 +164,7 @@ static rawImage_t *imgLoadPngFromFile(const char *path)
         return NULL;
 
     img = imgLoadPngFromBuffer(buf);
-    free(buf);
+    pkgi_free(buf);
 
     return img;
 }
@@ -174,14 +174,14 @@ pkgi_texture loadPngTexture(const char* path, const void* buffer)
 	rawImage_t* raw;
 	pkgi_texture tex;
 
-	tex = malloc(sizeof(struct pkgi_texture_s));
+	tex = pkgi_malloc_tag(MemTextures, sizeof(struct pkgi_texture_s));
 	if (!tex)
 		return NULL;
 
 	raw = path ? imgLoadPngFromFile(path) : imgLoadPngFromBuffer(buffer);
 	if (!raw)
 	{
-		free(tex);
+		pkgi_free(tex);
 		return NULL;
 	}
 
@@ -191,10 +191,12 @@ pkgi_texture loadPngTexture(const char* path, const void* buffer)
 	tex->texture = SDL_CreateTextureFromSurface(renderer, surface);
 	tex->width = raw->width;
 	tex->height = raw->height;
+	// the texture holds its own copy of the pixels, released in pkgi_free_texture()
+	pkgi_mem_add(MemTextures, tex->width * tex->height * 4);
 
 	SDL_FreeSurface(surface);
-	free(raw->datap);
-	free(raw);
+	pkgi_free(raw->datap);
+	pkgi_free(raw);
 
 	return tex;
 }
@@ -5,23 +5,33 @@
 
 #include "pkgi.h"
 #include "pkgi_aes.h"
+#include "pkgi_pkg.h"
+#include "pkgi_lz4.h"
+#include "pkgi_scratch.h"
 #include "pkgi_download.h"
 #include <zlib.h>
+#include <mbedtls/md5.h>
+#include <mbedtls/sha1.h>
 
 #include <stdio.h>
 #include <string.h>
 
 #define ISO_SECTOR_SIZE 2048
 #define CSO_HEADER_SIZE 24
+#define CSO_BUFFER_SIZE (64 * 1024)
+#define CSO2_BLOCK_SIZE (4 * ISO_SECTOR_SIZE)
+#define CSO2_LZ4_SLACK  16      // csov2 keeps lz4 blocks up to 1/16 bigger than deflate
+#define PSAR_READAHEAD_SIZE (256 * 1024)
+#define EDAT_CHUNK_SIZE     (64 * 1024)
+#define PSAR_BLOCK_MAX      (16 * ISO_SECTOR_SIZE)
+#define COPY_CHUNK_SIZE     (64 * 1024)
 
-#define PKG_HEADER_SIZE 192
-#define PKG_HEADER_EXT_SIZE 64
+#define Z_WBITS_DEFLATE (-15)
 
-#define PKG_TYPE_PSP 0x0001
-#define PKG_TYPE_PSX 0x0002
-#define PKG_TYPE_PTF 0x0003
+static const char* image_ext[] = { "iso", "cso", "zso", "cso" };
 
-#define Z_WBITS_DEFLATE (-15)
+// checksums of the last converted iso, for the completion dialog
+static char iso_hashes[128];
 
 // https://vitadevwiki.com/vita/Keys_NonVita#PSPAESKirk4.2F7
 static const uint8_t kirk7_key38[] = { 0x12, 0x46, 0x8d, 0x7e, 0x1c, 0x42, 0x20, 0x9b, 0xba, 0x54, 0x26, 0x83, 0x5e, 0xb0, 0x33, 0x03 };
@@ -33,227 +43,346 @@ static const uint8_t amctl_hashkey_3[] = { 0xe3, 0x50, 0xed, 0x1d, 0x91, 0x0a, 0
 static const uint8_t amctl_hashkey_4[] = { 0x13, 0x5f, 0xa4, 0x7c, 0xab, 0x39, 0x5b, 0xa4, 0x76, 0xb8, 0xcc, 0xa9, 0x8f, 0x3a, 0x04, 0x45 };
 static const uint8_t amctl_hashkey_5[] = { 0x67, 0x8d, 0x7f, 0xa3, 0x2a, 0x9c, 0xa0, 0xd1, 0x50, 0x8a, 0xd8, 0x38, 0x5e, 0x4b, 0x01, 0x7e };
 
-// https://wiki.henkaku.xyz/vita/Packages#AES_Keys
-static const uint8_t pkg_ps3_key[] = { 0x2e, 0x7b, 0x71, 0xd7, 0xc9, 0xc9, 0xa1, 0x4e, 0xa3, 0x22, 0x1f, 0x18, 0x88, 0x28, 0xb8, 0xf8 };
-static const uint8_t pkg_psp_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
-
-// lzrc decompression code from libkirk by tpu
-typedef struct {
-    // input stream
-    const uint8_t* input;
-    uint32_t in_ptr;
-    uint32_t in_len;
-
-    // output stream
-    uint8_t* output;
-    uint32_t out_ptr;
-    uint32_t out_len;
-
-    // range decode
-    uint32_t range;
-    uint32_t code;
-    uint32_t out_code;
-    uint8_t lc;
 
-    uint8_t bm_literal[8][256];
-    uint8_t bm_dist_bits[8][39];
-    uint8_t bm_dist[18][8];
-    uint8_t bm_match[8][8];
-    uint8_t bm_len[8][31];
-} lzrc_decode;
+static void out_write_at(FILE* file, long offset, const void* buffer, uint32_t size)
+{
+    long pos = ftell(file);
 
+    fseek(file, offset, SEEK_SET);
+    fwrite(buffer, size, 1, file);
+    fseek(file, pos, SEEK_SET);
+}
 
-static uint32_t zlib_deflate_cso(FILE *outfile, uint8_t *in, uint32_t* cso_block)
+typedef struct
 {
-    uint8_t GCC_ALIGN(16) out[ISO_SECTOR_SIZE];
+    void* file;
+    ImageFormat format;
     z_stream z;
-    uint32_t ret;
+    int level;
+    uint32_t block_size;
+    uint32_t* index;
+    uint32_t count;
+    uint32_t offset;
+    // compressed blocks are collected here and written out in bigger chunks
+    uint8_t* buffer;
+    uint32_t used;
+    // input is cut into blocks here when they don't line up with the psar blocks
+    uint8_t* block;
+    uint32_t staged;
+    // second candidate for csov2, which picks lz4 or deflate per block
+    uint8_t* scratch;
+    uint64_t input;
+    uint32_t start;
+} CsoWriter;
+
+// one deflate stream is reused for all blocks, deflateInit2 is far more expensive
+// than compressing a single block
+static int cso_open(CsoWriter* cso, void* file, ImageFormat format, uint64_t iso_size, int level)
+{
+    memset(cso, 0, sizeof(CsoWriter));
+    cso->file = file;
+    cso->format = format;
+    cso->level = level;
+    cso->block_size = (format == ImageCso2) ? CSO2_BLOCK_SIZE : ISO_SECTOR_SIZE;
 
-    memset(&z, 0, sizeof(z));
-    if(deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, Z_WBITS_DEFLATE, 8, Z_DEFAULT_STRATEGY))
+    if (format != ImageZso && deflateInit2(&cso->z, level, Z_DEFLATED, Z_WBITS_DEFLATE, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     {
         LOG("Error: zlib initialization error");
-        return(0);
+        return 0;
     }
 
-    z.next_in   = in;
-    z.avail_in  = ISO_SECTOR_SIZE;
-    z.next_out  = out;
-    z.avail_out = sizeof(out);
-
-    if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+    uint32_t block_count = (uint32_t)(1 + (iso_size + cso->block_size - 1) / cso->block_size);
+    cso->index = pkgi_malloc_tag(MemInstall, block_count * sizeof(uint32_t));
+    cso->buffer = pkgi_scratch_get(CSO_BUFFER_SIZE + 2 * cso->block_size);
+    if (!cso->index || !cso->buffer)
     {
-        pkgi_write(outfile, out, (uint32_t)z.total_out);
-        ret = z.total_out;
+        LOG("Error: out of memory for cso buffers");
+        if (format != ImageZso) deflateEnd(&cso->z);
+        pkgi_free(cso->index);
+        pkgi_scratch_put(cso->buffer);
+        return 0;
     }
-    else
+    cso->block = cso->buffer + CSO_BUFFER_SIZE;
+    cso->scratch = cso->block + cso->block_size;
+    memset(cso->index, 0, block_count * sizeof(uint32_t));
+
+    uint8_t cso_header[CSO_HEADER_SIZE] = { 0x43, 0x49, 0x53, 0x4f };
+    if (format == ImageZso)
     {
-        *cso_block |= 0x80000000;
-        pkgi_write(outfile, in, ISO_SECTOR_SIZE);
-        ret = ISO_SECTOR_SIZE;
+        memcpy(cso_header, "ZISO", 4);
     }
-
-    deflateEnd(&z);
-    return(ret);
+    // header size
+    set32le(cso_header + 4, sizeof(cso_header));
+    // original size
+    set64le(cso_header + 8, iso_size);
+    // block size
+    set32le(cso_header + 16, cso->block_size);
+    // version, index shift stays 0
+    cso_header[20] = (format == ImageCso2) ? 2 : 1;
+
+    pkgi_write(file, cso_header, sizeof(cso_header));
+    pkgi_write(file, cso->index, block_count * sizeof(uint32_t));
+
+    cso->offset = CSO_HEADER_SIZE + block_count * sizeof(uint32_t);
+    cso->start = pkgi_time_msec();
+    return 1;
 }
 
-static void sys_read(FILE* file, uint64_t offset, void* buffer, uint32_t size)
+static void cso_flush(CsoWriter* cso)
 {
-    fseek(file, offset, SEEK_SET);
-    fread(buffer, size, 1, file);
+    if (cso->used)
+    {
+        pkgi_write(cso->file, cso->buffer, cso->used);
+        cso->used = 0;
+    }
 }
 
-static void out_write_at(FILE* file, long offset, const void* buffer, uint32_t size)
+static uint32_t cso_deflate(CsoWriter* cso, const uint8_t* in, uint32_t size, uint8_t* out, uint32_t out_size)
 {
-    long pos = ftell(file);
+    deflateReset(&cso->z);
+    cso->z.next_in   = (uint8_t*)in;
+    cso->z.avail_in  = size;
+    cso->z.next_out  = out;
+    cso->z.avail_out = out_size;
 
-    fseek(file, offset, SEEK_SET);
-    fwrite(buffer, size, 1, file);
-    fseek(file, pos, SEEK_SET);
+    return (deflate(&cso->z, Z_FINISH) == Z_STREAM_END) ? (uint32_t)cso->z.total_out : 0;
 }
 
-static void rc_init(lzrc_decode* rc, void* out, int out_len, const void* in, int in_len)
+static void cso_put_block(CsoWriter* cso, const uint8_t* in, uint32_t size)
 {
-    if (in_len < 5)
+    if (cso->used + cso->block_size > CSO_BUFFER_SIZE)
     {
-        LOG("ERROR: internal error - lzrc input underflow! pkg may be corrupted?\n");
-        return;
+        cso_flush(cso);
     }
 
-    rc->input = in;
-    rc->in_len = in_len;
-    rc->in_ptr = 5;
-
-    rc->output = out;
-    rc->out_len = out_len;
-    rc->out_ptr = 0;
-
-    rc->range = 0xffffffff;
-    rc->lc = rc->input[0];
-    rc->code = get32be(rc->input + 1);
-    rc->out_code = 0xffffffff;
+    uint8_t* out = cso->buffer + cso->used;
+    uint32_t out_size = 0;
+    uint32_t flags = 0;
 
-    memset(rc->bm_literal, 0x80, sizeof(rc->bm_literal));
-    memset(rc->bm_dist_bits, 0x80, sizeof(rc->bm_dist_bits));
-    memset(rc->bm_dist, 0x80, sizeof(rc->bm_dist));
-    memset(rc->bm_match, 0x80, sizeof(rc->bm_match));
-    memset(rc->bm_len, 0x80, sizeof(rc->bm_len));
-}
-
-static void normalize(lzrc_decode* rc)
-{
-    if (rc->range < 0x01000000)
+    if (cso->format == ImageCso)
     {
-        rc->range <<= 8;
-        rc->code = (rc->code << 8) + rc->input[rc->in_ptr];
-        rc->in_ptr++;
+        // v1: high bit marks a block stored as is
+        out_size = cso_deflate(cso, in, size, out, size);
+        flags = out_size ? 0 : 0x80000000;
     }
-}
-
-static int rc_bit(lzrc_decode* rc, uint8_t *prob)
-{
-    uint32_t bound;
-
-    normalize(rc);
-
-    bound = (rc->range >> 8) * (*prob);
-    *prob -= *prob >> 3;
-
-    if (rc->code < bound)
+    else if (cso->format == ImageZso)
     {
-        rc->range = bound;
-        *prob += 31;
-        return 1;
+        // same layout as v1 with lz4 blocks, much cheaper to decode on the psp
+        out_size = pkgi_lz4_compress(in, size, out, size);
+        flags = out_size ? 0 : 0x80000000;
     }
     else
     {
-        rc->code -= bound;
-        rc->range -= bound;
-        return 0;
-    }
-}
+        // v2: high bit marks lz4, a block is stored as is when its size reaches the block size.
+        // a short last block must always compress, deflate can't grow it to a full block
+        uint32_t zsize = cso_deflate(cso, in, size, out, cso->block_size - 1);
+        uint32_t lsize = pkgi_lz4_compress(in, size, cso->scratch, cso->block_size - 1);
 
-static int rc_bittree(lzrc_decode* rc, uint8_t *probs, int limit)
-{
-    int number = 1;
+        // lz4 wins unless deflate is notably smaller
+        if (lsize && (!zsize || lsize <= zsize + zsize / CSO2_LZ4_SLACK))
+        {
+            memcpy(out, cso->scratch, lsize);
+            out_size = lsize;
+            flags = 0x80000000;
+        }
+        else
+        {
+            out_size = zsize;
+        }
+    }
 
-    do
+    if (!out_size)
     {
-        number = (number << 1) + rc_bit(rc, probs + number);
+        memcpy(out, in, size);
+        out_size = size;
     }
-    while (number < limit);
 
-    return number;
+    cso->index[cso->count++] = cso->offset | flags;
+    cso->used += out_size;
+    cso->offset += out_size;
 }
 
-static int rc_number(lzrc_decode* rc, uint8_t *prob, uint32_t n)
+static void cso_write(CsoWriter* cso, const uint8_t* data, uint32_t size)
 {
-    int number = 1;
+    cso->input += size;
 
-    if (n > 3)
+    while (size)
     {
-        number = (number << 1) + rc_bit(rc, prob + 3);
-        if (n > 4)
+        if (cso->staged == 0 && size >= cso->block_size)
         {
-            number = (number << 1) + rc_bit(rc, prob + 3);
-            if (n > 5)
-            {
-                // direct bits
-                normalize(rc);
+            cso_put_block(cso, data, cso->block_size);
+            data += cso->block_size;
+            size -= cso->block_size;
+            continue;
+        }
 
-                for (uint32_t i = 0; i < n - 5; i++)
-                {
-                    rc->range >>= 1;
-                    number <<= 1;
-                    if (rc->code < rc->range)
-                    {
-                        number += 1;
-                    }
-                    else
-                    {
-                        rc->code -= rc->range;
-                    }
-                }
-            }
+        uint32_t part = min32(size, cso->block_size - cso->staged);
+        memcpy(cso->block + cso->staged, data, part);
+        cso->staged += part;
+        data += part;
+        size -= part;
+
+        if (cso->staged == cso->block_size)
+        {
+            cso_put_block(cso, cso->block, cso->block_size);
+            cso->staged = 0;
         }
     }
+}
 
-    if (n > 0)
+static void cso_close(CsoWriter* cso)
+{
+    if (cso->staged)
     {
-        number = (number << 1) + rc_bit(rc, prob);
-        if (n > 1)
-        {
-            number = (number << 1) + rc_bit(rc, prob + 1);
-            if (n > 2)
-            {
-                number = (number << 1) + rc_bit(rc, prob + 2);
-            }
-        }
+        cso_put_block(cso, cso->block, cso->staged);
     }
+    cso_flush(cso);
+
+    cso->index[cso->count++] = cso->offset;
+    out_write_at(cso->file, CSO_HEADER_SIZE, cso->index, cso->count * sizeof(uint32_t));
 
-    return number;
+    uint32_t elapsed = pkgi_time_msec() - cso->start;
+    LOG("%s level %d: %llu -> %u bytes (%u%%) in %u ms, %u KB/s", cso->format == ImageZso ? "zso" : "cso",
+        cso->level, cso->input, cso->offset, cso->input ? (uint32_t)((uint64_t)cso->offset * 100 / cso->input) : 0,
+        elapsed, elapsed ? (uint32_t)(cso->input / elapsed) : 0);
+    PKGI_UNUSED(elapsed);
+
+    if (cso->format != ImageZso)
+    {
+        deflateEnd(&cso->z);
+    }
+    pkgi_free(cso->index);
+    pkgi_scratch_put(cso->buffer);
 }
 
+// lzrc decompression code from libkirk by tpu, reworked to keep the range coder in locals.
+// the tables keep their original layout, corrupt streams index past a row into the next one
+typedef struct {
+    uint8_t bm_literal[8][256];
+    uint8_t bm_dist_bits[8][39];
+    uint8_t bm_dist[18][8];
+    uint8_t bm_match[8][8];
+    uint8_t bm_len[8][31];
+} lzrc_probs;
+
+// input past the end reads as zeros
+#define RC_NORMALIZE()                                          \
+    if (range < 0x01000000)                                     \
+    {                                                           \
+        range <<= 8;                                            \
+        code = (code << 8) | (in_ptr < in_end ? *in_ptr++ : 0); \
+    }
+
+// branch free: mask is all ones for a 1 bit
+#define RC_BIT(prob, bit)                                       \
+    do {                                                        \
+        uint8_t* p_ = (prob);                                   \
+        RC_NORMALIZE();                                         \
+        uint32_t bound_ = (range >> 8) * *p_;                   \
+        uint32_t mask_ = 0 - (uint32_t)(code < bound_);         \
+        *p_ -= *p_ >> 3;                                        \
+        *p_ += 31 & mask_;                                      \
+        code -= bound_ & ~mask_;                                \
+        range = (bound_ & mask_) | ((range - bound_) & ~mask_); \
+        bit = mask_ & 1;                                        \
+    } while (0)
+
+#define RC_BITTREE(probs, limit, number)                        \
+    do {                                                        \
+        uint32_t bit_;                                          \
+        number = 1;                                             \
+        do {                                                    \
+            RC_BIT((probs) + number, bit_);                     \
+            number = (number << 1) + bit_;                      \
+        } while (number < (limit));                             \
+    } while (0)
+
+#define RC_NUMBER(prob, n, number)                              \
+    do {                                                        \
+        uint32_t bit_;                                          \
+        number = 1;                                             \
+        if ((n) > 3)                                            \
+        {                                                       \
+            RC_BIT((prob) + 3, bit_);                           \
+            number = (number << 1) + bit_;                      \
+            if ((n) > 4)                                        \
+            {                                                   \
+                RC_BIT((prob) + 3, bit_);                       \
+                number = (number << 1) + bit_;                  \
+                if ((n) > 5)                                    \
+                {                                               \
+                    /* direct bits */                           \
+                    RC_NORMALIZE();                             \
+                    for (uint32_t i_ = 0; i_ < (n) - 5; i_++)   \
+                    {                                           \
+                        range >>= 1;                            \
+                        uint32_t mask_ = 0 - (uint32_t)(code < range); \
+                        code -= range & ~mask_;                 \
+                        number = (number << 1) + (mask_ & 1);   \
+                    }                                           \
+                }                                               \
+            }                                                   \
+        }                                                       \
+        if ((n) > 0)                                            \
+        {                                                       \
+            RC_BIT((prob), bit_);                               \
+            number = (number << 1) + bit_;                      \
+            if ((n) > 1)                                        \
+            {                                                   \
+                RC_BIT((prob) + 1, bit_);                       \
+                number = (number << 1) + bit_;                  \
+                if ((n) > 2)                                    \
+                {                                               \
+                    RC_BIT((prob) + 2, bit_);                   \
+                    number = (number << 1) + bit_;              \
+                }                                               \
+            }                                                   \
+        }                                                       \
+    } while (0)
+
 static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
 {
-    lzrc_decode rc;
-    rc_init(&rc, out, out_len, in, in_len);
+    const uint8_t* input = in;
+    uint8_t* output = out;
+
+    if (in_len < 5)
+    {
+        LOG("ERROR: internal error - lzrc input underflow! pkg may be corrupted?\n");
+        return -1;
+    }
 
-    if (rc.lc & 0x80)
+    uint8_t lc = input[0];
+    uint32_t code = get32be(input + 1);
+    uint32_t range = 0xffffffff;
+
+    if (lc & 0x80)
     {
         // plain text
-        memcpy(rc.output, rc.input + 5, rc.code);
-        return rc.code;
+        if (code > (uint32_t)out_len || code > (uint32_t)in_len - 5)
+        {
+            LOG("ERROR: internal error - lzrc output overflow! pkg may be corrupted?\n");
+            return -1;
+        }
+        memcpy(output, input + 5, code);
+        return code;
     }
 
-    int rc_state = 0;
+    const uint8_t* in_ptr = input + 5;
+    const uint8_t* in_end = input + in_len;
+    uint32_t out_ptr = 0;
+
+    lzrc_probs rc;
+    memset(&rc, 0x80, sizeof(rc));
+
+    uint32_t rc_state = 0;
     uint8_t last_byte = 0;
 
     for (;;)
     {
         uint32_t match_step = 0;
+        uint32_t bit;
 
-        int bit = rc_bit(&rc, &rc.bm_match[rc_state][match_step]);
+        RC_BIT(&rc.bm_match[rc_state][match_step], bit);
         if (bit == 0) // literal
         {
             if (rc_state > 0)
@@ -261,16 +390,16 @@ static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
                 rc_state -= 1;
             }
 
-            int byte = rc_bittree(&rc, &rc.bm_literal[((last_byte >> rc.lc) & 0x07)][0], 0x100);
-            byte -= 0x100;
+            uint32_t byte;
+            RC_BITTREE(&rc.bm_literal[((last_byte >> lc) & 0x07)][0], 0x100, byte);
 
-            if (rc.out_ptr == rc.out_len)
+            if (out_ptr == (uint32_t)out_len)
             {
                 LOG("ERROR: internal error - lzrc output overflow! pkg may be corrupted?\n");
                 return -1;
             }
-            rc.output[rc.out_ptr++] = (uint8_t)byte;
             last_byte = (uint8_t)byte;
+            output[out_ptr++] = last_byte;
         }
         else // match
         {
@@ -279,7 +408,7 @@ static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
             for (int i = 0; i < 7; i++)
             {
                 match_step += 1;
-                bit = rc_bit(&rc, &rc.bm_match[rc_state][match_step]);
+                RC_BIT(&rc.bm_match[rc_state][match_step], bit);
                 if (bit == 0)
                 {
                     break;
@@ -295,12 +424,12 @@ static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
             }
             else
             {
-                uint32_t len_state = ((len_bits - 1) << 2) + ((rc.out_ptr << (len_bits - 1)) & 0x03);
-                match_len = rc_number(&rc, &rc.bm_len[rc_state][len_state], len_bits);
+                uint32_t len_state = ((len_bits - 1) << 2) + ((out_ptr << (len_bits - 1)) & 0x03);
+                RC_NUMBER(&rc.bm_len[rc_state][len_state], len_bits, match_len);
                 if (match_len == 0xFF)
                 {
                     // end of stream
-                    return rc.out_ptr;
+                    return out_ptr;
                 }
             }
 
@@ -312,14 +441,15 @@ static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
                 dist_state += 7;
                 limit = 44;
             }
-            int dist_bits = rc_bittree(&rc, &rc.bm_dist_bits[len_bits][dist_state], limit);
+            uint32_t dist_bits;
+            RC_BITTREE(&rc.bm_dist_bits[len_bits][dist_state], limit, dist_bits);
             dist_bits -= limit;
 
             // find match distance
             uint32_t match_dist;
             if (dist_bits > 0)
             {
-                match_dist = rc_number(&rc, &rc.bm_dist[dist_bits][0], dist_bits);
+                RC_NUMBER(&rc.bm_dist[dist_bits][0], dist_bits, match_dist);
             }
             else
             {
@@ -327,31 +457,50 @@ static int lzrc_decompress(void* out, int out_len, const void* in, int in_len)
             }
 
             // copy match bytes
-            if (match_dist > rc.out_ptr)
+            if (match_dist > out_ptr)
             {
                 LOG("ERROR: internal error - lzrc match_dist out of range! pkg may be corrupted?\n");
                 return -1;
             }
 
-            if (rc.out_ptr + match_len + 1 > rc.out_len)
+            if (out_ptr + match_len + 1 > (uint32_t)out_len)
             {
                 LOG("ERROR: internal error - lzrc output overflow! pkg may be corrupted?\n");
                 return -1;
             }
 
-            const uint8_t* match_src = rc.output + rc.out_ptr - match_dist;
-            for (uint32_t i = 0; i <= match_len; i++)
+            uint8_t* dst = output + out_ptr;
+            const uint8_t* src = dst - match_dist;
+            uint32_t count = match_len + 1;
+            out_ptr += count;
+
+            // 8 byte chunks can't overlap their own source at this distance
+            if (match_dist >= 8)
             {
-                rc.output[rc.out_ptr++] = *match_src++;
+                for (; count >= 8; count -= 8, dst += 8, src += 8)
+                {
+                    uint64_t v;
+                    memcpy(&v, src, sizeof(v));
+                    memcpy(dst, &v, sizeof(v));
+                }
             }
-            last_byte = match_src[-1];
+            while (count--)
+            {
+                *dst++ = *src++;
+            }
+            last_byte = dst[-1];
 
-            rc_state = 6 + ((rc.out_ptr + 1) & 1);
+            rc_state = 6 + ((out_ptr + 1) & 1);
         }
     }
 }
 
-static void init_psp_decrypt(mbedtls_aes_context* key, uint8_t* iv, int eboot, const uint8_t* mac, const uint8_t* header, uint32_t offset1, uint32_t offset2)
+#undef RC_NUMBER
+#undef RC_BITTREE
+#undef RC_BIT
+#undef RC_NORMALIZE
+
+static void init_psp_decrypt(aes128_ctx* key, uint8_t* iv, int eboot, const uint8_t* mac, const uint8_t* header, uint32_t offset1, uint32_t offset2)
 {
     uint8_t tmp[16];
     aes128_init_dec(key, kirk7_key63);
@@ -364,7 +513,7 @@ static void init_psp_decrypt(mbedtls_aes_context* key, uint8_t* iv, int eboot, c
         memcpy(tmp, header + offset1, 16);
     }
 
-    mbedtls_aes_context aes;
+    aes128_ctx aes;
     aes128_init_dec(&aes, kirk7_key38);
     aes128_ecb_decrypt(&aes, tmp, tmp);
 
@@ -381,8 +530,84 @@ static void init_psp_decrypt(mbedtls_aes_context* key, uint8_t* iv, int eboot, c
     }
 }
 
-static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, const uint8_t* pkg_iv, FILE* pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size, int cso)
+// redump style checksums of the plain iso, taken as sectors are written so the
+// image doesn't need a second pass
+typedef struct
+{
+    uLong crc;
+    mbedtls_md5_context md5;
+    mbedtls_sha1_context sha1;
+    uint64_t size;
+} IsoHash;
+
+static void iso_hash_init(IsoHash* hash)
+{
+    hash->crc = crc32(0, Z_NULL, 0);
+    mbedtls_md5_init(&hash->md5);
+    mbedtls_md5_starts(&hash->md5);
+    mbedtls_sha1_init(&hash->sha1);
+    mbedtls_sha1_starts(&hash->sha1);
+    hash->size = 0;
+}
+
+static void iso_hash_update(IsoHash* hash, const uint8_t* data, uint32_t size)
+{
+    hash->crc = crc32(hash->crc, data, size);
+    mbedtls_md5_update(&hash->md5, data, size);
+    mbedtls_sha1_update(&hash->sha1, data, size);
+    hash->size += size;
+}
+
+static void hex_string(char* text, const uint8_t* data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        pkgi_snprintf(text + i * 2, 3, "%02x", data[i]);
+    }
+}
+
+// writes the checksums next to the image as <image>.hashes
+static void iso_hash_finish(IsoHash* hash, const char* path, int ok)
+{
+    uint8_t md5[16];
+    uint8_t sha1[20];
+    char md5_text[sizeof(md5) * 2 + 1];
+    char sha1_text[sizeof(sha1) * 2 + 1];
+
+    mbedtls_md5_finish(&hash->md5, md5);
+    mbedtls_sha1_finish(&hash->sha1, sha1);
+    mbedtls_md5_free(&hash->md5);
+    mbedtls_sha1_free(&hash->sha1);
+
+    if (!ok)
+    {
+        return;
+    }
+
+    hex_string(md5_text, md5, sizeof(md5));
+    hex_string(sha1_text, sha1, sizeof(sha1));
+
+    char text[512];
+    const char* name = pkgi_strrchr(path, '/');
+    int len = pkgi_snprintf(text, sizeof(text), "File: %s\nSize: %llu\nCRC32: %08lx\nMD5: %s\nSHA-1: %s\n",
+        name ? name + 1 : path, hash->size, hash->crc, md5_text, sha1_text);
+
+    char hash_path[1024];
+    pkgi_snprintf(hash_path, sizeof(hash_path), "%s.hashes", path);
+    if (!pkgi_save(hash_path, text, len))
+    {
+        LOG("failed to save %s", hash_path);
+    }
+
+    // the dialog font is 40 hex digits wide, sha-1 gets a line of its own
+    pkgi_snprintf(iso_hashes, sizeof(iso_hashes), "CRC32 %08lx\nMD5 %s\nSHA-1\n%s", hash->crc, md5_text, sha1_text);
+    LOG("%s: crc32 %08lx md5 %s sha1 %s", path, hash->crc, md5_text, sha1_text);
+}
+
+static void unpack_psp_eboot(const char* path, PkgFile* pkg, const PkgItem* item, ImageFormat format, int level)
 {
+    uint64_t item_size = item->data_size;
+
     if (item_size < 0x28)
     {
         LOG("ERROR: eboot.pbp file is too short!\n");
@@ -390,8 +615,10 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
     }
 
     uint8_t eboot_header[0x28];
-    sys_read(pkg, enc_offset + item_offset, eboot_header, sizeof(eboot_header));
-    aes128_ctr_xor(pkg_key, pkg_iv, item_offset / 16, eboot_header, sizeof(eboot_header));
+    if (!pkgi_pkg_read(pkg, item, 0, eboot_header, sizeof(eboot_header)))
+    {
+        return;
+    }
 
     if (memcmp(eboot_header, "\x00PBP", 4) != 0)
     {
@@ -412,8 +639,10 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
     }
 
     uint8_t psar_header[256];
-    sys_read(pkg, enc_offset + item_offset + psar_offset, psar_header, sizeof(psar_header));
-    aes128_ctr_xor(pkg_key, pkg_iv, (item_offset + psar_offset) / 16, psar_header, sizeof(psar_header));
+    if (!pkgi_pkg_read(pkg, item, psar_offset, psar_header, sizeof(psar_header)))
+    {
+        return;
+    }
 
     if (memcmp(psar_header, "NPUMDIMG", 8) != 0)
     {
@@ -431,7 +660,7 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
     uint8_t mac[16];
     aes128_cmac(kirk7_key38, psar_header, 0xc0, mac);
 
-    mbedtls_aes_context psp_key;
+    aes128_ctx psp_key;
     uint8_t psp_iv[16];
     init_psp_decrypt(&psp_key, psp_iv, 1, mac, psar_header, 0xc0, 0xa0);
     aes128_psp_decrypt(&psp_key, psp_iv, 0, psar_header + 0x40, 0x60);
@@ -449,65 +678,79 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
         return;
     }
 
-    uint32_t cso_index = 0;
-    uint32_t cso_offset = 0;
-    uint32_t* cso_block = NULL;
-
-    void* outfile = pkgi_create(path);
-
-    if (cso)
+    // the whole block table is read and decrypted at once instead of one
+    // small read per entry
+    uint8_t* table = pkgi_malloc_tag(MemInstall, block_count * 32);
+    if (!table)
     {
-        uint64_t cso_size = block_count * iso_block * ISO_SECTOR_SIZE;
-
-        uint32_t cso_block_count = (uint32_t)(1 + (cso_size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE);
-        cso_block = pkgi_malloc(cso_block_count * sizeof(uint32_t));
+        LOG("ERROR: out of memory for data.psar offset table!\n");
+        return;
+    }
+    if (!pkgi_pkg_read(pkg, item, psar_offset + iso_table, table, block_count * 32))
+    {
+        pkgi_free(table);
+        return;
+    }
 
-        uint8_t cso_header[CSO_HEADER_SIZE] = { 0x43, 0x49, 0x53, 0x4f };
-        // header size
-        set32le(cso_header + 4, sizeof(cso_header));
-        // original size
-        set64le(cso_header + 8, cso_size);
-        // block size
-        set32le(cso_header + 16, ISO_SECTOR_SIZE);
-        // version
-        cso_header[20] = 1;
+    // a raw block, and the lzrc output of a compressed one
+    uint8_t* data = pkgi_scratch_get(2 * PSAR_BLOCK_MAX);
+    if (!data)
+    {
+        LOG("ERROR: out of memory for data.psar blocks!\n");
+        pkgi_free(table);
+        return;
+    }
+    uint8_t* uncompressed = data + PSAR_BLOCK_MAX;
 
-        pkgi_write(outfile, cso_header, sizeof(cso_header));
-        pkgi_write(outfile, cso_block, cso_block_count * sizeof(uint32_t));
+    CsoWriter writer;
 
-        cso_offset = CSO_HEADER_SIZE + cso_block_count * sizeof(uint32_t);
+    void* outfile = pkgi_create(path);
+    if (!outfile)
+    {
+        pkgi_scratch_put(data);
+        pkgi_free(table);
+        return;
     }
 
-    for (uint32_t i = 0; i < block_count; i++)
+    int cso = (format != ImageIso);
+    if (cso && !cso_open(&writer, outfile, format, (uint64_t)block_count * iso_block * ISO_SECTOR_SIZE, level))
     {
-        uint64_t table_offset = item_offset + psar_offset + iso_table + 32 * i;
+        pkgi_scratch_put(data);
+        pkgi_free(table);
+        pkgi_close(outfile);
+        return;
+    }
 
-        uint8_t table[32];
-        sys_read(pkg, enc_offset + table_offset, table, sizeof(table));
-        aes128_ctr_xor(pkg_key, pkg_iv, table_offset / 16, table, sizeof(table));
+    // blocks are stored mostly in order, so big read-ahead turns them into few sequential reads
+    pkgi_pkg_readahead(pkg, PSAR_READAHEAD_SIZE);
 
+    IsoHash hash;
+    iso_hash_init(&hash);
+    uint32_t i;
+
+    for (i = 0; i < block_count; i++)
+    {
         uint32_t t[8];
         for (size_t k = 0; k < 8; k++)
         {
-            t[k] = get32le(table + k * 4);
+            t[k] = get32le(table + i * 32 + k * 4);
         }
 
         uint32_t block_offset = t[4] ^ t[2] ^ t[3];
         uint32_t block_size = t[5] ^ t[1] ^ t[2];
         uint32_t block_flags = t[6] ^ t[0] ^ t[3];
 
-        if (psar_offset + block_size > item_size)
+        if (block_size > PSAR_BLOCK_MAX || psar_offset + block_offset + block_size > item_size)
         {
             LOG("ERROR: iso block size/offset is too large!\n");
-            return;
+            break;
         }
 
-        uint8_t GCC_ALIGN(16) data[16 * ISO_SECTOR_SIZE];
-
-        uint64_t abs_offset = item_offset + psar_offset + block_offset;
-        update_install_progress(NULL, enc_offset + abs_offset);
-        sys_read(pkg, enc_offset + abs_offset, data, block_size);
-        aes128_ctr_xor(pkg_key, pkg_iv, abs_offset / 16, data, block_size);
+        update_install_progress(NULL, pkg->enc_offset + item->data_offset + psar_offset + block_offset);
+        if (!pkgi_pkg_read(pkg, item, psar_offset + block_offset, data, block_size))
+        {
+            break;
+        }
 
         if ((block_flags & 4) == 0)
         {
@@ -516,14 +759,10 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
 
         if (block_size == iso_block * ISO_SECTOR_SIZE)
         {
+            iso_hash_update(&hash, data, block_size);
             if (cso)
             {
-                for (size_t n = 0; n < iso_block * ISO_SECTOR_SIZE; n += ISO_SECTOR_SIZE)
-                {
-                    cso_block[cso_index] = cso_offset;
-                    cso_offset += zlib_deflate_cso(outfile, data + n, &cso_block[cso_index]);
-                    cso_index++;
-                }
+                cso_write(&writer, data, block_size);
             }
             else
             {
@@ -532,21 +771,16 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
         }
         else
         {
-            uint8_t GCC_ALIGN(16) uncompressed[16 * ISO_SECTOR_SIZE];
-            uint32_t out_size = lzrc_decompress(uncompressed, sizeof(uncompressed), data, block_size);
+            uint32_t out_size = lzrc_decompress(uncompressed, PSAR_BLOCK_MAX, data, block_size);
             if (out_size != iso_block * ISO_SECTOR_SIZE)
             {
                 LOG("ERROR: internal error - lzrc decompression failed! pkg may be corrupted?\n");
-                return;
+                break;
             }
+            iso_hash_update(&hash, uncompressed, out_size);
             if (cso)
             {
-                for (size_t n = 0; n < iso_block * ISO_SECTOR_SIZE; n += ISO_SECTOR_SIZE)
-                {
-                    cso_block[cso_index] = cso_offset;
-                    cso_offset += zlib_deflate_cso(outfile, uncompressed + n, &cso_block[cso_index]);
-                    cso_index++;
-                }
+                cso_write(&writer, uncompressed, out_size);
             }
             else
             {
@@ -557,30 +791,36 @@ static void unpack_psp_eboot(const char* path, mbedtls_aes_context* pkg_key, con
 
     if (cso)
     {
-        cso_block[cso_index++] = cso_offset;
-        out_write_at(outfile, CSO_HEADER_SIZE, cso_block, cso_index * sizeof(uint32_t));
-        pkgi_free(cso_block);
+        cso_close(&writer);
     }
+    pkgi_pkg_readahead(pkg, 0);
+    pkgi_scratch_put(data);
+    pkgi_free(table);
 
     pkgi_close(outfile);
+    iso_hash_finish(&hash, path, i == block_count);
 }
 
-static void unpack_psp_edat(const char* path, mbedtls_aes_context* pkg_key, const uint8_t* pkg_iv, FILE* pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size)
+static void unpack_psp_edat(const char* path, PkgFile* pkg, const PkgItem* item)
 {
-    if (item_size < 0x90 + 0xa0)
+    if (item->data_size < 0x90 + 0xa0)
     {
         LOG("ERROR: EDAT file is to short!\n");
         return;
     }
 
     uint8_t item_header[90];
-    sys_read(pkg, enc_offset + item_offset, item_header, sizeof(item_header));
-    aes128_ctr_xor(pkg_key, pkg_iv, (item_offset) / 16, item_header, sizeof(item_header));
+    if (!pkgi_pkg_read(pkg, item, 0, item_header, sizeof(item_header)))
+    {
+        return;
+    }
     uint8_t key_header_offset = item_header[0xC];
 
     uint8_t key_header[0xa0];
-    sys_read(pkg, enc_offset + item_offset + key_header_offset, key_header, sizeof(key_header));
-    aes128_ctr_xor(pkg_key, pkg_iv, (item_offset + key_header_offset) / 16, key_header, sizeof(key_header));
+    if (!pkgi_pkg_read(pkg, item, key_header_offset, key_header, sizeof(key_header)))
+    {
+        return;
+    }
 
     if (memcmp(key_header, "\x00PGD", 4) != 0)
     {
@@ -599,7 +839,7 @@ static void unpack_psp_edat(const char* path, mbedtls_aes_context* pkg_key, cons
     uint8_t mac[16];
     aes128_cmac(kirk7_key38, key_header, 0x70, mac);
 
-    mbedtls_aes_context psp_key;
+    aes128_ctx psp_key;
     uint8_t psp_iv[16];
     init_psp_decrypt(&psp_key, psp_iv, 0, mac, key_header, 0x70, 0x10);
     aes128_psp_decrypt(&psp_key, psp_iv, 0, key_header + 0x30, 0x30);
@@ -618,155 +858,104 @@ static void unpack_psp_edat(const char* path, mbedtls_aes_context* pkg_key, cons
     uint32_t block_size = 0x10;
     uint32_t block_count = ((data_size + (block_size - 1)) / block_size );
 
+    // blocks are decrypted a chunk at a time, one psp_decrypt call over n blocks
+    // starting at index i gives the same result as n calls for i, i+1, ...
+    uint8_t* buffer = pkgi_scratch_get(EDAT_CHUNK_SIZE);
+    if (!buffer)
+    {
+        LOG("ERROR: out of memory for EDAT buffer!\n");
+        return;
+    }
+
     void* outfile = pkgi_create(path);
-    for (uint32_t i = 0; i < block_count; i++)
+    if (!outfile)
     {
-        uint8_t block[0x10];
-        uint32_t block_offset = (data_offset + (i * block_size)); 
+        pkgi_scratch_put(buffer);
+        return;
+    }
 
-        // update progress bar every 128Kb
-        if (i % 0x2000 == 0)
-            update_install_progress(NULL, enc_offset + item_offset + key_header_offset + block_offset);
+    for (uint32_t i = 0; i < block_count; )
+    {
+        uint32_t count = min32(block_count - i, EDAT_CHUNK_SIZE / block_size);
+        uint32_t block_offset = (data_offset + (i * block_size));
 
-        sys_read(pkg, enc_offset + item_offset + key_header_offset + block_offset, block, block_size);
-        aes128_ctr_xor(pkg_key, pkg_iv, (item_offset + key_header_offset + block_offset)  / 16, block, block_size);
-        aes128_psp_decrypt(&psp_key, psp_iv, i * block_size / 16, block, block_size);
+        update_install_progress(NULL, pkg->enc_offset + item->data_offset + key_header_offset + block_offset);
 
-        uint32_t out_size = 0x10;
-        if ( ((i + 1) * block_size) > data_size )
+        if (!pkgi_pkg_read(pkg, item, key_header_offset + block_offset, buffer, count * block_size))
         {
-            out_size = data_size - (i * block_size);
+            break;
         }
-        pkgi_write(outfile, block, out_size);
+        aes128_psp_decrypt(&psp_key, psp_iv, i * block_size / 16, buffer, count * block_size);
+
+        // the last block may only be partly used
+        uint32_t out_size = min32(count * block_size, data_size - (i * block_size));
+        pkgi_write(outfile, buffer, out_size);
+
+        i += count;
     }
 
     pkgi_close(outfile);
+    pkgi_scratch_put(buffer);
 }
 
-int convert_psp_pkg_iso(const char* pkg_arg, int cso)
+int convert_psp_pkg_iso(const char* pkg_arg, ImageFormat format, int level)
 {
     LOG("pkg2zip v1.8");
     LOG("[*] loading %s...", pkg_arg);
+    iso_hashes[0] = 0;
 
-    uint64_t pkg_size = pkgi_get_size(pkg_arg);
-    void* pkg = pkgi_open(pkg_arg);
-    if (!pkg)
+    // picks the file extension from image_ext[]
+    if ((unsigned)format >= ImageFormatCount)
     {
-        LOG("ERROR: could not open pkg file");
+        LOG("ERROR: unknown image format %d", format);
         return(0);
     }
 
-    uint8_t pkg_header[PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE];
-    sys_read(pkg, 0, pkg_header, sizeof(pkg_header));
-
-    if (get32be(pkg_header) != 0x7f504b47 || get32be(pkg_header + PKG_HEADER_SIZE) != 0x7F657874)
+    PkgFile pkg;
+    if (!pkgi_pkg_open(&pkg, pkg_arg))
     {
-        LOG("ERROR: not a pkg file\n");
+        LOG("ERROR: could not open pkg file");
         return(0);
     }
 
-    // http://www.psdevwiki.com/ps3/PKG_files
-    uint64_t meta_offset = get32be(pkg_header + 8);
-    uint32_t meta_count = get32be(pkg_header + 12);
-    uint32_t item_count = get32be(pkg_header + 20);
-    uint64_t total_size = get64be(pkg_header + 24);
-    uint64_t enc_offset = get64be(pkg_header + 32);
-    uint64_t enc_size = get64be(pkg_header + 40);
-    const uint8_t* iv = pkg_header + 0x70;
-    int key_type = pkg_header[0xe7] & 7;
-
-    if (pkg_size < total_size)
+    if (get32be(pkg.header + PKG_HEADER_SIZE) != 0x7F657874)
     {
-        LOG("ERROR: pkg file is too small\n");
-        return(0);
-    }
-    if (pkg_size < enc_offset + item_count * 32)
-    {
-        LOG("ERROR: pkg file is too small\n");
+        LOG("ERROR: not a pkg file\n");
+        pkgi_pkg_close(&pkg);
         return(0);
     }
 
-    uint32_t content_type = 0;
-    uint32_t items_offset = 0;
-    uint32_t items_size = 0;
+    int type = pkg.type;
+    int key_type = pkg.header[0xe7] & 7;
 
-    for (uint32_t i = 0; i < meta_count; i++)
+    if (type == PKG_TYPE_PSX)
     {
-        uint8_t block[16];
-        sys_read(pkg, meta_offset, block, sizeof(block));
-
-        uint32_t type = get32be(block + 0);
-        uint32_t size = get32be(block + 4);
-
-        if (type == 2)
-        {
-            content_type = get32be(block + 8);
-        }
-        else if (type == 13)
-        {
-            items_offset = get32be(block + 8);
-            items_size = get32be(block + 12);
-        }
-/*
-        else if (type == 10)
-        {
-            // DLC
-            sys_read(pkg, meta_offset + 8 + 8, dlc_install_dir, sizeof(dlc_install_dir));
-        }
-        else if (type == 14)
-        {
-            sfo_offset = get32be(block + 8);
-            sfo_size = get32be(block + 12);
-        }
-*/
-
-        meta_offset += 2 * sizeof(uint32_t) + size;
-    }
-
-    int type;
-
-    // http://www.psdevwiki.com/ps3/PKG_files
-    if (content_type == 6)
-    {
-        type = PKG_TYPE_PSX;
         LOG("[*] unpacking PSX");
     }
-    else if (content_type == 7 || content_type == 0xe || content_type == 0xf || content_type == 0x10)
+    else if (type == PKG_TYPE_PSP)
     {
-        // PSP & PSP-PCEngine / PSP-Go / PSP-Mini / PSP-NeoGeo
-        type = PKG_TYPE_PSP;
         LOG("[*] unpacking PSP");
     }
-    else if (content_type == 9)
+    else if (type == PKG_TYPE_PTF)
     {
-        // PSP Theme
-        type = PKG_TYPE_PTF;
         LOG("[*] unpacking PSP Theme");
     }
     else
     {
-        LOG("ERROR: unsupported content type 0x%x", content_type);
+        LOG("ERROR: unsupported content type 0x%x", pkg.content_type);
+        pkgi_pkg_close(&pkg);
         return(0);
     }
 
-    mbedtls_aes_context ps3_key;
-    uint8_t main_key[16];
-    if (key_type == 1)
-    {
-        memcpy(main_key, pkg_psp_key, sizeof(main_key));
-        aes128_init(&ps3_key, pkg_ps3_key);
-    }
-    else
+    if (key_type != 1)
     {
         LOG("ERROR: unsupported key type 0x%x", key_type);
+        pkgi_pkg_close(&pkg);
         return(0);
     }
 
-    mbedtls_aes_context key;
-    aes128_init(&key, main_key);
-
-    const char* title = (char*)pkg_header + 0x44;
-    const char* id = (char*)pkg_header + 0x37;
+    const char* title = (char*)pkg.header + 0x44;
+    const char* id = (char*)pkg.header + 0x37;
 
     char root[1024];
 
@@ -775,7 +964,7 @@ int convert_psp_pkg_iso(const char* pkg_arg, int cso)
         snprintf(root, sizeof(root), "%s/ISO", pkgi_get_storage_device());
         pkgi_mkdirs(root);
 
-        if (content_type == 7) // && strcmp(category, "HG") == 0)
+        if (pkg.content_type == 7) // && strcmp(category, "HG") == 0)
         {
             snprintf(root, sizeof(root), "%s/PSP/GAME/%.9s", pkgi_get_storage_device(), id);
         }
@@ -793,62 +982,43 @@ int convert_psp_pkg_iso(const char* pkg_arg, int cso)
     else
     {
         LOG("ERROR: unsupported type\n");
+        pkgi_pkg_close(&pkg);
         return(0);
     }
 
-    char path[1024];
-
-    for (uint32_t item_index = 0; item_index < item_count; item_index++)
+    // plain copies of the other items
+    uint8_t* buffer = pkgi_scratch_get(COPY_CHUNK_SIZE);
+    if (!buffer)
     {
-        uint8_t item[32];
-        uint64_t item_offset = items_offset + item_index * 32;
-        sys_read(pkg, enc_offset + item_offset, item, sizeof(item));
-        aes128_ctr_xor(&key, iv, item_offset / 16, item, sizeof(item));
+        LOG("ERROR: out of memory for copy buffer!\n");
+        pkgi_pkg_close(&pkg);
+        return(0);
+    }
 
-        uint32_t name_offset = get32be(item + 0);
-        uint32_t name_size = get32be(item + 4);
-        uint64_t data_offset = get64be(item + 8);
-        uint64_t data_size = get64be(item + 16);
-        uint8_t psp_type = item[24];
-        uint8_t flags = item[27];
+    char path[1024];
+    int result = 1;
 
-        if ((name_offset % 16 != 0) || (data_offset % 16 != 0))
+    for (uint32_t item_index = 0; item_index < pkg.item_count; item_index++)
+    {
+        PkgItem item;
+        if (!pkgi_pkg_get_item(&pkg, item_index, &item))
         {
             LOG("ERROR: pkg file is corrupted");
-            return(0);
+            result = 0;
+            break;
         }
 
-        if (pkg_size < enc_offset + name_offset + name_size ||
-            pkg_size < enc_offset + data_offset + data_size)
-        {
-            LOG("ERROR: pkg file is too short, possibly corrupted\n");
-            return(0);
-        }
-
-        if (name_size >= FILENAME_MAX)
+        char name[FILENAME_MAX];
+        if (!pkgi_pkg_item_name(&pkg, &item, name, sizeof(name)))
         {
             LOG("ERROR: pkg file contains file with very long name\n");
-            return(0);
+            result = 0;
+            break;
         }
 
-        mbedtls_aes_context* item_key;
-        if (type == PKG_TYPE_PSP || type == PKG_TYPE_PSX)
-        {
-            item_key = psp_type == 0x90 ? &key : &ps3_key;
-        }
-        else
-        {
-            item_key = &key;
-        }
-
-        char name[FILENAME_MAX];
-        sys_read(pkg, enc_offset + name_offset, name, name_size);
-        aes128_ctr_xor(item_key, iv, name_offset / 16, (uint8_t*)name, name_size);
-        name[name_size] = 0;
-
         // LOG("[%u/%u] %s\n", item_index + 1, item_count, name);
 
-        if (flags != 4 && flags != 18)
+        if (item.flags != 4 && item.flags != 18)
         {
             if (type == PKG_TYPE_PSX)
             {
@@ -869,16 +1039,16 @@ int convert_psp_pkg_iso(const char* pkg_arg, int cso)
             {
                 snprintf(path, sizeof(path), "%s/PSP/THEME/%s", pkgi_get_storage_device(), name);
                 update_install_progress(path + 15, 0);
-                unpack_psp_edat(path, item_key, iv, pkg, enc_offset, data_offset, data_size);
+                unpack_psp_edat(path, &pkg, &item);
                 continue;
             }
             else if (type == PKG_TYPE_PSP)
             {
                 if (strcmp("USRDIR/CONTENT/EBOOT.PBP", name) == 0)
                 {
-                    snprintf(path, sizeof(path), "%s/ISO/%s [%.9s].%s", pkgi_get_storage_device(), title, id, cso ? "cso" : "iso");
+                    snprintf(path, sizeof(path), "%s/ISO/%s [%.9s].%s", pkgi_get_storage_device(), title, id, image_ext[format]);
                     update_install_progress(path + 4, 0);
-                    unpack_psp_eboot(path, item_key, iv, pkg, enc_offset, data_offset, data_size, cso);
+                    unpack_psp_eboot(path, &pkg, &item, format, level);
                     continue;
                 }
 /*
@@ -903,29 +1073,43 @@ int convert_psp_pkg_iso(const char* pkg_arg, int cso)
                 snprintf(path, sizeof(path), "%s/%s", root, name);
             }
 
-            uint64_t offset = data_offset;
+            uint64_t offset = 0;
 
             void* outfile = pkgi_create(path);
-            while (data_size != 0)
+            while (offset < item.data_size)
             {
-                uint8_t GCC_ALIGN(16) buffer[1 << 16];
-                uint32_t size = (uint32_t)min64(data_size, sizeof(buffer));
-                update_install_progress(path + 14, enc_offset + offset);
+                uint32_t size = (uint32_t)min64(item.data_size - offset, COPY_CHUNK_SIZE);
+                update_install_progress(path + 14, pkg.enc_offset + item.data_offset + offset);
 
-                sys_read(pkg, enc_offset + offset, buffer, size);
-                aes128_ctr_xor(item_key, iv, offset / 16, buffer, size);
+                if (!pkgi_pkg_read(&pkg, &item, offset, buffer, size))
+                {
+                    result = 0;
+                    break;
+                }
                 pkgi_write(outfile, buffer, size);
 
                 offset += size;
-                data_size -= size;
             }
 
             pkgi_close(outfile);
         }
     }
-    pkgi_close(pkg);
-    update_install_progress(NULL, pkg_size);
+    update_install_progress(NULL, pkg.size);
+    pkgi_pkg_close(&pkg);
+    pkgi_scratch_put(buffer);
+
+    LOG("[*] unpacking %s", result ? "completed" : "failed");
+    return result;
+}
+
+int convert_psp_pkg_hashes(char* text, uint32_t size)
+{
+    if (!iso_hashes[0])
+    {
+        return 0;
+    }
 
-    LOG("[*] unpacking completed");
+    pkgi_strncpy(text, size, iso_hashes);
+    iso_hashes[0] = 0;
     return 1;
 }
@@ -5,6 +5,7 @@
 #include "pkgi_dialog.h"
 #include "pkgi_download.h"
 #include "pkgi_utils.h"
+#include "pkgi_scratch.h"
 #include "pkgi_style.h"
 
 #include <stddef.h>
@@ -13,12 +14,15 @@
 
 #define content_filter(c)   (c ? 1 << (7 + c) : DbFilterAllContent)
 
+#define PKGI_PREFETCH_DWELL 750 // msec the selection has to rest on an item before warming up its url
+
 typedef enum  {
     StateError,
     StateRefreshing,
     StateUpdateDone,
     StateMain,
     StateDownload,
+    StateDownloading,
     StateTerminate
 } State;
 
@@ -44,6 +48,12 @@ static int bottom_y;
 static char search_text[256];
 static char error_state[256];
 
+#ifdef PKGI_ENABLE_LOGGING
+#define PKGI_MEM_DUMP_FILE "ms0:/pkgi-mem.txt"
+
+static int mem_overlay;
+#endif
+
 static void reposition(void);
 int psp_network_up(void);
 
@@ -87,24 +97,41 @@ static int install(void)
     pkgi_dialog_start_progress(_("Installing..."), _("Please wait..."), -1);
 
     pkgi_dialog_allow_close(0);
-    int ok = pkgi_install(config.install_mode_iso, !config.keep_pkg);
+    int ok = pkgi_install(config.install_mode_iso, config.cso_level, !config.keep_pkg);
     pkgi_dialog_allow_close(1);
 
     return ok;
 }
 
-static void pkgi_do_download(void)
+static void pkgi_download_thread(void)
 {
     DbItem* item = pkgi_db_get(selected_item);
 
     LOG("download thread start");
 
+    // pkgs converted to an image need the whole file, zips are extracted as they are
+    int stream = config.keep_pkg ? 0 : PKGI_STREAM_ZIP | (config.install_mode_iso ? 0 : PKGI_STREAM_PKG);
+
     pkgi_lock_process();
-    if (pkgi_download(item))
+    if (pkgi_download(item, stream))
     {
-        if (install())
+        char hashes[256];
+        int ok = install();
+        // always taken, so a failed conversion doesn't leave them for the next install
+        int has_hashes = convert_psp_pkg_hashes(hashes, sizeof(hashes));
+
+        if (ok)
         {
-            pkgi_dialog_message(item->name, _("Successfully installed"));
+            if (has_hashes)
+            {
+                char text[256];
+                pkgi_snprintf(text, sizeof(text), "%s\n%s", _("Successfully installed"), hashes);
+                pkgi_dialog_message(item->name, text);
+            }
+            else
+            {
+                pkgi_dialog_message(item->name, _("Successfully installed"));
+            }
             LOG("install succeeded");
         }
         else
@@ -114,6 +141,7 @@ static void pkgi_do_download(void)
         LOG("download completed!");
     }
     pkgi_unlock_process();
+    pkgi_scratch_trim();
 
     if (pkgi_dialog_is_cancelled())
     {
@@ -122,6 +150,8 @@ static void pkgi_do_download(void)
 
     item->presence = PresenceUnknown;
     state = StateMain;
+
+    pkgi_thread_exit();
 }
 
 static uint32_t friendly_size(uint64_t size)
@@ -241,6 +271,39 @@ static void cb_dialog_download(int res)
     state = StateDownload;
 }
 
+// prefetches the item the selection rests on, the download is likely to start there
+static void pkgi_do_prefetch(uint32_t db_count)
+{
+    static uint32_t prefetch_item = (uint32_t)-1;
+    static uint32_t prefetch_time;
+
+    // only while browsing, a download or refresh has the network to itself
+    if (state != StateMain)
+    {
+        return;
+    }
+
+    if (selected_item != prefetch_item)
+    {
+        pkgi_http_prefetch_cancel();
+        prefetch_item = selected_item;
+        prefetch_time = pkgi_time_msec() + PKGI_PREFETCH_DWELL;
+        return;
+    }
+
+    if (!prefetch_time || pkgi_time_msec() < prefetch_time || selected_item >= db_count)
+    {
+        return;
+    }
+
+    prefetch_time = 0;
+    DbItem* item = pkgi_db_get(selected_item);
+    if (item->type != ContentLocal && item->presence != PresenceInstalled)
+    {
+        pkgi_http_prefetch(item->url);
+    }
+}
+
 static void pkgi_do_main(pkgi_input* input)
 {
     int col_titleid = PKGI_MAIN_HMARGIN;
@@ -367,6 +430,8 @@ static void pkgi_do_main(pkgi_input* input)
                 }
             }
         }
+
+        pkgi_do_prefetch(db_count);
     }
     
     int y = font_height*3/2 + PKGI_MAIN_HLINE_EXTRA + PKGI_MAIN_VMARGIN;
@@ -573,6 +638,29 @@ static void pkgi_do_tail(void)
     pkgi_draw_text_z((PKGI_SCREEN_WIDTH - pkgi_text_width(text)) / 2, bottom_y, PKGI_FONT_Z, PKGI_COLOR_TEXT_TAIL, text);
 }
 
+#ifdef PKGI_ENABLE_LOGGING
+// debug builds only, START toggles it
+static void pkgi_do_mem_overlay(void)
+{
+    char text[64];
+    MemUsage usage[MemTagCount];
+    int x = PKGI_MAIN_TEXT_PADDING;
+    int y = PKGI_SCREEN_HEIGHT / 2 - (MemTagCount + 1) * font_height / 2;
+
+    pkgi_draw_fill_rect_z(x, y, PKGI_MENU_Z, 200, (MemTagCount + 1) * font_height, PKGI_COLOR_MENU_BACKGROUND);
+    pkgi_draw_text_z(x, y, PKGI_MENU_TEXT_Z, PKGI_COLOR_TEXT_MENU, "heap      now KB  peak KB");
+
+    pkgi_mem_snapshot(usage);
+    for (int i = 0; i < MemTagCount; i++)
+    {
+        pkgi_snprintf(text, sizeof(text), "%-8s %8u %8u", pkgi_mem_tag_name(i), usage[i].current / 1024, usage[i].peak / 1024);
+
+        y += font_height;
+        pkgi_draw_text_z(x, y, PKGI_MENU_TEXT_Z, PKGI_COLOR_TEXT_MENU, text);
+    }
+}
+#endif
+
 static void pkgi_do_error(void)
 {
     pkgi_draw_text((PKGI_SCREEN_WIDTH - pkgi_text_width(error_state)) / 2, PKGI_SCREEN_HEIGHT / 2, PKGI_COLOR_TEXT_ERROR, error_state);
@@ -668,7 +756,7 @@ static void pkgi_update_check(void)
 
     pkgi_dialog_start_progress(update_item.name, _("Preparing..."), 0);
     
-    if (pkgi_download(&update_item) && install())
+    if (pkgi_download(&update_item, 0) && install())
     {
         pkgi_dialog_message(update_item.name, _("Successfully downloaded PKGi PSP update"));
         LOG("update downloaded!");
@@ -676,7 +764,7 @@ static void pkgi_update_check(void)
 */
 
 end_update:
-    free(buffer);
+    pkgi_free(buffer);
 }
 
 static void pkgi_load_language(const char* lang)
@@ -688,19 +776,6 @@ static void pkgi_load_language(const char* lang)
     mini18n_set_locale(path);
 }
 
-void progress_screen_refresh(void)
-{
-    pkgi_update(&input);
-
-    pkgi_draw_background(background);
-    pkgi_do_head();
-    pkgi_do_dialog(&input);
-    pkgi_do_tail();
-
-    pkgi_swap();
-}
-
-
 int main(int argc, char* argv[])
 {
     SDL_Init(0);
@@ -716,7 +791,7 @@ int main(int argc, char* argv[])
     bottom_y = PKGI_SCREEN_HEIGHT - (PKGI_MAIN_VMARGIN + font_height);
 
     state = StateRefreshing;
-    pkgi_start_thread("refresh_thread", &pkgi_refresh_thread);
+    pkgi_start_thread("refresh_thread", &pkgi_refresh_thread, PKGI_THREAD_STACK_SIZE);
 
     background = pkgi_load_image_buffer(background, png);
 
@@ -754,7 +829,14 @@ int main(int argc, char* argv[])
             break;
 
         case StateDownload:
-            pkgi_do_download();
+            // a prefetch still connecting would compete with the download
+            pkgi_http_prefetch_cancel();
+            state = StateDownloading;
+            pkgi_start_thread("download_thread", &pkgi_download_thread, PKGI_DOWNLOAD_STACK_SIZE);
+            break;
+
+        case StateDownloading:
+            pkgi_download_update_dialog();
             break;
 
         case StateMain:
@@ -768,11 +850,27 @@ int main(int argc, char* argv[])
 
         pkgi_do_tail();
 
+#ifdef PKGI_ENABLE_LOGGING
+        if (input.pressed & PKGI_BUTTON_START)
+        {
+            mem_overlay = !mem_overlay;
+            if (mem_overlay)
+            {
+                pkgi_mem_dump(PKGI_MEM_DUMP_FILE);
+            }
+        }
+        if (mem_overlay)
+        {
+            pkgi_do_mem_overlay();
+        }
+#endif
+
         if (pkgi_dialog_is_open())
         {
             pkgi_do_dialog(&input);
 
-            if (pkgi_dialog_is_cancelled())
+            // a cancelled download keeps its dialog until the thread has stopped and closed it
+            if (pkgi_dialog_is_cancelled() && state != StateDownloading)
             {
                 pkgi_dialog_close();
             }
@@ -830,7 +928,7 @@ int main(int argc, char* argv[])
                 else if (mres == MenuResultRefresh)
                 {
                     state = StateRefreshing;
-                    pkgi_start_thread("refresh_thread", &pkgi_refresh_thread);
+                    pkgi_start_thread("refresh_thread", &pkgi_refresh_thread, PKGI_THREAD_STACK_SIZE);
                 }
             }
         }
@@ -839,6 +937,9 @@ int main(int argc, char* argv[])
     }
 
     LOG("finished");
+#ifdef PKGI_ENABLE_LOGGING
+    pkgi_mem_dump(PKGI_MEM_DUMP_FILE);
+#endif
     mini18n_close();
     pkgi_free_texture(background);
     pkgi_end();
@@ -4,83 +4,347 @@
 #include <string.h>
 
 
-void aes128_init(mbedtls_aes_context* ctx, const uint8_t* key)
+#ifdef PKGI_AES_BUILTIN
+
+// 32-bit table AES for 128-bit keys, the same tables and rounds as the mbedtls software
+// path, without its per block mode checks and the zeroing of the state after every block.
+// the tables are built on first use instead of being kept in the binary
+
+static uint8_t aes_fsb[256];
+static uint8_t aes_rsb[256];
+static uint32_t aes_ft[4][256];
+static uint32_t aes_rt[4][256];
+static uint32_t aes_rcon[10];
+static volatile int aes_tables_ready;
+
+static uint8_t aes_xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+static uint8_t aes_mul(uint8_t x, uint8_t y, const uint8_t* pow, const uint8_t* log)
+{
+    return (x && y) ? pow[(log[x] + log[y]) % 255] : 0;
+}
+
+static inline uint32_t rotl8(uint32_t x)
+{
+    return (x << 8) | (x >> 24);
+}
+
+// same values every time, so two threads racing through here do no harm
+static void aes_gen_tables(void)
+{
+    uint8_t pow[256], log[256];
+    uint8_t x = 1;
+
+    for (int i = 0; i < 256; i++)
+    {
+        pow[i] = x;
+        log[x] = (uint8_t)i;
+        x ^= aes_xtime(x);
+    }
+
+    x = 1;
+    for (int i = 0; i < 10; i++)
+    {
+        aes_rcon[i] = x;
+        x = aes_xtime(x);
+    }
+
+    aes_fsb[0x00] = 0x63;
+    aes_rsb[0x63] = 0x00;
+
+    for (int i = 1; i < 256; i++)
+    {
+        uint8_t y = pow[255 - log[i]];
+        uint8_t s = y;
+        for (int k = 0; k < 4; k++)
+        {
+            y = (uint8_t)((y << 1) | (y >> 7));
+            s ^= y;
+        }
+        s ^= 0x63;
+
+        aes_fsb[i] = s;
+        aes_rsb[s] = (uint8_t)i;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t f = aes_fsb[i];
+        uint8_t r = aes_rsb[i];
+
+        aes_ft[0][i] = (uint32_t)aes_xtime(f) ^ ((uint32_t)f << 8) ^ ((uint32_t)f << 16) ^ ((uint32_t)(aes_xtime(f) ^ f) << 24);
+        aes_rt[0][i] = (uint32_t)aes_mul(0x0e, r, pow, log) ^ ((uint32_t)aes_mul(0x09, r, pow, log) << 8) ^
+                       ((uint32_t)aes_mul(0x0d, r, pow, log) << 16) ^ ((uint32_t)aes_mul(0x0b, r, pow, log) << 24);
+
+        for (int n = 1; n < 4; n++)
+        {
+            aes_ft[n][i] = rotl8(aes_ft[n - 1][i]);
+            aes_rt[n][i] = rotl8(aes_rt[n - 1][i]);
+        }
+    }
+
+    __sync_synchronize();
+    aes_tables_ready = 1;
+}
+
+#define FT(x, n) aes_ft[n][(x) & 0xff]
+#define RT(x, n) aes_rt[n][(x) & 0xff]
+
+#define AES_FROUND(X0, X1, X2, X3, Y0, Y1, Y2, Y3)                                  \
+    X0 = *rk++ ^ FT(Y0, 0) ^ FT(Y1 >> 8, 1) ^ FT(Y2 >> 16, 2) ^ FT(Y3 >> 24, 3);    \
+    X1 = *rk++ ^ FT(Y1, 0) ^ FT(Y2 >> 8, 1) ^ FT(Y3 >> 16, 2) ^ FT(Y0 >> 24, 3);    \
+    X2 = *rk++ ^ FT(Y2, 0) ^ FT(Y3 >> 8, 1) ^ FT(Y0 >> 16, 2) ^ FT(Y1 >> 24, 3);    \
+    X3 = *rk++ ^ FT(Y3, 0) ^ FT(Y0 >> 8, 1) ^ FT(Y1 >> 16, 2) ^ FT(Y2 >> 24, 3)
+
+#define AES_RROUND(X0, X1, X2, X3, Y0, Y1, Y2, Y3)                                  \
+    X0 = *rk++ ^ RT(Y0, 0) ^ RT(Y3 >> 8, 1) ^ RT(Y2 >> 16, 2) ^ RT(Y1 >> 24, 3);    \
+    X1 = *rk++ ^ RT(Y1, 0) ^ RT(Y0 >> 8, 1) ^ RT(Y3 >> 16, 2) ^ RT(Y2 >> 24, 3);    \
+    X2 = *rk++ ^ RT(Y2, 0) ^ RT(Y1 >> 8, 1) ^ RT(Y0 >> 16, 2) ^ RT(Y3 >> 24, 3);    \
+    X3 = *rk++ ^ RT(Y3, 0) ^ RT(Y2 >> 8, 1) ^ RT(Y1 >> 16, 2) ^ RT(Y0 >> 24, 3)
+
+#define SBOX(box, a, b, c, d) \
+    ((uint32_t)box[(a) & 0xff] ^ ((uint32_t)box[((b) >> 8) & 0xff] << 8) ^ \
+    ((uint32_t)box[((c) >> 16) & 0xff] << 16) ^ ((uint32_t)box[((d) >> 24) & 0xff] << 24))
+
+void aes128_init(aes128_ctx* ctx, const uint8_t* key)
+{
+    uint32_t* rk = ctx->rk;
+
+    if (!aes_tables_ready)
+    {
+        aes_gen_tables();
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        rk[i] = get32le(key + 4 * i);
+    }
+
+    for (int i = 0; i < 10; i++, rk += 4)
+    {
+        rk[4] = rk[0] ^ aes_rcon[i] ^ ((uint32_t)aes_fsb[(rk[3] >> 8) & 0xff]) ^
+                ((uint32_t)aes_fsb[(rk[3] >> 16) & 0xff] << 8) ^
+                ((uint32_t)aes_fsb[rk[3] >> 24] << 16) ^
+                ((uint32_t)aes_fsb[rk[3] & 0xff] << 24);
+        rk[5] = rk[1] ^ rk[4];
+        rk[6] = rk[2] ^ rk[5];
+        rk[7] = rk[3] ^ rk[6];
+    }
+}
+
+// the equivalent inverse cipher, round keys in reverse with InvMixColumns applied
+void aes128_init_dec(aes128_ctx* ctx, const uint8_t* key)
+{
+    aes128_ctx enc;
+    aes128_init(&enc, key);
+
+    uint32_t* rk = ctx->rk;
+    const uint32_t* sk = enc.rk + 40;
+
+    for (int i = 0; i < 4; i++)
+    {
+        *rk++ = sk[i];
+    }
+
+    for (int round = 9; round > 0; round--)
+    {
+        sk -= 4;
+        for (int i = 0; i < 4; i++)
+        {
+            uint32_t k = sk[i];
+            *rk++ = RT(aes_fsb[k & 0xff], 0) ^ RT(aes_fsb[(k >> 8) & 0xff], 1) ^
+                    RT(aes_fsb[(k >> 16) & 0xff], 2) ^ RT(aes_fsb[k >> 24], 3);
+        }
+    }
+
+    sk -= 4;
+    for (int i = 0; i < 4; i++)
+    {
+        *rk++ = sk[i];
+    }
+
+    memset(&enc, 0, sizeof(enc));
+}
+
+void aes128_free(aes128_ctx* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void aes128_ecb_encrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* rk = ctx->rk;
+    uint32_t x0, x1, x2, x3, y0, y1, y2, y3;
+
+    x0 = get32le(input + 0) ^ *rk++;
+    x1 = get32le(input + 4) ^ *rk++;
+    x2 = get32le(input + 8) ^ *rk++;
+    x3 = get32le(input + 12) ^ *rk++;
+
+    for (int i = 0; i < 4; i++)
+    {
+        AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+        AES_FROUND(x0, x1, x2, x3, y0, y1, y2, y3);
+    }
+    AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+
+    set32le(output + 0, *rk++ ^ SBOX(aes_fsb, y0, y1, y2, y3));
+    set32le(output + 4, *rk++ ^ SBOX(aes_fsb, y1, y2, y3, y0));
+    set32le(output + 8, *rk++ ^ SBOX(aes_fsb, y2, y3, y0, y1));
+    set32le(output + 12, *rk++ ^ SBOX(aes_fsb, y3, y0, y1, y2));
+}
+
+void aes128_ecb_decrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* rk = ctx->rk;
+    uint32_t x0, x1, x2, x3, y0, y1, y2, y3;
+
+    x0 = get32le(input + 0) ^ *rk++;
+    x1 = get32le(input + 4) ^ *rk++;
+    x2 = get32le(input + 8) ^ *rk++;
+    x3 = get32le(input + 12) ^ *rk++;
+
+    for (int i = 0; i < 4; i++)
+    {
+        AES_RROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+        AES_RROUND(x0, x1, x2, x3, y0, y1, y2, y3);
+    }
+    AES_RROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+
+    set32le(output + 0, *rk++ ^ SBOX(aes_rsb, y0, y3, y2, y1));
+    set32le(output + 4, *rk++ ^ SBOX(aes_rsb, y1, y0, y3, y2));
+    set32le(output + 8, *rk++ ^ SBOX(aes_rsb, y2, y1, y0, y3));
+    set32le(output + 12, *rk++ ^ SBOX(aes_rsb, y3, y2, y1, y0));
+}
+
+#undef SBOX
+#undef AES_RROUND
+#undef AES_FROUND
+#undef RT
+#undef FT
+
+#else
+
+void aes128_init(aes128_ctx* ctx, const uint8_t* key)
 {
     mbedtls_aes_init(ctx);
     mbedtls_aes_setkey_enc(ctx, key, 128);
 }
 
-void aes128_init_dec(mbedtls_aes_context* ctx, const uint8_t* key)
+void aes128_init_dec(aes128_ctx* ctx, const uint8_t* key)
 {
     mbedtls_aes_init(ctx);
     mbedtls_aes_setkey_dec(ctx, key, 128);
-/*
-    mbedtls_aes_context enc;
-    aes128_init(&enc, key);
-*/
 }
 
-void aes128_ecb_encrypt(mbedtls_aes_context* ctx, const uint8_t* input, uint8_t* output)
+void aes128_free(aes128_ctx* ctx)
+{
+    mbedtls_aes_free(ctx);
+}
+
+void aes128_ecb_encrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output)
 {
     mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, input, output);
 }
 
-void aes128_ecb_decrypt(mbedtls_aes_context* ctx, const uint8_t* input, uint8_t* output)
+void aes128_ecb_decrypt(aes128_ctx* ctx, const uint8_t* input, uint8_t* output)
 {
     mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_DECRYPT, input, output);
 }
 
-static void ctr_add(uint8_t* counter, uint64_t n)
+#endif
+
+#define AES_CTR_BATCH 16    // keystream blocks generated per pass
+
+// xor in 32-bit words, memcpy keeps it safe for unaligned buffers
+static void xor_words(uint8_t* dst, const uint8_t* src, size_t size)
 {
-    for (int i=15; i>=0; i--)
+    while (size >= 4)
     {
-        n = n + counter[i];
-        counter[i] = (uint8_t)n;
-        n >>= 8;
+        uint32_t a, b;
+        memcpy(&a, dst, 4);
+        memcpy(&b, src, 4);
+        a ^= b;
+        memcpy(dst, &a, 4);
+        dst += 4;
+        src += 4;
+        size -= 4;
+    }
+
+    while (size--)
+    {
+        *dst++ ^= *src++;
     }
 }
 
-void aes128_ctr_xor(mbedtls_aes_context* context, const uint8_t* iv, uint64_t block, uint8_t* buffer, size_t size)
+// dst ^= a ^ b
+static void xor3_words(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t size)
 {
-    uint8_t tmp[16];
-    uint8_t counter[16];
-    for (uint32_t i=0; i<16; i++)
+    for (size_t i = 0; i < size; i += 4)
     {
-        counter[i] = iv[i];
+        uint32_t x, y, z;
+        memcpy(&x, dst + i, 4);
+        memcpy(&y, a + i, 4);
+        memcpy(&z, b + i, 4);
+        x ^= y ^ z;
+        memcpy(dst + i, &x, 4);
     }
-    ctr_add(counter, block);
+}
+
+// the 128-bit big endian counter is kept as two 64-bit halves, so seeking to
+// any block is one add and stepping to the next block rarely touches the upper half
+void aes128_ctr_xor(aes128_ctx* context, const uint8_t* iv, uint64_t block, uint8_t* buffer, size_t size)
+{
+    uint8_t GCC_ALIGN(16) stream[AES_CTR_BATCH * 16];
+    uint64_t hi = get64be(iv);
+    uint64_t lo = get64be(iv + 8) + block;
 
-    while (size >= 16)
+    if (lo < block)
     {
-        aes128_ecb_encrypt(context, counter, tmp);
-        for (uint32_t i=0; i<16; i++)
-        {
-            *buffer++ ^= tmp[i];
-        }
-        ctr_add(counter, 1);
-        size -= 16;
+        hi++;
     }
 
-    if (size != 0)
+    while (size != 0)
     {
-        aes128_ecb_encrypt(context, counter, tmp);
-        for (size_t i=0; i<size; i++)
+        size_t blocks = (size + 15) / 16;
+        if (blocks > AES_CTR_BATCH)
         {
-            *buffer++ ^= tmp[i];
+            blocks = AES_CTR_BATCH;
         }
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            uint8_t* ks = stream + i * 16;
+            set64be(ks, hi);
+            set64be(ks + 8, lo);
+            aes128_ecb_encrypt(context, ks, ks);
+
+            if (++lo == 0)
+            {
+                hi++;
+            }
+        }
+
+        size_t n = size < blocks * 16 ? size : blocks * 16;
+        xor_words(buffer, stream, n);
+        buffer += n;
+        size -= n;
     }
 }
 
 // https://tools.ietf.org/rfc/rfc4493.txt
 
 typedef struct {
-    mbedtls_aes_context key;
+    aes128_ctx key;
     uint8_t last[16];
     uint8_t block[16];
     uint32_t size;
 } aes128_cmac_ctx;
 
-static void aes128_cmac_process(mbedtls_aes_context* ctx, uint8_t* block, const uint8_t *buffer, uint32_t size)
+static void aes128_cmac_process(aes128_ctx* ctx, uint8_t* block, const uint8_t *buffer, uint32_t size)
 {
     if(size % 16 != 0)
         return;
@@ -177,38 +441,53 @@ void aes128_cmac(const uint8_t* key, const uint8_t* buffer, uint32_t size, uint8
     aes128_cmac_done(&ctx, mac);
 }
 
-void aes128_psp_decrypt(mbedtls_aes_context* ctx, const uint8_t* iv, uint32_t index, uint8_t* buffer, uint32_t size)
+#define AES_PSP_BATCH 16    // blocks decrypted per pass
+
+// the mode xors every decrypted counter with the previous counter, the first one
+// with the counter before index (or zeros at index 0). all counters of a run are laid
+// out back to back, so decryption and the xor each go over the whole run at once
+void aes128_psp_decrypt(aes128_ctx* ctx, const uint8_t* iv, uint32_t index, uint8_t* buffer, uint32_t size)
 {
     if(size % 16 != 0)
         return;
 
-    uint8_t GCC_ALIGN(16) prev[16];
-    uint8_t GCC_ALIGN(16) block[16];
+    uint8_t GCC_ALIGN(16) counters[(AES_PSP_BATCH + 1) * 16];
+    uint8_t GCC_ALIGN(16) out[AES_PSP_BATCH * 16];
+    uint32_t filled = 0;    // counter slots holding the iv part
 
     if (index == 0)
     {
-        memset(prev, 0, 16);
+        memset(counters, 0, 16);
     }
     else
     {
-        memcpy(prev, iv, 12);
-        set32le(prev + 12, index);
+        memcpy(counters, iv, 12);
+        set32le(counters + 12, index);
     }
 
-    memcpy(block, iv, 16);
-    set32le(block + 12, index);
-
-    for (uint32_t i = 0; i < size; i += 16)
+    while (size != 0)
     {
-        set32le(block + 12, get32le(block + 12) + 1);
+        uint32_t blocks = size / 16 < AES_PSP_BATCH ? size / 16 : AES_PSP_BATCH;
+
+        for (; filled < blocks; filled++)
+        {
+            memcpy(counters + (filled + 1) * 16, iv, 12);
+        }
 
-        uint8_t out[16];
-        aes128_ecb_decrypt(ctx, block, out);
+        for (uint32_t i = 1; i <= blocks; i++)
+        {
+            set32le(counters + i * 16 + 12, ++index);
+        }
 
-        for (size_t k = 0; k < 16; k++)
+        for (uint32_t i = 0; i < blocks; i++)
         {
-            *buffer++ ^= prev[k] ^ out[k];
+            aes128_ecb_decrypt(ctx, counters + (i + 1) * 16, out + i * 16);
         }
-        memcpy(prev, block, 16);
+
+        xor3_words(buffer, out, counters, blocks * 16);
+
+        memcpy(counters, counters + blocks * 16, 16);
+        buffer += blocks * 16;
+        size -= blocks * 16;
     }
 }
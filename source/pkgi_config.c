@@ -1,5 +1,6 @@
 #include "pkgi_config.h"
 #include "pkgi.h"
+#include "pkgi_download.h"
 
 static char* skipnonws(char* text, char* end)
 {
@@ -114,6 +115,7 @@ void pkgi_load_config(Config* config, char* refresh_url, uint32_t refresh_len)
     config->filter = DbFilterAll;
     config->version_check = 1;
     config->install_mode_iso = 0;
+    config->cso_level = PKGI_CSO_LEVEL;
     config->keep_pkg = 0;
     config->content = 0;
     config->allow_refresh = 0;
@@ -187,7 +189,13 @@ void pkgi_load_config(Config* config, char* refresh_url, uint32_t refresh_len)
             }
             else if (pkgi_stricmp(key, "install_mode_iso") == 0)
             {
-                config->install_mode_iso = (uint8_t)pkgi_strtoll(value);
+                int64_t mode = pkgi_strtoll(value);
+                config->install_mode_iso = (mode >= 0 && mode <= ImageFormatCount) ? (uint8_t)mode : 0;
+            }
+            else if (pkgi_stricmp(key, "cso_level") == 0)
+            {
+                int64_t level = pkgi_strtoll(value);
+                config->cso_level = (level >= 1 && level <= 9) ? (uint8_t)level : PKGI_CSO_LEVEL;
             }
             else if (pkgi_stricmp(key, "keep_pkg") == 0)
             {
@@ -311,6 +319,11 @@ void pkgi_save_config(const Config* config, const char* update_url, uint32_t upd
         len += pkgi_snprintf(data + len, sizeof(data) - len, "install_mode_iso %d\n", config->install_mode_iso);
     }
 
+    if (config->cso_level != PKGI_CSO_LEVEL)
+    {
+        len += pkgi_snprintf(data + len, sizeof(data) - len, "cso_level %d\n", config->cso_level);
+    }
+
     if (config->keep_pkg)
     {
         len += pkgi_snprintf(data + len, sizeof(data) - len, "keep_pkg 1\n");
@@ -4,6 +4,7 @@
 #include "pkgi_sha256.h"
 #include "pkgi.h"
 #include "pkgi_download.h"
+#include "pkgi_pkg.h"
 
 #include <stddef.h>
 #include <mini18n.h>
@@ -14,6 +15,7 @@
 #define MAX_DB_SIZE (4*1024*1024)
 #define MAX_DB_ITEMS 0x4000
 #define MAX_DB_COLUMNS 32
+#define DB_ARENA_CHUNK (16*1024)
 
 #define EXTDB_ID_LENGTH  110
 #define EXTDB_ID_SHA256  "\x7c\xb2\xf4\x8c\x8f\x8b\x4e\xf0\xfa\x1b\x8e\x7c\x03\x82\xc4\x33\xf9\xe9\x5c\x85\x21\xd3\xac\x6f\xad\x5c\x1c\x9f\x33\xf7\xcb\xc8"
@@ -30,6 +32,17 @@ static uint32_t db_count;
 static DbItem* db_item[MAX_DB_ITEMS];
 static uint32_t db_item_count;
 
+// strings the catalog makes itself instead of pointing into db_data (generated content ids,
+// local pkgs). chunks are kept and rewound by pkgi_db_reload(), so refreshes reuse them
+typedef struct DbArenaChunk {
+    struct DbArenaChunk* next;
+    uint32_t used;
+    char data[DB_ARENA_CHUNK];
+} DbArenaChunk;
+
+static DbArenaChunk* db_arena;
+static DbArenaChunk* db_arena_cur;
+
 typedef enum {
     ColumnContentId,
     ColumnContentType,
@@ -157,10 +170,70 @@ static uint8_t* pkgi_hexbytes(const char* digest, uint32_t length)
     return result;
 }
 
+static void arena_reset(void)
+{
+    for (DbArenaChunk* chunk = db_arena; chunk; chunk = chunk->next)
+    {
+        chunk->used = 0;
+    }
+    db_arena_cur = db_arena;
+}
+
+static char* arena_alloc(uint32_t size)
+{
+    if (size > DB_ARENA_CHUNK)
+    {
+        return NULL;
+    }
+
+    while (!db_arena_cur || db_arena_cur->used + size > DB_ARENA_CHUNK)
+    {
+        DbArenaChunk* next = db_arena_cur ? db_arena_cur->next : db_arena;
+        if (!next)
+        {
+            if ((next = pkgi_malloc_tag(MemDb, sizeof(DbArenaChunk))) == NULL)
+            {
+                LOG("failed to grow catalog arena");
+                return NULL;
+            }
+            next->next = NULL;
+            next->used = 0;
+
+            if (db_arena_cur)
+            {
+                db_arena_cur->next = next;
+            }
+            else
+            {
+                db_arena = next;
+            }
+        }
+        db_arena_cur = next;
+    }
+
+    char* ptr = db_arena_cur->data + db_arena_cur->used;
+    db_arena_cur->used += size;
+    return ptr;
+}
+
+static char* arena_strdup(const char* str)
+{
+    uint32_t size = pkgi_strlen(str) + 1;
+    char* copy = arena_alloc(size);
+    if (copy)
+    {
+        pkgi_memcpy(copy, str, size);
+    }
+    return copy;
+}
+
 static char* generate_contentid(void)
 {
-    char* cid = (char*)pkgi_malloc(37);
-    pkgi_snprintf(cid, 36, "X00000-X%08d_00-0000000000000000", db_count);
+    char* cid = arena_alloc(37);
+    if (cid)
+    {
+        pkgi_snprintf(cid, 36, "X00000-X%08d_00-0000000000000000", db_count);
+    }
     return cid;
 }
 
@@ -293,7 +366,7 @@ static int load_database(uint8_t db_id)
     {
         uint8_t check[SHA256_DIGEST_SIZE];
 
-        mbedtls_sha256((uint8_t*)db_data+db_size, EXTDB_ID_LENGTH, check, 0);
+        sha256((uint8_t*)db_data+db_size, EXTDB_ID_LENGTH, check);
 
         if (pkgi_memequ(EXTDB_ID_SHA256, check, SHA256_DIGEST_SIZE))
         {
@@ -309,7 +382,7 @@ static int load_database(uint8_t db_id)
         }
         else
         {
-            mbedtls_sha256((uint8_t*)db_data+db_size, EXTDB_ID_LENGTH - 9, check, 0);
+            sha256((uint8_t*)db_data+db_size, EXTDB_ID_LENGTH - 9, check);
             if (pkgi_memequ(EXTDB3_ID_SHA256, check, SHA256_DIGEST_SIZE))
             {
                 dbf.delimiter = '\t';
@@ -364,8 +437,17 @@ static int load_database(uint8_t db_id)
             db[db_count].url = dbf.data[ColumnUrl].data;
             db[db_count].size = pkgi_strtoll(dbf.data[ColumnSize].data);
             db[db_count].digest = pkgi_hexbytes(dbf.data[ColumnChecksum].data, SHA256_DIGEST_SIZE);
-            db_item[db_count] = db + db_count;
-            db_count++;
+
+            // no room left for a generated contentid, the row is left out and its slot reused
+            if (!db[db_count].content)
+            {
+                LOG("out of memory for the contentid of %s, skipping it", db[db_count].name);
+            }
+            else
+            {
+                db_item[db_count] = db + db_count;
+                db_count++;
+            }
         }
 
         if (db_count == MAX_DB_ITEMS)
@@ -393,9 +475,8 @@ static int load_database(uint8_t db_id)
 static void scan_local_packages(void)
 {
     DIR* d;
-    void* fp;
+    PkgFile pkg;
     struct dirent *dirp;
-    int64_t fsize;
     char buf[256];
 
     pkgi_snprintf(buf, sizeof(buf), "%s%s", pkgi_get_storage_device(), pkgi_get_temp_folder());
@@ -405,21 +486,21 @@ static void scan_local_packages(void)
 	while ((dirp = readdir(d)) != NULL)
 	{
         pkgi_snprintf(buf, sizeof(buf), "%s%s/%s", pkgi_get_storage_device(), pkgi_get_temp_folder(), dirp->d_name);
-        fsize = pkgi_get_size(buf);
-        if ((fp = pkgi_open(buf)) == NULL)
+        if (!pkgi_pkg_open(&pkg, buf))
             continue;
 
-        pkgi_read(fp, buf, 0x80);
-        pkgi_close(fp);
-
-        if (!pkgi_memequ(buf, "\x7FPKG\x80\x00\x00\x02", 8) || fsize != get32be(buf + 0x1C))
+        pkgi_pkg_close(&pkg);
+        if (!pkgi_memequ(pkg.header, "\x7FPKG\x80\x00\x00\x02", 8) || pkg.size != pkg.total_size)
             continue;
 
         memset(&db[db_count], 0, sizeof(DbItem));
-        db[db_count].content = strdup(buf + 0x30);
+        db[db_count].content = arena_strdup(pkg.content_id);
         db[db_count].type = ContentLocal;
-        db[db_count].name = strdup(dirp->d_name);
-        db[db_count].size = fsize;
+        db[db_count].name = arena_strdup(dirp->d_name);
+        if (!db[db_count].content || !db[db_count].name)
+            break;
+
+        db[db_count].size = pkg.size;
         db[db_count].url = db[db_count].name;
         db[db_count].description = db[db_count].name + pkgi_strlen(dirp->d_name);
         db_item[db_count] = &db[db_count];
@@ -459,8 +540,9 @@ int pkgi_db_reload(char* error, uint32_t error_size)
     db_size = 0;
     db_count = 0;
     db_item_count = 0;
+    arena_reset();
 
-    if (!db_data && (db_data = malloc(MAX_DB_SIZE)) == NULL)
+    if (!db_data && (db_data = pkgi_malloc_tag(MemDb, MAX_DB_SIZE)) == NULL)
     {
         pkgi_snprintf(error, error_size, "failed to allocate memory for database");
         return 0;
@@ -724,7 +806,7 @@ int pkgi_db_load_xml_updates(const char* content_id, const char* name)
     if (!doc)
     {
         LOG("XML: could not parse file %s", updUrl);
-        free(buffer);
+        pkgi_free(buffer);
         return 0;
     }
 
@@ -785,7 +867,7 @@ int pkgi_db_load_xml_updates(const char* content_id, const char* name)
     /*free the document *
     xmlFreeDoc(doc);
     xmlCleanupParser();
-    free(buffer);
+    pkgi_free(buffer);
 
     return updates;
     */
@@ -130,6 +130,13 @@ void pkgi_dialog_update_progress(const char* text, const char* extra, const char
 {
     pkgi_dialog_lock();
 
+    // the download thread may have replaced the progress dialog with its result already
+    if (dialog_type != DialogProgress)
+    {
+        pkgi_dialog_unlock();
+        return;
+    }
+
     pkgi_strncpy(dialog_text, sizeof(dialog_text), text);
     pkgi_strncpy(dialog_extra, sizeof(dialog_extra), extra ? extra : "");
     pkgi_strncpy(dialog_eta, sizeof(dialog_eta), eta ? eta : "");
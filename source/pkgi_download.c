@@ -6,14 +6,34 @@
 
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dirent.h>
 #include <mini18n.h>
 
+#define PKGI_RESUME_MAGIC       0x52494B50 // "PKIR"
+#define PKGI_RESUME_VERSION     2
+#define PKGI_RESUME_INTERVAL    (8 * 1024 * 1024)
+
+#define PKGI_RETRY_MAX          5       // attempts in a row without any progress
+#define PKGI_RETRY_DELAY        1000    // first backoff delay (msec), doubled on every attempt
+#define PKGI_RETRY_MAX_DELAY    30000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t offset;        // pkg bytes covered by the hash state
+    uint64_t total_size;    // pkg size reported by the server
+    sha256_ctx sha;
+    char url[512];
+    char validator[PKGI_HTTP_VALIDATOR_MAX];   // ETag or Last-Modified of the pkg, added in version 2
+} ResumeData;
 
 static char root[256];
 static char resume_file[256];
+static char resume_temp[256];
 
 static pkgi_http* http;
 static const DbItem* db_item;
@@ -23,7 +43,26 @@ static uint64_t initial_offset;  // where http download resumes
 static uint64_t download_offset; // pkg absolute offset
 static uint64_t download_size;   // pkg total size (from http request)
 
-static mbedtls_sha256_context sha;
+static uint32_t retry_count;     // reconnects since the transfer last made progress
+static uint32_t retry_total;     // reconnects during the whole transfer
+static uint64_t retry_offset;    // download offset at the last reconnect
+
+static sha256_ctx sha;
+
+static ResumeData resume_data;
+static uint64_t resume_offset;     // where the checkpoint says the pkg file ends
+static uint64_t resume_next;       // next offset to write a checkpoint at
+
+typedef enum {
+    StreamNone,
+    StreamZip,
+    StreamPkg,
+} StreamType;
+
+static StreamType stream_type;  // installs the download on the fly instead of saving it
+static int stream_installed;    // nothing left for pkgi_install() to do
+static int stream_failed;       // 1 on install errors, -1 if the file must be downloaded first
+static void* stream;
 
 static void* item_file;     // current file handle
 static char item_name[256]; // current file name
@@ -33,29 +72,145 @@ static char item_path[256]; // current file path
 static uint64_t total_size;
 
 // UI stuff
-static char dialog_extra[256];
-static char dialog_eta[256];
 static uint32_t info_start;
 static uint32_t info_update;
+static uint64_t info_offset;
+static uint32_t info_speed;
+static uint32_t info_total;     // when the whole download started
+
+typedef enum {
+    ProgressNone,
+    ProgressDownload,
+    ProgressRetry,
+} ProgressPhase;
+
+// progress record published by the download thread and read by the UI loop,
+// the sequence is odd while the record is being written
+typedef struct {
+    ProgressPhase phase;
+    uint64_t offset;
+    uint64_t total;
+    uint32_t speed;
+    uint32_t retry_count;
+    uint32_t retry_total;
+    char name[256];
+} DownloadProgress;
+
+static volatile uint32_t progress_seq;
+static DownloadProgress progress;
+static uint32_t progress_seen;
+
+
+static void publish_progress(ProgressPhase phase)
+{
+    progress_seq++;
+    __sync_synchronize();
+
+    progress.phase = phase;
+    progress.offset = download_offset;
+    progress.total = total_size;
+    progress.speed = info_speed;
+    progress.retry_count = retry_count;
+    progress.retry_total = retry_total;
+    pkgi_strncpy(progress.name, sizeof(progress.name), item_name);
+
+    __sync_synchronize();
+    progress_seq++;
+}
+
+// never waits for the writer, a torn read is simply picked up on the next frame
+static int read_progress(DownloadProgress* out)
+{
+    uint32_t seq = progress_seq;
+    __sync_synchronize();
+
+    if ((seq & 1) || seq == progress_seen)
+    {
+        return 0;
+    }
+
+    pkgi_memcpy(out, &progress, sizeof(*out));
+    __sync_synchronize();
+
+    if (seq != progress_seq)
+    {
+        return 0;
+    }
 
+    progress_seen = seq;
+    return 1;
+}
 
-static void calculate_eta(uint32_t speed)
+static void format_eta(char* eta, uint32_t size, const DownloadProgress* p)
 {
-    uint64_t seconds = (total_size - download_offset) / speed;
+    eta[0] = 0;
+    if (p->speed == 0 || p->offset >= p->total)
+    {
+        return;
+    }
+
+    uint64_t seconds = (p->total - p->offset) / p->speed;
     if (seconds < 60)
     {
-        pkgi_snprintf(dialog_eta, sizeof(dialog_eta), "%s: %us", _("ETA"), (uint32_t)seconds);
+        pkgi_snprintf(eta, size, "%s: %us", _("ETA"), (uint32_t)seconds);
     }
     else if (seconds < 3600)
     {
-        pkgi_snprintf(dialog_eta, sizeof(dialog_eta), "%s: %um %02us", _("ETA"), (uint32_t)(seconds / 60), (uint32_t)(seconds % 60));
+        pkgi_snprintf(eta, size, "%s: %um %02us", _("ETA"), (uint32_t)(seconds / 60), (uint32_t)(seconds % 60));
     }
     else
     {
         uint32_t hours = (uint32_t)(seconds / 3600);
         uint32_t minutes = (uint32_t)((seconds - hours * 3600) / 60);
-        pkgi_snprintf(dialog_eta, sizeof(dialog_eta), "%s: %uh %02um", _("ETA"), hours, minutes);
+        pkgi_snprintf(eta, size, "%s: %uh %02um", _("ETA"), hours, minutes);
+    }
+}
+
+void pkgi_download_update_dialog(void)
+{
+    DownloadProgress p;
+    char text[256];
+    char extra[256];
+    char eta[256];
+
+    if (!read_progress(&p) || p.phase == ProgressNone)
+    {
+        return;
+    }
+
+    float percent = p.total ? (float)((double)p.offset / p.total) : 0.f;
+
+    // the download thread closes the dialog itself once it has stopped
+    if (pkgi_dialog_is_cancelled())
+    {
+        pkgi_dialog_update_progress(_("Cancelling..."), NULL, NULL, percent);
+        return;
+    }
+
+    if (p.phase == ProgressRetry)
+    {
+        pkgi_snprintf(text, sizeof(text), "%s (%u/%u)", _("Connection lost, retrying..."), p.retry_count, PKGI_RETRY_MAX);
+        pkgi_dialog_update_progress(text, NULL, NULL, percent);
+        return;
+    }
+
+    if (p.speed > 10 * 1000 * 1024)
+    {
+        pkgi_snprintf(extra, sizeof(extra), "%u %s/s", p.speed / 1024 / 1024, _("MB"));
+    }
+    else
+    {
+        pkgi_snprintf(extra, sizeof(extra), "%u %s/s", p.speed / 1024, _("KB"));
+    }
+
+    if (p.retry_total)
+    {
+        uint32_t len = pkgi_strlen(extra);
+        pkgi_snprintf(extra + len, sizeof(extra) - len, " (%s %u)", _("retry"), p.retry_total);
     }
+
+    format_eta(eta, sizeof(eta), &p);
+    pkgi_dialog_update_progress(p.name, extra, eta, percent);
 }
 
 /* follow the CURLOPT_XFERINFOFUNCTION callback definition */
@@ -65,52 +220,140 @@ static int update_progress(void *p, int64_t dltotal, int64_t dlnow, int64_t ulto
 
     if (info_now >= info_update)
     {
-        char text[256];
-        pkgi_snprintf(text, sizeof(text), "%s", item_name);
+        // download speed, smoothed over the last updates so stalls and dips show up
+        uint64_t delta = download_offset > info_offset ? download_offset - info_offset : 0;
+        uint32_t speed = (uint32_t)((delta * 1000) / max32(info_now - info_start, 1));
+        info_speed = info_speed ? (info_speed + speed) / 2 : speed;
+
+        publish_progress(ProgressDownload);
+        info_start = info_now;
+        info_offset = download_offset;
+        info_update = info_now + 500;
+    }
+
+    return (pkgi_dialog_is_cancelled());
+}
+
+// writes the checkpoint to a temp file first, so a crash never leaves a torn .resume behind.
+// the rename can't replace the old .resume, so that is removed before it. a crash in between
+// leaves only the temp file, which pkgi_download() falls back to
+static void save_resume_checkpoint(void)
+{
+    // a failed checkpoint waits for the next interval too, instead of retrying on every write
+    resume_next = download_offset + PKGI_RESUME_INTERVAL;
+
+    if (!item_file || !pkgi_flush(item_file))
+    {
+        LOG("cannot flush %s, skipping checkpoint", item_path);
+        return;
+    }
+
+    resume_data.magic = PKGI_RESUME_MAGIC;
+    resume_data.version = PKGI_RESUME_VERSION;
+    resume_data.offset = download_offset;
+    resume_data.total_size = total_size;
+    resume_data.sha = sha;
+    pkgi_strncpy(resume_data.url, sizeof(resume_data.url), db_item->url);
+
+    if (!pkgi_save(resume_temp, &resume_data, sizeof(resume_data)))
+    {
+        LOG("cannot save %s", resume_temp);
+        return;
+    }
+
+    pkgi_rm(resume_file);
+    if (!pkgi_rename(resume_temp, resume_file))
+    {
+        LOG("cannot rename %s", resume_temp);
+        return;
+    }
 
-        if (download_resume)
+    LOG("resume checkpoint saved at %llu", download_offset);
+}
+
+static int load_resume_file(const char* path, const char* url)
+{
+    int size = pkgi_load(path, &resume_data, sizeof(resume_data));
+
+    int current = (size == sizeof(resume_data) && resume_data.version == PKGI_RESUME_VERSION);
+    // version 1 checkpoints end before the validator, they only get the size check
+    int older = (resume_data.version == 1 && size >= (int)offsetof(ResumeData, validator) && size < (int)sizeof(resume_data));
+
+    if (resume_data.magic == PKGI_RESUME_MAGIC && (current || older))
+    {
+        if (older)
         {
-            // if resuming download, then there is no "download speed"
-            dialog_extra[0] = 0;
+            resume_data.validator[0] = 0;
         }
-        else
-        {
-            // report download speed
-            uint32_t speed = (uint32_t)(((download_offset - initial_offset) * 1000) / (info_now - info_start));
-            if (speed > 10 * 1000 * 1024)
-            {
-                pkgi_snprintf(dialog_extra, sizeof(dialog_extra), "%u %s/s", speed / 1024 / 1024, _("MB"));
-            }
-            else if (speed > 1000)
-            {
-                pkgi_snprintf(dialog_extra, sizeof(dialog_extra), "%u %s/s", speed / 1024, _("KB"));
-            }
 
-            if (speed != 0)
-            {
-                // report ETA
-                calculate_eta(speed);
-            }
+        if (strncmp(resume_data.url, url, sizeof(resume_data.url)) != 0)
+        {
+            LOG("resume file %s is for a different url", path);
+            return 0;
         }
 
-        float percent = total_size ? (float)((double)download_offset / total_size) : 0.f;
+        sha = resume_data.sha;
+        resume_offset = resume_data.offset;
+        return 1;
+    }
 
-        pkgi_dialog_update_progress(text, dialog_extra, dialog_eta, percent);
-        info_update = info_now + 500;
-        progress_screen_refresh();
+    // legacy resume file, only the hash state of the whole partial file
+    if (size == sizeof(sha))
+    {
+        pkgi_memcpy(&sha, &resume_data, sizeof(sha));
+        resume_data.total_size = 0;
+        resume_data.validator[0] = 0;
+        resume_offset = (uint64_t)-1;
+        return 1;
     }
 
-    return (pkgi_dialog_is_cancelled());
+    return 0;
+}
+
+static void* stream_open(void)
+{
+    return stream_type == StreamZip ? (void*)zip_stream_open() : (void*)pkg_stream_open();
+}
+
+static int stream_close(int keep)
+{
+    int res = stream_type == StreamZip ? zip_stream_close(stream, keep) : pkg_stream_close(stream, keep);
+    stream = NULL;
+    return res;
+}
+
+static size_t write_stream_data(const void* buffer, size_t size)
+{
+    int res = stream_type == StreamZip ? zip_stream_write(stream, buffer, size) : pkg_stream_write(stream, buffer, size);
+    if (res <= 0)
+    {
+        stream_failed = res ? -1 : 1;
+        return 0;
+    }
+
+    download_offset += size;
+    sha256_update(&sha, buffer, size);
+    return size;
 }
 
-static size_t write_verify_data(void *buffer, size_t size, size_t nmemb, void *stream)
+static size_t write_verify_data(void *buffer, size_t size, size_t nmemb, void *userdata)
 {
     size_t realsize = size * nmemb;
 
+    if (stream)
+    {
+        return write_stream_data(buffer, realsize);
+    }
+
     if (pkgi_write(item_file, buffer, realsize))
     {
         download_offset += realsize;
-        mbedtls_sha256_update(&sha, buffer, realsize);
+        sha256_update(&sha, buffer, realsize);
+
+        if (download_offset >= resume_next)
+        {
+            save_resume_checkpoint();
+        }
         return (realsize);
     }
 
@@ -122,60 +365,171 @@ static void download_start(void)
     LOG("resuming pkg download from %llu offset", initial_offset);
     download_offset = initial_offset;
     download_resume = 0;
+    resume_next = initial_offset + PKGI_RESUME_INTERVAL;
     info_update = pkgi_time_msec() + 1000;
     pkgi_dialog_set_progress_title(_("Downloading..."));
 }
 
-static int download_data(void)
+// returns 1 when the transfer can start, 0 on errors, and -1 if the request should be retried
+static int download_request(void)
 {
+    LOG("requesting %s @ %llu", db_item->url, download_offset);
+    http = pkgi_http_get(db_item->url, db_item->content, download_offset);
     if (!http)
     {
-        LOG("requesting %s @ %llu", db_item->url, initial_offset);
-        http = pkgi_http_get(db_item->url, db_item->content, initial_offset);
-        if (!http)
+        pkgi_dialog_error(_("Could not send HTTP request"));
+        return 0;
+    }
+
+    int64_t http_length;
+    if (!pkgi_http_response_length(http, &http_length))
+    {
+        if (pkgi_http_can_retry(http))
         {
-            pkgi_dialog_error(_("Could not send HTTP request"));
-            return 0;
+            return -1;
         }
 
-        int64_t http_length;
-        if (!pkgi_http_response_length(http, &http_length))
+        pkgi_dialog_error(_("HTTP request failed"));
+        return 0;
+    }
+    if (http_length < 0)
+    {
+        pkgi_dialog_error(_("HTTP response has unknown length"));
+        return 0;
+    }
+
+    const char* validator = pkgi_http_validator(http);
+
+    if (total_size == 0)
+    {
+        download_size = http_length;
+        total_size = initial_offset + download_size;
+
+        if ((resume_data.total_size && resume_data.total_size != total_size) ||
+            (resume_data.validator[0] && validator[0] && strcmp(resume_data.validator, validator) != 0))
         {
-            pkgi_dialog_error(_("HTTP request failed"));
+            LOG("pkg changed (%llu != %llu, %s != %s), removing resume data", total_size, resume_data.total_size,
+                validator, resume_data.validator);
+            pkgi_rm(resume_file);
+            pkgi_rm(resume_temp);
+            pkgi_dialog_error(_("pkg changed on server, try downloading again"));
             return 0;
         }
-        if (http_length < 0)
+
+        // servers that send no validator on this response keep the one of the checkpoint
+        if (validator[0])
         {
-            pkgi_dialog_error(_("HTTP response has unknown length"));
-            return 0;
+            pkgi_strncpy(resume_data.validator, sizeof(resume_data.validator), validator);
         }
 
-        download_size = http_length;
-        total_size = initial_offset + download_size;
-
         if (!pkgi_check_free_space(http_length))
         {
             LOG("error! out of space");
             return 0;
         }
+    }
+    else if (download_offset + http_length != total_size ||
+        (resume_data.validator[0] && validator[0] && strcmp(resume_data.validator, validator) != 0))
+    {
+        LOG("pkg changed (%llu != %llu, %s != %s) while reconnecting", download_offset + http_length, total_size,
+            validator, resume_data.validator);
+        pkgi_dialog_error(_("pkg changed on server, try downloading again"));
+        return 0;
+    }
 
-        LOG("http response length = %lld, total pkg size = %llu", http_length, total_size);
-        info_start = pkgi_time_msec();
-        info_update = pkgi_time_msec() + 500;
+    LOG("http response length = %lld, total pkg size = %llu", http_length, total_size);
+    info_start = pkgi_time_msec();
+    info_update = info_start + 500;
+    info_offset = download_offset;
+    return 1;
+}
+
+// exponential backoff, with the upper half of the delay randomized so clients don't reconnect in lockstep
+static int download_retry_wait(void)
+{
+    uint32_t delay = min32(PKGI_RETRY_DELAY << (retry_count - 1), PKGI_RETRY_MAX_DELAY);
+    delay = delay / 2 + pkgi_time_msec() % (delay / 2 + 1);
+
+    LOG("connection lost @ %llu, retry %u/%u in %u msec", download_offset, retry_count, PKGI_RETRY_MAX, delay);
+
+    publish_progress(ProgressRetry);
+
+    uint32_t start = pkgi_time_msec();
+    while (pkgi_time_msec() - start < delay)
+    {
+        if (pkgi_dialog_is_cancelled())
+        {
+            return 0;
+        }
+        pkgi_sleep(100);
     }
 
-    if (!pkgi_http_read(http, &write_verify_data, &update_progress))
+    info_speed = 0;
+    return 1;
+}
+
+static int download_data(void)
+{
+    retry_count = 0;
+    retry_total = 0;
+    retry_offset = download_offset;
+
+    for (;;)
     {
-        pkgi_save(resume_file, &sha, sizeof(sha));
+        int res = http ? 1 : download_request();
+
+        if (res > 0)
+        {
+            if (pkgi_http_read(http, &write_verify_data, &update_progress))
+            {
+                return 1;
+            }
+
+            if (stream_failed)
+            {
+                return 0;
+            }
+
+            save_resume_checkpoint();
+
+            if (pkgi_dialog_is_cancelled())
+            {
+                return 0;
+            }
+            if (!pkgi_http_can_retry(http))
+            {
+                pkgi_dialog_error(_("HTTP download error"));
+                return 0;
+            }
+        }
+        else if (res == 0)
+        {
+            return 0;
+        }
+
+        // only attempts that made no progress at all count against the limit
+        if (download_offset != retry_offset)
+        {
+            retry_count = 0;
+            retry_offset = download_offset;
+        }
 
-        if (!pkgi_dialog_is_cancelled())
+        if (retry_count == PKGI_RETRY_MAX)
         {
             pkgi_dialog_error(_("HTTP download error"));
+            return 0;
         }
-        return 0;
-    }
 
-    return 1;
+        pkgi_http_close(http);
+        http = NULL;
+
+        retry_count++;
+        retry_total++;
+        if (!download_retry_wait())
+        {
+            return 0;
+        }
+    }
 }
 
 // this includes creating of all the parent folders necessary to actually create file
@@ -222,6 +576,66 @@ static int resume_partial_file(void)
     return 1;
 }
 
+static int check_integrity(const uint8_t* digest)
+{
+    if (!digest)
+    {
+        LOG("no integrity provided, skipping check");
+        return 1;
+    }
+
+    uint8_t check[SHA256_DIGEST_SIZE];
+    sha256_finish(&sha, check);
+
+    LOG("checking integrity of pkg");
+    if (!pkgi_memequ(digest, check, SHA256_DIGEST_SIZE))
+    {
+        LOG("pkg integrity is wrong, removing %s & resume data", item_path);
+
+        pkgi_rm(item_path);
+        pkgi_rm(resume_file);
+        pkgi_rm(resume_temp);
+
+        pkgi_dialog_error(_("pkg integrity failed, try downloading again"));
+        return 0;
+    }
+
+    LOG("pkg integrity check succeeded");
+    return 1;
+}
+
+// sets initial_offset to where the partial file continues, cutting off what the checkpoint does not cover
+static int rewind_to_checkpoint(void)
+{
+    initial_offset = pkgi_get_size(item_path);
+    if (resume_offset == (uint64_t)-1)
+    {
+        // legacy resume file, its hash state covers the whole partial file
+        return 1;
+    }
+
+    if ((int64_t)initial_offset < 0 || initial_offset < resume_offset)
+    {
+        LOG("partial file is shorter than checkpoint (%lld < %llu)", initial_offset, resume_offset);
+        pkgi_rm(resume_file);
+        pkgi_rm(resume_temp);
+        pkgi_dialog_error(_("cannot resume file, try downloading again"));
+        return 0;
+    }
+
+    // drop data written after the last checkpoint, the hash state does not cover it
+    if (initial_offset > resume_offset && !pkgi_truncate(item_path, resume_offset))
+    {
+        char error[256];
+        pkgi_snprintf(error, sizeof(error), "%s %s", _("cannot resume file"), item_name);
+        pkgi_dialog_error(error);
+        return 0;
+    }
+
+    initial_offset = resume_offset;
+    return 1;
+}
+
 static int download_pkg_file(void)
 {
     int result = 0;
@@ -232,21 +646,62 @@ static int download_pkg_file(void)
 
     if (download_resume)
     {
-        initial_offset = pkgi_get_size(item_path);
-        if (!resume_partial_file()) goto bail;
+        if (!rewind_to_checkpoint() || !resume_partial_file()) goto bail;
         download_start();
     }
+    else if (stream_type != StreamNone && (stream = stream_open()) != NULL)
+    {
+        LOG("installing %s while downloading", item_name);
+    }
     else
     {
         if (!create_file()) goto bail;
     }
 
-    if (!download_data()) goto bail;
+    if (!download_data())
+    {
+        if (stream_failed >= 0) goto bail;
+
+        // start over and keep the file for pkgi_install()
+        LOG("%s cannot be streamed, downloading it first", item_name);
+        stream_close(0);
+        stream_failed = 0;
+
+        pkgi_http_close(http);
+        http = NULL;
+        total_size = 0;
+        download_offset = 0;
+        sha256_init(&sha);
+
+        if (!create_file() || !download_data()) goto bail;
+    }
+
+    if (stream)
+    {
+        // the files are already in place, a wrong hash takes them out again
+        int verified = check_integrity(db_item->digest);
+        int installed = stream_close(verified);
+        if (!verified) goto bail;
+        if (!installed)
+        {
+            pkgi_dialog_error(stream_type == StreamZip ? _("Could not extract the zip file") : _("Could not install the pkg file"));
+            goto bail;
+        }
+        stream_installed = 1;
+    }
 
     LOG("%s downloaded", item_path);
     result = 1;
 
 bail:
+    if (stream)
+    {
+        if (stream_failed > 0)
+        {
+            pkgi_dialog_error(stream_type == StreamZip ? _("Could not extract the zip file") : _("Could not install the pkg file"));
+        }
+        stream_close(0);
+    }
     if (item_file != NULL)
     {
         pkgi_close(item_file);
@@ -255,33 +710,6 @@ bail:
     return result;
 }
 
-static int check_integrity(const uint8_t* digest)
-{
-    if (!digest)
-    {
-        LOG("no integrity provided, skipping check");
-        return 1;
-    }
-
-    uint8_t check[SHA256_DIGEST_SIZE];
-    mbedtls_sha256_finish(&sha, check);
-
-    LOG("checking integrity of pkg");
-    if (!pkgi_memequ(digest, check, SHA256_DIGEST_SIZE))
-    {
-        LOG("pkg integrity is wrong, removing %s & resume data", item_path);
-
-        pkgi_rm(item_path);
-        pkgi_rm(resume_file);
-
-        pkgi_dialog_error(_("pkg integrity failed, try downloading again"));
-        return 0;
-    }
-
-    LOG("pkg integrity check succeeded");
-    return 1;
-}
-
 static int create_rap(const char* contentid, const uint8_t* rap)
 {
     LOG("creating %s.rap", contentid);
@@ -308,15 +736,25 @@ static int is_zip(const char* filename)
     return extension && (pkgi_stricmp(extension, ".zip") == 0);
 }
 
-int pkgi_download(const DbItem* item)
+int pkgi_download(const DbItem* item, int stream_flags)
 {
     int result = 0;
 
+    stream_type = StreamNone;
+    stream_installed = 0;
+    stream_failed = 0;
+
     pkgi_snprintf(root, sizeof(root), "%s.%s", item->content, is_zip(item->url) ? "zip" : "pkg");
     LOG("package installation file: %s", root);
 
     pkgi_snprintf(resume_file, sizeof(resume_file), "%s%s/%s.resume", pkgi_get_storage_device(), pkgi_get_temp_folder(), item->content);
-    if (pkgi_load(resume_file, &sha, sizeof(sha)) == sizeof(sha))
+    pkgi_snprintf(resume_temp, sizeof(resume_temp), "%s.tmp", resume_file);
+
+    memset(&resume_data, 0, sizeof(resume_data));
+    resume_next = PKGI_RESUME_INTERVAL;
+
+    // a crash between removing the old checkpoint and renaming the new one leaves only the temp file
+    if (load_resume_file(resume_file, item->url) || load_resume_file(resume_temp, item->url))
     {
         LOG("resume file exists, trying to resume");
         pkgi_dialog_set_progress_title(_("Resuming..."));
@@ -334,8 +772,17 @@ int pkgi_download(const DbItem* item)
         LOG("cannot load resume file, starting download from scratch");
         pkgi_dialog_set_progress_title(_("Downloading..."));
         download_resume = 0;
-        mbedtls_sha256_init(&sha);
-        mbedtls_sha256_starts(&sha, 0);
+        // partial downloads resume into the archive file, so only fresh ones are streamed
+        if (is_zip(item->url))
+        {
+            stream_type = (stream_flags & PKGI_STREAM_ZIP) ? StreamZip : StreamNone;
+        }
+        else
+        {
+            stream_type = (stream_flags & PKGI_STREAM_PKG) ? StreamPkg : StreamNone;
+        }
+        memset(&resume_data, 0, sizeof(resume_data));
+        sha256_init(&sha);
     }
 
     http = NULL;
@@ -346,10 +793,14 @@ int pkgi_download(const DbItem* item)
     initial_offset = 0;
     db_item = item;
 
-    dialog_extra[0] = 0;
-    dialog_eta[0] = 0;
+    retry_count = 0;
+    retry_total = 0;
+    publish_progress(ProgressNone);
     info_start = pkgi_time_msec();
     info_update = info_start + 1000;
+    info_total = info_start;
+    info_offset = 0;
+    info_speed = 0;
 
     if (item->rap)
     {
@@ -357,9 +808,17 @@ int pkgi_download(const DbItem* item)
     }
 
     if (!download_pkg_file()) goto finish;
-    if (!check_integrity(item->digest)) goto finish;
+
+    uint32_t elapsed = max32(pkgi_time_msec() - info_total, 1);
+    LOG("downloaded %llu bytes in %u ms (%llu KB/s), resumed at %llu, %u reconnects", download_offset - initial_offset,
+        elapsed, (download_offset - initial_offset) * 1000 / elapsed / 1024, initial_offset, retry_total);
+    PKGI_UNUSED(elapsed);
+
+    // streamed installs were checked before the files were kept
+    if (!stream_installed && !check_integrity(item->digest)) goto finish;
 
     pkgi_rm(resume_file);
+    pkgi_rm(resume_temp);
     result = 1;
 
 finish:
@@ -367,6 +826,7 @@ finish:
     {
         pkgi_http_close(http);
     }
+    publish_progress(ProgressNone);
 
     return result;
 }
@@ -378,22 +838,33 @@ void update_install_progress(const char *filename, int64_t progress)
     update_progress(NULL, 0, 0, 0, 0);
 }
 
-int pkgi_install(int iso_mode, int remove_pkg)
+int pkgi_install(int iso_mode, int cso_level, int remove_pkg)
 {
     int result;
 
+    if (stream_installed)
+    {
+        LOG("installed during the download");
+        return 1;
+    }
+
     download_size = pkgi_get_size(item_path);
     info_start = pkgi_time_msec();
+    info_offset = 0;
+    info_speed = 0;
 
     initial_offset = 0;
     download_offset = 0;
     total_size = download_size;
+    retry_total = 0;
 
     // check if it's a zip file
     if (is_zip(item_path))
         result = extract_zip(item_path);
     else
-        result = iso_mode ? convert_psp_pkg_iso(item_path, (iso_mode == 2)) : install_psp_pkg(item_path);
+        result = iso_mode ? convert_psp_pkg_iso(item_path, (ImageFormat)(iso_mode - 1), cso_level) : install_psp_pkg(item_path);
+
+    publish_progress(ProgressNone);
 
     if (result && remove_pkg)
     {
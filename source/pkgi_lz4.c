@@ -0,0 +1,142 @@
+#include "pkgi_lz4.h"
+
+#include <string.h>
+
+// greedy single-pass LZ4 block compressor, enough for the small image blocks
+// written by pkg2iso; output is standard LZ4 and decodes with any LZ4 reader
+
+#define LZ4_HASH_BITS     12
+#define LZ4_MIN_MATCH     4
+#define LZ4_MFLIMIT       12    // last match must start this far from the end
+#define LZ4_LAST_LITERALS 5     // and the block must end with this many literals
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t* put_length(uint8_t* op, uint32_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* put_literals(uint8_t* op, uint8_t* token, const uint8_t* lit, uint32_t len)
+{
+    if (len >= 15)
+    {
+        *token = 15 << 4;
+        op = put_length(op, len - 15);
+    }
+    else
+    {
+        *token = (uint8_t)(len << 4);
+    }
+
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+uint32_t pkgi_lz4_compress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t dst_size)
+{
+    uint16_t table[1 << LZ4_HASH_BITS];
+
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + size;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + dst_size;
+
+    if (size > PKGI_LZ4_MAX_INPUT)
+    {
+        return 0;
+    }
+
+    if (size >= LZ4_MFLIMIT)
+    {
+        const uint8_t* match_start_limit = end - LZ4_MFLIMIT;
+        const uint8_t* match_end_limit = end - LZ4_LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+
+        while (ip < match_start_limit)
+        {
+            uint32_t seq = read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+
+            if (ref >= ip || read32(ref) != seq)
+            {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* match = ip + LZ4_MIN_MATCH;
+            const uint8_t* match_ref = ref + LZ4_MIN_MATCH;
+            while (match < match_end_limit && *match == *match_ref)
+            {
+                match++;
+                match_ref++;
+            }
+
+            uint32_t lit_len = (uint32_t)(ip - anchor);
+            uint32_t match_len = (uint32_t)(match - ip) - LZ4_MIN_MATCH;
+
+            // token + literal length + literals + offset + match length, worst case
+            if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > op_end)
+            {
+                return 0;
+            }
+
+            uint8_t* token = op++;
+            op = put_literals(op, token, anchor, lit_len);
+
+            uint32_t offset = (uint32_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            if (match_len >= 15)
+            {
+                *token |= 15;
+                op = put_length(op, match_len - 15);
+            }
+            else
+            {
+                *token |= (uint8_t)match_len;
+            }
+
+            ip = match;
+            anchor = ip;
+        }
+    }
+
+    uint32_t lit_len = (uint32_t)(end - anchor);
+    if (op + 1 + lit_len / 255 + 1 + lit_len > op_end)
+    {
+        return 0;
+    }
+
+    uint8_t* token = op++;
+    op = put_literals(op, token, anchor, lit_len);
+
+    return (uint32_t)(op - dst);
+}
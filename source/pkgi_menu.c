@@ -81,7 +81,9 @@ static MenuEntry format_entries[] =
 {
     { MenuMode, "Digital", 0 },
     { MenuMode, "ISO", 1 },
-    { MenuMode, "CSO", 2 }
+    { MenuMode, "CSO", 2 },
+    { MenuMode, "ZSO", 3 },
+    { MenuMode, "CSO v2", 4 }
 };
 
 int pkgi_menu_is_open(void)
@@ -149,6 +151,8 @@ void pkgi_menu_start(int search_clear, const Config* config)
     format_entries[0].text = _("Digital");
     format_entries[1].text = _("ISO");
     format_entries[2].text = _("CSO");
+    format_entries[3].text = _("ZSO");
+    format_entries[4].text = _("CSO v2");
 
     if (pkgi_menu_width)
         return;
@@ -0,0 +1,367 @@
+#include "pkgi_pkg.h"
+#include "pkgi_aes.h"
+#include "pkgi.h"
+#include "pkgi_scratch.h"
+
+#include <pspiofilemgr.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PKG_TABLE_BATCH 512             // item table entries decrypted per read
+#define PKG_CACHE_SIZE  (64 * 1024)     // default per cache slot, bigger reads bypass the cache
+
+// https://wiki.henkaku.xyz/vita/Packages#AES_Keys
+static const uint8_t pkg_ps3_key[] = { 0x2e, 0x7b, 0x71, 0xd7, 0xc9, 0xc9, 0xa1, 0x4e, 0xa3, 0x22, 0x1f, 0x18, 0x88, 0x28, 0xb8, 0xf8 };
+static const uint8_t pkg_psp_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
+
+
+static int read_direct(PkgFile* pkg, uint64_t offset, void* buffer, uint32_t size)
+{
+    if (pkg->mem)
+    {
+        if (offset + size > pkg->mem_size)
+        {
+            LOG("pkg data at %llu + %u is not in memory", offset, size);
+            return 0;
+        }
+        memcpy(buffer, pkg->mem + offset, size);
+        return 1;
+    }
+
+    if (sceIoLseek(pkg->fd, offset, PSP_SEEK_SET) != (SceOff)offset)
+    {
+        return 0;
+    }
+    pkg->read_count++;
+    return (sceIoRead(pkg->fd, buffer, size) == (int)size);
+}
+
+// small reads go through two read-ahead slots, so interleaved reads from two places (like an
+// index table and the data it points to) don't keep evicting each other
+static int read_raw(PkgFile* pkg, uint64_t offset, void* buffer, uint32_t size)
+{
+    if (offset + size > pkg->size)
+    {
+        LOG("read past the end of pkg (%llu + %u)", offset, size);
+        return 0;
+    }
+
+    if (size >= pkg->cache_slot || pkg->mem)
+    {
+        return read_direct(pkg, offset, buffer, size);
+    }
+
+    if (!pkg->cache)
+    {
+        // borrowed like the installer buffers, reads go around the cache when the budget is used up
+        pkg->cache = pkgi_scratch_get(2 * pkg->cache_slot);
+        if (!pkg->cache)
+        {
+            return read_direct(pkg, offset, buffer, size);
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (offset >= pkg->cache_offset[i] && offset + size <= pkg->cache_offset[i] + pkg->cache_size[i])
+        {
+            memcpy(buffer, pkg->cache + i * pkg->cache_slot + (offset - pkg->cache_offset[i]), size);
+            pkg->cache_last = i;
+            return 1;
+        }
+    }
+
+    uint32_t slot = pkg->cache_last ^ 1;
+    uint32_t fill = (uint32_t)min64(pkg->cache_slot, pkg->size - offset);
+
+    pkg->cache_size[slot] = 0;
+    if (!read_direct(pkg, offset, pkg->cache + slot * pkg->cache_slot, fill))
+    {
+        return 0;
+    }
+
+    pkg->cache_offset[slot] = offset;
+    pkg->cache_size[slot] = fill;
+    pkg->cache_last = slot;
+
+    memcpy(buffer, pkg->cache + slot * pkg->cache_slot, size);
+    return 1;
+}
+
+static aes128_ctx* item_key(PkgFile* pkg, const PkgItem* item)
+{
+    if (pkg->type == PKG_TYPE_PSP || pkg->type == PKG_TYPE_PSX)
+    {
+        return item->psp_type == PKG_ITEM_PSP ? &pkg->key : &pkg->ps3_key;
+    }
+    return &pkg->key;
+}
+
+static int parse_metadata(PkgFile* pkg)
+{
+    uint64_t meta_offset = get32be(pkg->header + 8);
+    uint32_t meta_count = get32be(pkg->header + 12);
+
+    for (uint32_t i = 0; i < meta_count; i++)
+    {
+        uint8_t block[16];
+        if (!read_direct(pkg, meta_offset, block, sizeof(block)))
+        {
+            return 0;
+        }
+
+        uint32_t type = get32be(block + 0);
+        uint32_t size = get32be(block + 4);
+
+        if (type == 2)
+        {
+            pkg->content_type = get32be(block + 8);
+        }
+        else if (type == 6)
+        {
+            // title id, as used for the install folder
+            if (!read_direct(pkg, meta_offset + 8, pkg->title_id, 9))
+            {
+                return 0;
+            }
+        }
+        else if (type == 13)
+        {
+            pkg->items_offset = get32be(block + 8);
+        }
+
+        meta_offset += 2 * sizeof(uint32_t) + size;
+    }
+
+    // http://www.psdevwiki.com/ps3/PKG_files
+    if (pkg->content_type == 6)
+    {
+        pkg->type = PKG_TYPE_PSX;
+    }
+    else if (pkg->content_type == 7 || pkg->content_type == 0xe || pkg->content_type == 0xf || pkg->content_type == 0x10)
+    {
+        // PSP & PSP-PCEngine / PSP-Go / PSP-Mini / PSP-NeoGeo
+        pkg->type = PKG_TYPE_PSP;
+    }
+    else if (pkg->content_type == 9)
+    {
+        // PSP Theme
+        pkg->type = PKG_TYPE_PTF;
+    }
+
+    return 1;
+}
+
+static int parse_header(PkgFile* pkg, const char* path)
+{
+    if (pkg->size < sizeof(pkg->header) || !read_direct(pkg, 0, pkg->header, sizeof(pkg->header)))
+    {
+        return 0;
+    }
+
+    if (get32be(pkg->header) != 0x7f504b47)
+    {
+        LOG("%s is not a pkg file", path);
+        return 0;
+    }
+
+    pkg->item_count = get32be(pkg->header + 20);
+    pkg->total_size = get64be(pkg->header + 24);
+    pkg->enc_offset = get64be(pkg->header + 32);
+    pkg->enc_size = get64be(pkg->header + 40);
+    memcpy(pkg->content_id, pkg->header + 0x30, sizeof(pkg->content_id) - 1);
+
+    if (pkg->size < pkg->total_size || pkg->size < pkg->enc_offset + (uint64_t)pkg->item_count * PKG_ITEM_SIZE)
+    {
+        LOG("pkg file %s is too small", path);
+        return 0;
+    }
+
+    if (!parse_metadata(pkg))
+    {
+        return 0;
+    }
+
+    if (!pkg->title_id[0])
+    {
+        memcpy(pkg->title_id, pkg->content_id + 7, 9);
+    }
+
+    aes128_init(&pkg->key, pkg_psp_key);
+    aes128_init(&pkg->ps3_key, pkg_ps3_key);
+    return 1;
+}
+
+int pkgi_pkg_open(PkgFile* pkg, const char* path)
+{
+    memset(pkg, 0, sizeof(PkgFile));
+    pkg->cache_slot = PKG_CACHE_SIZE;
+
+    pkg->fd = sceIoOpen(path, PSP_O_RDONLY, 0777);
+    if (pkg->fd < 0)
+    {
+        return 0;
+    }
+
+    pkg->size = sceIoLseek(pkg->fd, 0, PSP_SEEK_END);
+    if (!parse_header(pkg, path))
+    {
+        sceIoClose(pkg->fd);
+        pkg->fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+int pkgi_pkg_open_memory(PkgFile* pkg, const uint8_t* data, uint32_t size, uint64_t total_size)
+{
+    memset(pkg, 0, sizeof(PkgFile));
+    pkg->cache_slot = PKG_CACHE_SIZE;
+    pkg->fd = -1;
+    pkg->mem = data;
+    pkg->mem_size = size;
+    pkg->size = total_size;
+
+    return parse_header(pkg, "pkg stream");
+}
+
+void pkgi_pkg_close(PkgFile* pkg)
+{
+    if (pkg->fd >= 0)
+    {
+        LOG("pkg closed after %u reads", pkg->read_count);
+        sceIoClose(pkg->fd);
+    }
+    aes128_free(&pkg->key);
+    aes128_free(&pkg->ps3_key);
+
+    pkgi_free(pkg->table);
+    pkgi_scratch_put(pkg->cache);
+    pkg->fd = -1;
+    pkg->table = NULL;
+    pkg->cache = NULL;
+}
+
+void pkgi_pkg_readahead(PkgFile* pkg, uint32_t size)
+{
+    pkgi_scratch_put(pkg->cache);
+    pkg->cache = NULL;
+    pkg->cache_size[0] = pkg->cache_size[1] = 0;
+    pkg->cache_slot = size ? size : PKG_CACHE_SIZE;
+}
+
+int pkgi_pkg_get_item(PkgFile* pkg, uint32_t index, PkgItem* item)
+{
+    if (index >= pkg->item_count)
+    {
+        return 0;
+    }
+
+    if (!pkg->table && (pkg->table = pkgi_malloc_tag(MemInstall, PKG_TABLE_BATCH * PKG_ITEM_SIZE)) == NULL)
+    {
+        LOG("failed to allocate item table");
+        return 0;
+    }
+
+    if (index < pkg->table_start || index >= pkg->table_start + pkg->table_count)
+    {
+        uint64_t offset = pkg->items_offset + (uint64_t)index * PKG_ITEM_SIZE;
+        uint32_t count = min32(pkg->item_count - index, PKG_TABLE_BATCH);
+
+        pkg->table_count = 0;
+        if (!read_direct(pkg, pkg->enc_offset + offset, pkg->table, count * PKG_ITEM_SIZE))
+        {
+            LOG("failed to read item table at %llu", offset);
+            return 0;
+        }
+        aes128_ctr_xor(&pkg->key, pkg->header + 0x70, offset / 16, pkg->table, count * PKG_ITEM_SIZE);
+
+        pkg->table_start = index;
+        pkg->table_count = count;
+    }
+
+    const uint8_t* entry = pkg->table + (index - pkg->table_start) * PKG_ITEM_SIZE;
+
+    item->name_offset = get32be(entry + 0);
+    item->name_size = get32be(entry + 4);
+    item->data_offset = get64be(entry + 8);
+    item->data_size = get64be(entry + 16);
+    item->psp_type = entry[24];
+    item->flags = entry[27];
+
+    if ((item->name_offset % 16 != 0) || (item->data_offset % 16 != 0))
+    {
+        LOG("pkg item %u is not aligned", index);
+        return 0;
+    }
+
+    if (pkg->size < pkg->enc_offset + item->name_offset + item->name_size ||
+        pkg->size < pkg->enc_offset + item->data_offset + item->data_size)
+    {
+        LOG("pkg item %u is past the end of file", index);
+        return 0;
+    }
+
+    return 1;
+}
+
+int pkgi_pkg_item_name(PkgFile* pkg, const PkgItem* item, char* name, uint32_t size)
+{
+    if (item->name_size >= size)
+    {
+        LOG("pkg item name is too long (%u)", item->name_size);
+        return 0;
+    }
+
+    if (!read_raw(pkg, pkg->enc_offset + item->name_offset, name, item->name_size))
+    {
+        return 0;
+    }
+
+    aes128_ctr_xor(item_key(pkg, item), pkg->header + 0x70, item->name_offset / 16, (uint8_t*)name, item->name_size);
+    name[item->name_size] = 0;
+    return 1;
+}
+
+void pkgi_pkg_decrypt(PkgFile* pkg, const PkgItem* item, uint64_t offset, void* buffer, uint32_t size)
+{
+    aes128_ctr_xor(item_key(pkg, item), pkg->header + 0x70, (item->data_offset + offset) / 16, buffer, size);
+}
+
+int pkgi_pkg_read(PkgFile* pkg, const PkgItem* item, uint64_t offset, void* buffer, uint32_t size)
+{
+    uint8_t* out = buffer;
+
+    if (offset + size > item->data_size)
+    {
+        LOG("read past the end of pkg item (%llu + %u)", offset, size);
+        return 0;
+    }
+
+    // the keystream is per 16 byte block, decrypt a partial leading block on its own
+    uint32_t skip = (item->data_offset + offset) % 16;
+    if (skip)
+    {
+        uint8_t block[16];
+        uint32_t part = min32(16 - skip, size);
+
+        if (!read_raw(pkg, pkg->enc_offset + item->data_offset + offset - skip, block, 16))
+        {
+            return 0;
+        }
+        pkgi_pkg_decrypt(pkg, item, offset - skip, block, 16);
+        memcpy(out, block + skip, part);
+
+        out += part;
+        offset += part;
+        size -= part;
+    }
+
+    if (size && !read_raw(pkg, pkg->enc_offset + item->data_offset + offset, out, size))
+    {
+        return 0;
+    }
+
+    pkgi_pkg_decrypt(pkg, item, offset, out, size);
+    return 1;
+}
@@ -49,6 +49,13 @@ static uint32_t * free_mem;         // Pointer after last texture
 
 #define PKGI_USER_AGENT "Mozilla/5.0 (PLAYSTATION PORTABLE; 1.00)"
 
+// a transfer slower than this for the whole period is treated as stalled
+#define PKGI_HTTP_LOW_SPEED_LIMIT   1024L
+#define PKGI_HTTP_LOW_SPEED_TIME    30L
+
+#define PKGI_PREFETCH_MAX           2       // warm connections kept around
+#define PKGI_PREFETCH_RANGE         "0-255" // enough to check the pkg/zip magic
+
 
 struct pkgi_http
 {
@@ -56,8 +63,19 @@ struct pkgi_http
     uint64_t size;
     uint64_t offset;
     CURL *curl;
+    CURLcode res;
+    int etag;       // validator holds an ETag, a Last-Modified date never replaces it
+    char validator[PKGI_HTTP_VALIDATOR_MAX];
 };
 
+typedef struct
+{
+    CURL *curl;
+    uint64_t size;      // total size reported by the server
+    uint32_t time;      // last use, oldest entry gets evicted
+    char url[512];
+} pkgi_prefetch;
+
 typedef struct 
 {
     pkgi_texture circle;
@@ -76,6 +94,7 @@ char * strcasestr(const char *haystack, const char *needle);
 
 static char disp_list[0x10000] __attribute__((aligned(64)));
 static SceLwMutexWorkarea g_dialog_lock;
+static SceLwMutexWorkarea g_mem_lock;
 
 static int g_ok_button;
 static int g_cancel_button;
@@ -88,6 +107,11 @@ static uint16_t g_ime_text[SCE_IME_DIALOG_MAX_TEXT_LENGTH];
 static uint16_t g_ime_input[SCE_IME_DIALOG_MAX_TEXT_LENGTH + 1];
 
 static pkgi_http g_http[4];
+static pkgi_prefetch g_prefetch[PKGI_PREFETCH_MAX];
+static SceLwMutexWorkarea g_prefetch_lock;
+static char g_prefetch_url[512];
+static volatile uint32_t g_prefetch_gen;
+static int g_prefetch_running;
 static t_tex_buttons tex_buttons;
 
 SDL_Window* window;                         // SDL window
@@ -164,14 +188,146 @@ int64_t pkgi_strtoll(const char* str)
     return str[0] == '-' ? -res : res;
 }
 
-void *pkgi_malloc(uint32_t size)
+// every block starts with its size and tag, padded so the caller gets malloc's alignment
+#define MEM_HEADER_SIZE 16
+
+typedef struct
+{
+    uint32_t size;
+    uint32_t tag;
+} MemHeader;
+
+static const char* mem_tag_names[MemTagCount] = { "other", "db", "fonts", "textures", "http", "install" };
+static uint32_t mem_current[MemTagCount];
+static uint32_t mem_peak[MemTagCount];
+static uint32_t mem_blocks[MemTagCount];
+
+static void mem_count(MemTag tag, int32_t size, int32_t blocks)
+{
+    sceKernelLockLwMutex(&g_mem_lock, 1, NULL);
+    mem_current[tag] += size;
+    mem_blocks[tag] += blocks;
+    if (mem_current[tag] > mem_peak[tag])
+    {
+        mem_peak[tag] = mem_current[tag];
+    }
+    sceKernelUnlockLwMutex(&g_mem_lock, 1);
+}
+
+void pkgi_mem_add(MemTag tag, int32_t size)
+{
+    mem_count(tag, size, 0);
+}
+
+void pkgi_mem_snapshot(MemUsage usage[MemTagCount])
+{
+    sceKernelLockLwMutex(&g_mem_lock, 1, NULL);
+    for (int i = 0; i < MemTagCount; i++)
+    {
+        usage[i].current = mem_current[i];
+        usage[i].peak = mem_peak[i];
+        usage[i].blocks = mem_blocks[i];
+    }
+    sceKernelUnlockLwMutex(&g_mem_lock, 1);
+}
+
+const char* pkgi_mem_tag_name(MemTag tag)
+{
+    return mem_tag_names[tag];
+}
+
+int pkgi_mem_dump(const char* path)
+{
+    char text[512];
+    MemUsage usage[MemTagCount];
+    uint32_t len = pkgi_snprintf(text, sizeof(text), "%-10s %10s %10s %8s\n", "tag", "current", "peak", "blocks");
+
+    pkgi_mem_snapshot(usage);
+    for (int i = 0; i < MemTagCount; i++)
+    {
+        len += pkgi_snprintf(text + len, sizeof(text) - len, "%-10s %10u %10u %8u\n", mem_tag_names[i], usage[i].current, usage[i].peak, usage[i].blocks);
+        LOG("mem %s: %u bytes, %u peak, %u blocks", mem_tag_names[i], usage[i].current, usage[i].peak, usage[i].blocks);
+    }
+
+    return pkgi_save(path, text, len);
+}
+
+void* pkgi_malloc_tag(MemTag tag, uint32_t size)
+{
+    MemHeader* h = malloc(MEM_HEADER_SIZE + size);
+    if (!h)
+    {
+        return NULL;
+    }
+
+    h->size = size;
+    h->tag = tag;
+    mem_count(tag, size, 1);
+    return (uint8_t*)h + MEM_HEADER_SIZE;
+}
+
+void* pkgi_malloc(uint32_t size)
+{
+    return pkgi_malloc_tag(MemOther, size);
+}
+
+void* pkgi_calloc_tag(MemTag tag, uint32_t count, uint32_t size)
+{
+    if (size && count > UINT32_MAX / size)
+    {
+        return NULL;
+    }
+
+    void* ptr = pkgi_malloc_tag(tag, count * size);
+    if (ptr)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void* pkgi_realloc_tag(MemTag tag, void* ptr, uint32_t size)
 {
-    return malloc(size);
+    if (!ptr)
+    {
+        return pkgi_malloc_tag(tag, size);
+    }
+
+    MemHeader* h = (MemHeader*)((uint8_t*)ptr - MEM_HEADER_SIZE);
+    uint32_t old_size = h->size;
+
+    h = realloc(h, MEM_HEADER_SIZE + size);
+    if (!h)
+    {
+        return NULL;
+    }
+
+    h->size = size;
+    mem_count(h->tag, (int32_t)(size - old_size), 0);
+    return (uint8_t*)h + MEM_HEADER_SIZE;
+}
+
+char* pkgi_strdup_tag(MemTag tag, const char* str)
+{
+    uint32_t size = strlen(str) + 1;
+    char* copy = pkgi_malloc_tag(tag, size);
+    if (copy)
+    {
+        memcpy(copy, str, size);
+    }
+    return copy;
 }
 
-void pkgi_free(void *ptr)
+void pkgi_free(void* ptr)
 {
-    free(ptr);
+    if (!ptr)
+    {
+        return;
+    }
+
+    MemHeader* h = (MemHeader*)((uint8_t*)ptr - MEM_HEADER_SIZE);
+    mem_count(h->tag, -(int32_t)h->size, -1);
+    free(h);
 }
 
 void pkgi_memcpy(void* dst, const void* src, uint32_t size)
@@ -446,7 +602,7 @@ void pkgi_dialog_input_get_text(char* text, uint32_t size)
 static void load_ttf_fonts(void)
 {
     LOG("loading TTF fonts");
-    texture_mem = malloc(256 * 8 * 4);
+    texture_mem = pkgi_malloc_tag(MemFonts, 256 * 8 * 4);
 
     if(!texture_mem)
         return; // fail!
@@ -542,6 +698,27 @@ int psp_network_up(void)
     return net_up;
 }
 
+// curl allocations are counted as http
+static void* curl_mem_malloc(size_t size)
+{
+	return pkgi_malloc_tag(MemHttp, size);
+}
+
+static void* curl_mem_realloc(void* ptr, size_t size)
+{
+	return pkgi_realloc_tag(MemHttp, ptr, size);
+}
+
+static char* curl_mem_strdup(const char* str)
+{
+	return pkgi_strdup_tag(MemHttp, str);
+}
+
+static void* curl_mem_calloc(size_t count, size_t size)
+{
+	return pkgi_calloc_tag(MemHttp, count, size);
+}
+
 static int http_init(void)
 {
 	int ret = 0;
@@ -564,7 +741,7 @@ static int http_init(void)
 		return -1;
 	}
 
-	curl_global_init(CURL_GLOBAL_ALL);
+	curl_global_init_mem(CURL_GLOBAL_ALL, curl_mem_malloc, pkgi_free, curl_mem_realloc, curl_mem_strdup, curl_mem_calloc);
 
 	return 0;
 }
@@ -631,11 +808,22 @@ void pkgi_start(void)
 
     pkgi_start_debug_log();
 
+    // created first, allocations are counted under it
+    ret = sceKernelCreateLwMutex(&g_mem_lock, "mem_mutex", 0, 0, NULL);
+    if (ret != 0) {
+        LOG("mutex create error (%x)", ret);
+    }
+
     ret = sceKernelCreateLwMutex(&g_dialog_lock, "dialog_mutex", 0, 0, NULL);
     if (ret != 0) {
         LOG("mutex create error (%x)", ret);
     }
 
+    ret = sceKernelCreateLwMutex(&g_prefetch_lock, "prefetch_mutex", 0, 0, NULL);
+    if (ret != 0) {
+        LOG("mutex create error (%x)", ret);
+    }
+
     sceUtilityGetSystemParamInt(PSP_SYSTEMPARAM_ID_INT_UNKNOWN, &ret); // X/O button swap
     if (ret == 0)
     {
@@ -752,11 +940,14 @@ void pkgi_end(void)
 
     // Cleanup resources
     sceKernelDeleteLwMutex(&g_dialog_lock);
+    sceKernelDeleteLwMutex(&g_prefetch_lock);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     // Stop all SDL sub-systems
     SDL_Quit();
     http_end();
+    // last, the final pkgi_mem_dump has run and everything above still updates the counters
+    sceKernelDeleteLwMutex(&g_mem_lock);
 }
 
 int pkgi_get_battery_charge(int* status)
@@ -913,11 +1104,11 @@ void pkgi_thread_exit(void)
     sceKernelExitDeleteThread(0);
 }
 
-void pkgi_start_thread(const char* name, pkgi_thread_entry* start)
+void pkgi_start_thread(const char* name, pkgi_thread_entry* start, uint32_t stack_size)
 {
     SceUID id;
 
-    id = sceKernelCreateThread(name, (SceKernelThreadEntry) start, 0x18, 0x10000, PSP_THREAD_ATTR_USER, NULL);
+    id = sceKernelCreateThread(name, (SceKernelThreadEntry) start, 0x18, stack_size, PSP_THREAD_ATTR_USER, NULL);
 	LOG("sysThreadCreate: %s (0x%08x)", name, id);
 
     if (id < 0)
@@ -1051,7 +1242,8 @@ void pkgi_draw_texture_z(pkgi_texture texture, int x, int y, int z, float scale)
 void pkgi_free_texture(pkgi_texture texture)
 {
     SDL_DestroyTexture(texture->texture);
-    free(texture);
+    pkgi_mem_add(MemTextures, -(int32_t)(texture->width * texture->height * 4));
+    pkgi_free(texture);
 }
 
 void pkgi_clip_set(int x, int y, int w, int h)
@@ -1196,6 +1388,9 @@ static void pkgi_curl_init(CURL *curl)
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     // request using SSL for the FTP transfer if available
     curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
+    // abort stalled transfers, so the caller can reconnect
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, PKGI_HTTP_LOW_SPEED_LIMIT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, PKGI_HTTP_LOW_SPEED_TIME);
 
     // check for proxy settings
     memset(&proxy_info, 0, sizeof(proxy_info));
@@ -1214,6 +1409,242 @@ static void pkgi_curl_init(CURL *curl)
     }
 }
 
+static void prefetch_lock(void)
+{
+    sceKernelLockLwMutex(&g_prefetch_lock, 1, NULL);
+}
+
+static void prefetch_unlock(void)
+{
+    sceKernelUnlockLwMutex(&g_prefetch_lock, 1);
+}
+
+static pkgi_prefetch* prefetch_find(const char* url)
+{
+    for (size_t i = 0; i < PKGI_PREFETCH_MAX; i++)
+    {
+        if (g_prefetch[i].curl && strcmp(g_prefetch[i].url, url) == 0)
+        {
+            return &g_prefetch[i];
+        }
+    }
+    return NULL;
+}
+
+// hands over the warm handle for url, if there is one
+static CURL* prefetch_take(const char* url)
+{
+    CURL* curl = NULL;
+
+    prefetch_lock();
+    pkgi_prefetch* pf = prefetch_find(url);
+    if (pf)
+    {
+        LOG("prefetched size %llu", pf->size);
+        curl = pf->curl;
+        pf->curl = NULL;
+    }
+    prefetch_unlock();
+
+    return curl;
+}
+
+static void prefetch_store(CURL* curl, const char* url, uint64_t size)
+{
+    prefetch_lock();
+    pkgi_prefetch* pf = prefetch_find(url);
+    if (!pf)
+    {
+        pf = &g_prefetch[0];
+        for (size_t i = 0; i < PKGI_PREFETCH_MAX; i++)
+        {
+            if (!g_prefetch[i].curl)
+            {
+                pf = &g_prefetch[i];
+                break;
+            }
+            if (g_prefetch[i].time < pf->time)
+            {
+                pf = &g_prefetch[i];
+            }
+        }
+    }
+
+    CURL* old = pf->curl;
+    pf->curl = curl;
+    pf->size = size;
+    pf->time = pkgi_time_msec();
+    pkgi_strncpy(pf->url, sizeof(pf->url), url);
+    prefetch_unlock();
+
+    if (old)
+    {
+        curl_easy_cleanup(old);
+    }
+}
+
+/* follow the CURLOPT_XFERINFOFUNCTION callback definition */
+static int prefetch_progress(void *p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    // abort as soon as the selection moved on
+    return (*(uint32_t*)p != g_prefetch_gen);
+}
+
+static size_t prefetch_write(void *buffer, size_t size, size_t nmemb, void *stream)
+{
+    curl_memory_t* head = stream;
+    size_t realsize = size * nmemb;
+
+    if (head->size + realsize > 256)
+    {
+        // server ignored the range, stop before pulling the whole file
+        return 0;
+    }
+
+    pkgi_memcpy(head->memory + head->size, buffer, realsize);
+    head->size += realsize;
+    return realsize;
+}
+
+static size_t prefetch_header(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    size_t len = size * nitems;
+    char line[128];
+
+    size_t n = len < sizeof(line) ? len : sizeof(line) - 1;
+    pkgi_memcpy(line, buffer, n);
+    line[n] = 0;
+
+    if (strncasecmp(line, "Content-Range:", 14) == 0)
+    {
+        const char* total = pkgi_strrchr(line, '/');
+        if (total)
+        {
+            *(uint64_t*)userdata = pkgi_strtoll(total + 1);
+        }
+    }
+
+    return len;
+}
+
+static void prefetch_url(const char* url, uint32_t gen)
+{
+    char data[256];
+    curl_memory_t head = { data, 0 };
+    uint64_t size = 0;
+    CURLcode res;
+
+    prefetch_lock();
+    pkgi_prefetch* pf = prefetch_find(url);
+    if (pf)
+    {
+        pf->time = pkgi_time_msec();
+    }
+    prefetch_unlock();
+
+    if (pf)
+    {
+        return;
+    }
+
+    CURL* curl = curl_easy_init();
+    if (!curl)
+    {
+        return;
+    }
+
+    LOG("prefetching %s", url);
+    pkgi_curl_init(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, PKGI_PREFETCH_RANGE);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, prefetch_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &head);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, prefetch_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &size);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, prefetch_progress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &gen);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+    res = curl_easy_perform(curl);
+    if (res != CURLE_OK && res != CURLE_WRITE_ERROR)
+    {
+        LOG("prefetch failed: %s", curl_easy_strerror(res));
+        curl_easy_cleanup(curl);
+        return;
+    }
+
+    if (!size)
+    {
+        curl_off_t length = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        size = length > 0 ? length : 0;
+    }
+
+    if (head.size < 4 || !(pkgi_memequ(data, "\x7FPKG", 4) || pkgi_memequ(data, "PK\x03\x04", 4)))
+    {
+        LOG("prefetch of %s returned no pkg/zip header", url);
+    }
+    LOG("prefetched %s: %llu bytes", url, size);
+
+    prefetch_store(curl, url, size);
+}
+
+static void prefetch_thread(void)
+{
+    char url[512];
+    uint32_t gen;
+
+    for (;;)
+    {
+        prefetch_lock();
+        if (!g_prefetch_url[0])
+        {
+            g_prefetch_running = 0;
+            prefetch_unlock();
+            break;
+        }
+        pkgi_strncpy(url, sizeof(url), g_prefetch_url);
+        g_prefetch_url[0] = 0;
+        gen = g_prefetch_gen;
+        prefetch_unlock();
+
+        prefetch_url(url, gen);
+    }
+
+    pkgi_thread_exit();
+}
+
+void pkgi_http_prefetch(const char* url)
+{
+    int state = PSP_NET_APCTL_STATE_DISCONNECTED;
+
+    // never bring up the network dialog for a guess
+    if (!pkgi_validate_url(url) || sceNetApctlGetState(&state) < 0 || state != PSP_NET_APCTL_STATE_GOT_IP)
+    {
+        return;
+    }
+
+    prefetch_lock();
+    pkgi_strncpy(g_prefetch_url, sizeof(g_prefetch_url), url);
+    g_prefetch_gen++;
+    int start = !g_prefetch_running;
+    g_prefetch_running = 1;
+    prefetch_unlock();
+
+    if (start)
+    {
+        pkgi_start_thread("prefetch_thread", &prefetch_thread, PKGI_THREAD_STACK_SIZE);
+    }
+}
+
+void pkgi_http_prefetch_cancel(void)
+{
+    prefetch_lock();
+    g_prefetch_url[0] = 0;
+    g_prefetch_gen++;
+    prefetch_unlock();
+}
+
 pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
 {
     LOG("http get");
@@ -1240,7 +1671,19 @@ pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
         return NULL;
     }
 
-    http->curl = curl_easy_init();
+    http->res = CURLE_OK;
+    http->curl = prefetch_take(url);
+    if (http->curl)
+    {
+        // reset keeps the open connection, dns and tls session caches
+        LOG("using prefetched connection");
+        curl_easy_reset(http->curl);
+    }
+    else
+    {
+        http->curl = curl_easy_init();
+    }
+
     if (!http->curl)
     {
         LOG("curl init error");
@@ -1263,6 +1706,77 @@ pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
     return(http);
 }
 
+// timing breakdown of the last transfer on the handle, to compare network changes on real hardware
+static void http_log_stats(pkgi_http* http)
+{
+#ifdef PKGI_ENABLE_LOGGING
+    double dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+    curl_off_t bytes = 0, speed = 0;
+    long connects = 0, redirects = 0;
+
+    curl_easy_getinfo(http->curl, CURLINFO_NAMELOOKUP_TIME, &dns);
+    curl_easy_getinfo(http->curl, CURLINFO_CONNECT_TIME, &connect);
+    curl_easy_getinfo(http->curl, CURLINFO_APPCONNECT_TIME, &tls);
+    curl_easy_getinfo(http->curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+    curl_easy_getinfo(http->curl, CURLINFO_TOTAL_TIME, &total);
+    curl_easy_getinfo(http->curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    curl_easy_getinfo(http->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+    curl_easy_getinfo(http->curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(http->curl, CURLINFO_REDIRECT_COUNT, &redirects);
+
+    LOG("http stats: dns %d ms, connect %d ms, tls %d ms, ttfb %d ms, total %d ms",
+        (int)(dns * 1000), (int)(connect * 1000), (int)(tls * 1000), (int)(ttfb * 1000), (int)(total * 1000));
+    LOG("http stats: %lld bytes @ %lld KB/s, %ld new connections, %ld redirects", bytes, speed / 1024, connects, redirects);
+#endif
+}
+
+// keeps the validator of the last response, redirects start a new header block
+static size_t http_header(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    pkgi_http* http = userdata;
+    size_t len = size * nitems;
+    char line[256];
+
+    size_t n = len < sizeof(line) ? len : sizeof(line) - 1;
+    pkgi_memcpy(line, buffer, n);
+    while (n && (line[n - 1] == '\r' || line[n - 1] == '\n' || line[n - 1] == ' '))
+    {
+        n--;
+    }
+    line[n] = 0;
+
+    if (strncmp(line, "HTTP/", 5) == 0)
+    {
+        http->etag = 0;
+        http->validator[0] = 0;
+    }
+    else if (strncasecmp(line, "ETag:", 5) == 0)
+    {
+        const char* value = line + 5;
+        while (*value == ' ')
+        {
+            value++;
+        }
+        // a weak tag does not promise the same bytes, it is no use for resuming
+        if (strncmp(value, "W/", 2) != 0)
+        {
+            pkgi_snprintf(http->validator, sizeof(http->validator), "ETag %s", value);
+            http->etag = 1;
+        }
+    }
+    else if (strncasecmp(line, "Last-Modified:", 14) == 0 && !http->etag)
+    {
+        const char* value = line + 14;
+        while (*value == ' ')
+        {
+            value++;
+        }
+        pkgi_snprintf(http->validator, sizeof(http->validator), "Last-Modified %s", value);
+    }
+
+    return len;
+}
+
 int pkgi_http_response_length(pkgi_http* http, int64_t* length)
 {
     CURLcode res;
@@ -1270,9 +1784,14 @@ int pkgi_http_response_length(pkgi_http* http, int64_t* length)
     // do the download request without getting the body
     curl_easy_setopt(http->curl, CURLOPT_NOBODY, 1L);
     curl_easy_setopt(http->curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(http->curl, CURLOPT_HEADERFUNCTION, http_header);
+    curl_easy_setopt(http->curl, CURLOPT_HEADERDATA, http);
+    http->etag = 0;
+    http->validator[0] = 0;
 
     // Perform the request
     res = curl_easy_perform(http->curl);
+    http->res = res;
 
     if(res != CURLE_OK)
     {
@@ -1287,6 +1806,7 @@ int pkgi_http_response_length(pkgi_http* http, int64_t* length)
     curl_easy_getinfo(http->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, length);
     LOG("http response length = %llu", *length);
     http->size = *length;
+    LOG("http validator = %s", http->validator);
 
     return 1;
 }
@@ -1311,6 +1831,8 @@ int pkgi_http_read(pkgi_http* http, void* write_func, void* xferinfo_func)
 
     // Perform the request
     res = curl_easy_perform(http->curl);
+    http->res = res;
+    http_log_stats(http);
 
     if(res != CURLE_OK)
     {
@@ -1321,6 +1843,30 @@ int pkgi_http_read(pkgi_http* http, void* write_func, void* xferinfo_func)
     return 1;
 }
 
+int pkgi_http_can_retry(pkgi_http* http)
+{
+    switch (http->res)
+    {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+const char* pkgi_http_validator(pkgi_http* http)
+{
+    return http->validator;
+}
+
 void pkgi_http_close(pkgi_http* http)
 {
     LOG("http close");
@@ -1380,6 +1926,58 @@ void pkgi_rm(const char* file)
     }
 }
 
+void pkgi_rm_with_folders(const char* file, int keep)
+{
+    char path[256];
+    char* slash;
+    int level = 0;
+
+    pkgi_rm(file);
+    pkgi_strncpy(path, sizeof(path), file);
+
+    // "ms0:/PSP/GAME/X/EBOOT.PBP" is 4 levels deep, its folders are levels 3, 2 and 1
+    for (const char* p = path; *p; p++)
+    {
+        level += (*p == '/');
+    }
+
+    while (--level > keep && (slash = strrchr(path, '/')) != NULL)
+    {
+        *slash = 0;
+        if (sceIoRmdir(path) < 0)
+        {
+            break;
+        }
+        LOG("removed folder %s", path);
+    }
+}
+
+int pkgi_rename(const char* from, const char* to)
+{
+    LOG("renaming %s to %s", from, to);
+
+    int err = rename(from, to);
+    if (err < 0)
+    {
+        LOG("error renaming %s file, err=0x%08x", from, err);
+        return 0;
+    }
+    return 1;
+}
+
+int pkgi_truncate(const char* path, uint64_t size)
+{
+    LOG("truncating %s to %llu bytes", path, size);
+
+    int err = truncate(path, (off_t)size);
+    if (err < 0)
+    {
+        LOG("error truncating %s file, err=0x%08x", path, err);
+        return 0;
+    }
+    return 1;
+}
+
 int64_t pkgi_get_size(const char* path)
 {
     struct stat st;
@@ -1464,6 +2062,16 @@ int pkgi_write(void* f, const void* buffer, uint32_t size)
     return (write == 1);
 }
 
+int pkgi_flush(void* f)
+{
+    int err = fflush((FILE*)f);
+    if (err != 0)
+    {
+        LOG("fflush error 0x%08x", err);
+    }
+    return (err == 0);
+}
+
 void pkgi_close(void* f)
 {
     FILE *fd = (FILE*)f;
@@ -1480,7 +2088,7 @@ static size_t curl_write_memory(void *contents, size_t size, size_t nmemb, void
     size_t realsize = size * nmemb;
     curl_memory_t *mem = (curl_memory_t *)userp;
 
-    char *ptr = realloc(mem->memory, mem->size + realsize + 1);
+    char *ptr = pkgi_realloc_tag(MemHttp, mem->memory, mem->size + realsize + 1);
     if(!ptr)
     {
         /* out of memory! */
@@ -1509,7 +2117,7 @@ char * pkgi_http_download_buffer(const char* url, uint32_t* buf_size)
         return NULL;
     }
     
-    chunk.memory = malloc(1);   /* will be grown as needed by the realloc above */
+    chunk.memory = pkgi_malloc_tag(MemHttp, 1);   /* will be grown as needed by the realloc above */
     chunk.size = 0;             /* no data at this point */
 
     pkgi_curl_init(curl);
@@ -1527,7 +2135,7 @@ char * pkgi_http_download_buffer(const char* url, uint32_t* buf_size)
     {
         LOG("curl_easy_perform() failed: %s", curl_easy_strerror(res));
         curl_easy_cleanup(curl);
-        free(chunk.memory);
+        pkgi_free(chunk.memory);
         return NULL;
     }
 
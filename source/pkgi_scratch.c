@@ -0,0 +1,124 @@
+#include "pkgi_scratch.h"
+#include "pkgi.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRATCH_SLOTS   8           // buffers borrowed at the same time
+#define SCRATCH_IO_BLOCK (128 * 1024)
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} ScratchSlot;
+
+// per device i/o block, the depackager keeps three of them and the unzipper two
+static const struct
+{
+    const char* device;
+    uint32_t io_block;
+} scratch_devices[] =
+{
+    { "ms0:", 256 * 1024 },     // memory stick, big sequential writes
+    { "ef0:", 128 * 1024 },     // psp go internal flash
+};
+
+static void* scratch_mem;           // as returned by pkgi_malloc_tag
+static uint8_t* scratch;            // aligned start of the budget
+static ScratchSlot slots[SCRATCH_SLOTS];    // borrowed ranges, sorted by offset
+static uint32_t slot_count;
+
+void* pkgi_scratch_get(uint32_t size)
+{
+    size = (size + PKGI_SCRATCH_ALIGN - 1) & ~(PKGI_SCRATCH_ALIGN - 1);
+    if (size == 0 || size > PKGI_SCRATCH_BUDGET || slot_count == SCRATCH_SLOTS)
+    {
+        LOG("scratch buffer of %u bytes not available", size);
+        return NULL;
+    }
+
+    if (!scratch)
+    {
+        scratch_mem = pkgi_malloc_tag(MemInstall, PKGI_SCRATCH_BUDGET + PKGI_SCRATCH_ALIGN - 1);
+        if (!scratch_mem)
+        {
+            LOG("failed to allocate scratch pool");
+            return NULL;
+        }
+        scratch = (uint8_t*)(((uintptr_t)scratch_mem + PKGI_SCRATCH_ALIGN - 1) & ~(uintptr_t)(PKGI_SCRATCH_ALIGN - 1));
+    }
+
+    // first gap that fits, buffers are few and mostly returned in reverse order
+    uint32_t offset = 0;
+    uint32_t i;
+    for (i = 0; i < slot_count; i++)
+    {
+        if (slots[i].offset - offset >= size)
+        {
+            break;
+        }
+        offset = slots[i].offset + slots[i].size;
+    }
+
+    if (i == slot_count && PKGI_SCRATCH_BUDGET - offset < size)
+    {
+        LOG("scratch budget exhausted, %u bytes requested", size);
+        return NULL;
+    }
+
+    memmove(slots + i + 1, slots + i, (slot_count - i) * sizeof(ScratchSlot));
+    slots[i].offset = offset;
+    slots[i].size = size;
+    slot_count++;
+
+    return scratch + offset;
+}
+
+void pkgi_scratch_put(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    uint32_t offset = (uint32_t)((uint8_t*)ptr - scratch);
+    for (uint32_t i = 0; i < slot_count; i++)
+    {
+        if (slots[i].offset == offset)
+        {
+            slot_count--;
+            memmove(slots + i, slots + i + 1, (slot_count - i) * sizeof(ScratchSlot));
+            return;
+        }
+    }
+
+    LOG("buffer %p is not from the scratch pool", ptr);
+}
+
+void pkgi_scratch_trim(void)
+{
+    if (slot_count)
+    {
+        LOG("scratch pool still has %u buffers borrowed", slot_count);
+        return;
+    }
+
+    pkgi_free(scratch_mem);
+    scratch_mem = NULL;
+    scratch = NULL;
+}
+
+uint32_t pkgi_scratch_io_block(void)
+{
+    const char* device = pkgi_get_storage_device();
+
+    for (uint32_t i = 0; i < sizeof(scratch_devices) / sizeof(scratch_devices[0]); i++)
+    {
+        if (strcmp(device, scratch_devices[i].device) == 0)
+        {
+            return scratch_devices[i].io_block;
+        }
+    }
+    return SCRATCH_IO_BLOCK;
+}
@@ -0,0 +1,174 @@
+#include "pkgi_sha256.h"
+
+#include <string.h>
+
+// FIPS 180-4 SHA-256 with the 64 rounds unrolled and the message schedule kept in a 16
+// word ring, so the compression function runs out of registers and one small array
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define S0(x) (ror32(x, 2) ^ ror32(x, 13) ^ ror32(x, 22))
+#define S1(x) (ror32(x, 6) ^ ror32(x, 11) ^ ror32(x, 25))
+#define s0(x) (ror32(x, 7) ^ ror32(x, 18) ^ ((x) >> 3))
+#define s1(x) (ror32(x, 17) ^ ror32(x, 19) ^ ((x) >> 10))
+
+#define CH(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// message word i, from round 16 on computed in place of the one 16 rounds back
+#define W(i) ((i) < 16 ? w[i] : (w[(i) & 15] += s1(w[((i) - 2) & 15]) + w[((i) - 7) & 15] + s0(w[((i) - 15) & 15])))
+
+#define ROUND(a, b, c, d, e, f, g, h, i)                        \
+    do                                                          \
+    {                                                           \
+        uint32_t t = h + S1(e) + CH(e, f, g) + sha256_k[i] + W(i); \
+        d += t;                                                 \
+        h = t + S0(a) + MAJ(a, b, c);                           \
+    } while (0)
+
+#define ROUND8(i)                               \
+    ROUND(a, b, c, d, e, f, g, h, (i) + 0);     \
+    ROUND(h, a, b, c, d, e, f, g, (i) + 1);     \
+    ROUND(g, h, a, b, c, d, e, f, (i) + 2);     \
+    ROUND(f, g, h, a, b, c, d, e, (i) + 3);     \
+    ROUND(e, f, g, h, a, b, c, d, (i) + 4);     \
+    ROUND(d, e, f, g, h, a, b, c, (i) + 5);     \
+    ROUND(c, d, e, f, g, h, a, b, (i) + 6);     \
+    ROUND(b, c, d, e, f, g, h, a, (i) + 7)
+
+static void sha256_block(uint32_t* state, const uint8_t* data)
+{
+    uint32_t w[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = get32be(data + 4 * i);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
+
+    ROUND8(0);
+    ROUND8(8);
+    ROUND8(16);
+    ROUND8(24);
+    ROUND8(32);
+    ROUND8(40);
+    ROUND8(48);
+    ROUND8(56);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+#undef ROUND8
+#undef ROUND
+#undef W
+#undef MAJ
+#undef CH
+#undef s1
+#undef s0
+#undef S1
+#undef S0
+
+void sha256_init(sha256_ctx* ctx)
+{
+    static const uint32_t iv[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->state, iv, sizeof(iv));
+}
+
+void sha256_update(sha256_ctx* ctx, const uint8_t* data, size_t size)
+{
+    uint32_t used = ctx->total[0] & 63;
+
+    ctx->total[0] += (uint32_t)size;
+    if (ctx->total[0] < (uint32_t)size)
+    {
+        ctx->total[1]++;
+    }
+
+    if (used)
+    {
+        uint32_t fill = 64 - used;
+        if (size < fill)
+        {
+            memcpy(ctx->buffer + used, data, size);
+            return;
+        }
+
+        memcpy(ctx->buffer + used, data, fill);
+        sha256_block(ctx->state, ctx->buffer);
+        data += fill;
+        size -= fill;
+    }
+
+    // whole blocks are hashed straight from the caller's buffer
+    while (size >= 64)
+    {
+        sha256_block(ctx->state, data);
+        data += 64;
+        size -= 64;
+    }
+
+    memcpy(ctx->buffer, data, size);
+}
+
+void sha256_finish(sha256_ctx* ctx, uint8_t* digest)
+{
+    uint32_t used = ctx->total[0] & 63;
+    uint32_t high = (ctx->total[0] >> 29) | (ctx->total[1] << 3);
+    uint32_t low = ctx->total[0] << 3;
+
+    ctx->buffer[used++] = 0x80;
+    if (used > 56)
+    {
+        memset(ctx->buffer + used, 0, 64 - used);
+        sha256_block(ctx->state, ctx->buffer);
+        used = 0;
+    }
+    memset(ctx->buffer + used, 0, 56 - used);
+
+    set32be(ctx->buffer + 56, high);
+    set32be(ctx->buffer + 60, low);
+    sha256_block(ctx->state, ctx->buffer);
+
+    for (int i = 0; i < 8; i++)
+    {
+        set32be(digest + 4 * i, ctx->state[i]);
+    }
+}
+
+void sha256(const uint8_t* data, size_t size, uint8_t* digest)
+{
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_finish(&ctx, digest);
+}
@@ -5,6 +5,7 @@
 //#include "types.h"
 #include "ttf_render.h"
 #include "pkgi_style.h"
+#include "pkgi.h"
 
 extern SDL_Renderer* renderer;
 
@@ -309,6 +310,7 @@ static SDL_Texture* create_texture(const uint8_t* bitmap, uint32_t rgba)
     SDL_Texture* sdl_tex = SDL_CreateTextureFromSurface(renderer, surface);
     SDL_SetTextureBlendMode(sdl_tex, SDL_BLENDMODE_BLEND);
     SDL_FreeSurface(surface);
+    pkgi_mem_add(MemFonts, TEX_SZ * TEX_SZ * 4);
 
     return (sdl_tex);
 }
@@ -470,6 +472,13 @@ int display_ttf_string(int posx, int posy, const char *string, uint32_t color, u
 
                 ww += slot->bitmap.width;
                 }
+                // a reused slot still holds the textures of the char it had before
+                for(n = 0; n < 2; n++) {
+                    if(ttf_font_datas[l].text[n]) {
+                        SDL_DestroyTexture(ttf_font_datas[l].text[n]);
+                        pkgi_mem_add(MemFonts, -(TEX_SZ * TEX_SZ * 4));
+                    }
+                }
                 ttf_font_datas[l].text[0] = create_texture(bitmap, 0x000000FF);
                 ttf_font_datas[l].text[1] = create_texture(bitmap, 0xFFFFFFFF);
             }
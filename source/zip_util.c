@@ -4,23 +4,140 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pspiofilemgr.h>
+#include <zlib.h>
 
 #include "pkgi.h"
 #include "pkgi_download.h"
+#include "pkgi_utils.h"
+#include "pkgi_scratch.h"
 
-#define UNZIP_BUF_SIZE 0x20000
+#define UNZIP_DIR_CACHE 1024	// power of two, only half of it is filled
 
-static inline uint64_t min64(uint64_t a, uint64_t b)
+#define ZIP_LOCAL_MAGIC   0x04034b50
+#define ZIP_CENTRAL_MAGIC 0x02014b50
+#define ZIP_END_MAGIC     0x06054b50
+#define ZIP_LOCAL_SIZE    30
+
+// directories already created during this extraction, pkgi_mkdirs() checks
+// every path component with a dopen otherwise
+typedef struct {
+	char* path[UNZIP_DIR_CACHE];
+	int count;
+} dir_cache;
+
+static uint32_t dir_hash(const char* path)
+{
+	uint32_t h = 2166136261U;
+	while (*path)
+		h = (h ^ (uint8_t)*path++) * 16777619U;
+	return h;
+}
+
+static void cached_mkdirs(dir_cache* cache, const char* path)
 {
-    return a < b ? a : b;
+	uint32_t h = dir_hash(path) & (UNZIP_DIR_CACHE - 1);
+
+	while (cache->path[h]) {
+		if (strcmp(cache->path[h], path) == 0)
+			return;
+		h = (h + 1) & (UNZIP_DIR_CACHE - 1);
+	}
+
+	pkgi_mkdirs(path);
+
+	if (cache->count < UNZIP_DIR_CACHE / 2 && (cache->path[h] = pkgi_strdup_tag(MemInstall, path)) != NULL)
+		cache->count++;
+}
+
+static void free_dir_cache(dir_cache* cache)
+{
+	for (int i = 0; i < UNZIP_DIR_CACHE; i++)
+		pkgi_free(cache->path[i]);
+}
+
+// strips the leading "/" and "PSP/GAME/" the archives come with, and creates the parent folder
+static const char* entry_path(dir_cache* dirs, const char* filename, char* path, size_t size)
+{
+	if (filename[0] == '/')
+		filename++;
+
+	if (strncasecmp(filename, "PSP/GAME/", 9) == 0)
+		filename += 9;
+
+	snprintf(path, size-1, "%s/PSP/GAME/%s", pkgi_get_storage_device(), filename);
+	char* slash = strrchr(path, '/');
+	*slash = 0;
+	cached_mkdirs(dirs, path);
+	*slash = '/';
+
+	return filename;
+}
+
+// inflates into one half of the buffer while the other half is written in the background.
+// libzip checks the entry crc as the last bytes are read, so a bad entry fails zip_fread
+static int extract_entry(struct zip_file* zfd, const char* path, uint64_t size, uint8_t* buffer, uint32_t block)
+{
+	SceUID fd = sceIoOpen(path, PSP_O_WRONLY | PSP_O_CREAT | PSP_O_TRUNC, 0777);
+	uint64_t pos = 0, count, pending = 0;
+	int n = 0, writing = 0, ok = 1;
+	SceInt64 res;
+
+	if (fd < 0) {
+		LOG("Error opening file '%s'.", path);
+		return 0;
+	}
+
+	while (pos < size) {
+		uint8_t* cur = buffer + (n++ & 1) * block;
+
+		count = min64(block, size - pos);
+		if (zip_fread(zfd, cur, count) != (zip_int64_t)count) {
+			LOG("Error reading from zip.");
+			ok = 0;
+			break;
+		}
+
+		if (writing) {
+			writing = 0;
+			if (sceIoWaitAsync(fd, &res) < 0 || res != (SceInt64)pending) {
+				LOG("Error writing '%s'.", path);
+				ok = 0;
+				break;
+			}
+		}
+
+		writing = (sceIoWriteAsync(fd, cur, count) >= 0);
+		pending = count;
+		pos += count;
+		if (!writing) {
+			ok = 0;
+			break;
+		}
+	}
+
+	if (writing && (sceIoWaitAsync(fd, &res) < 0 || res != (SceInt64)pending)) {
+		LOG("Error writing '%s'.", path);
+		ok = 0;
+	}
+
+	sceIoClose(fd);
+	return ok;
 }
 
 int extract_zip(const char* zip_file)
 {
 	char path[256];
 	uint8_t* buffer;
+	uint32_t block = pkgi_scratch_io_block();
+	dir_cache* dirs;
 	int64_t zsize = pkgi_get_size(zip_file);
-	struct zip* archive = zip_open(zip_file, ZIP_RDONLY | ZIP_CHECKCONS, NULL);
+	// no ZIP_CHECKCONS, that reads through the whole archive up front. entries are
+	// checked against their crc while they are extracted instead
+	struct zip* archive = zip_open(zip_file, ZIP_RDONLY, NULL);
+	if (!archive)
+		return 0;
+
 	int files = zip_get_num_files(archive);
 
 	LOG("Extracting %s to <%s>...", zip_file, pkgi_get_storage_device());
@@ -31,9 +148,14 @@ int extract_zip(const char* zip_file)
 		return 0;
 	}
 
-	buffer = malloc(UNZIP_BUF_SIZE);
-	if (!buffer)
+	buffer = pkgi_scratch_get(2 * block);
+	dirs = pkgi_calloc_tag(MemInstall, 1, sizeof(dir_cache));
+	if (!buffer || !dirs) {
+		pkgi_scratch_put(buffer);
+		pkgi_free(dirs);
+		zip_close(archive);
 		return 0;
+	}
 
 	for (int i = 0; i < files; i++) {
 		const char* filename = zip_get_name(archive, i, 0);
@@ -44,18 +166,7 @@ int extract_zip(const char* zip_file)
 		if (!filename)
 			continue;
 
-		if (filename[0] == '/')
-			filename++;
-
-		if (strncasecmp(filename, "PSP/GAME/", 9) == 0)
-			filename += 9;
-
-		snprintf(path, sizeof(path)-1, "%s/PSP/GAME/%s", pkgi_get_storage_device(), filename);
-		char* slash = strrchr(path, '/');
-		*slash = 0;
-		pkgi_mkdirs(path);
-		*slash = '/';
-
+		filename = entry_path(dirs, filename, path, sizeof(path));
 		if (filename[strlen(filename) - 1] == '/')
 			continue;
 
@@ -70,34 +181,17 @@ int extract_zip(const char* zip_file)
 			continue;
 		}
 
-		FILE* tfd = fopen(path, "wb");
-		if(!tfd) {
-			free(buffer);
-			zip_fclose(zfd);
+		int ok = extract_entry(zfd, path, st.size, buffer, block);
+		zip_fclose(zfd);
+
+		if (!ok) {
+			free_dir_cache(dirs);
+			pkgi_free(dirs);
+			pkgi_scratch_put(buffer);
 			zip_close(archive);
-			LOG("Error opening temporary file '%s'.", path);
 			return 0;
 		}
 
-		uint64_t pos = 0, count;
-		while (pos < st.size) {
-			count = min64(UNZIP_BUF_SIZE, st.size - pos);
-			if (zip_fread(zfd, buffer, count) != count) {
-				free(buffer);
-				fclose(tfd);
-				zip_fclose(zfd);
-				zip_close(archive);
-				LOG("Error reading from zip.");
-				return 0;
-			}
-
-			fwrite(buffer, count, 1, tfd);
-			pos += count;
-		}
-
-		zip_fclose(zfd);
-		fclose(tfd);
-
 		update_install_progress(NULL, zsize * (i+1)/files);
 	}
 
@@ -106,7 +200,305 @@ int extract_zip(const char* zip_file)
 	}
 
 	update_install_progress(NULL, zsize);
-	free(buffer);
+	free_dir_cache(dirs);
+	pkgi_free(dirs);
+	pkgi_scratch_put(buffer);
+
+	return files;
+}
+
+// sequential extraction straight from the download, driven by the local file headers only.
+// archives that need the central directory (data descriptors, zip64, encryption) make
+// zip_stream_write() return -1, and are then downloaded and handed to extract_zip()
+typedef enum {
+	StreamHeader,
+	StreamName,
+	StreamExtra,
+	StreamData,
+	StreamDone,
+} stream_state;
+
+struct zip_stream {
+	stream_state state;
+	uint8_t header[ZIP_LOCAL_SIZE];
+	char name[256];
+	uint32_t have;		// bytes of the header or name collected so far
+	uint32_t name_size;
+	uint32_t extra_size;
+	uint32_t method;
+	uint32_t left;		// compressed bytes of the entry still to come
+	uint32_t size;		// uncompressed size and crc from the local header
+	uint32_t crc;
+	uint32_t out_size;
+	uint32_t out_crc;
+	void* file;
+	z_stream z;
+	int inflating;		// z is initialized
+	int inflate_end;
+	int files;
+	dir_cache dirs;
+	uint8_t* buffer;	// inflate output
+	uint32_t block;
+	char** created;		// files written, removed if the install is not kept
+	uint32_t created_count;
+};
+
+zip_stream* zip_stream_open(void)
+{
+	zip_stream* zs = pkgi_calloc_tag(MemInstall, 1, sizeof(zip_stream));
+	if (!zs)
+		return NULL;
+
+	zs->block = pkgi_scratch_io_block();
+	zs->buffer = pkgi_scratch_get(zs->block);
+	if (!zs->buffer) {
+		pkgi_free(zs);
+		return NULL;
+	}
+
+	zs->state = StreamHeader;
+	LOG("Extracting zip stream to <%s>...", pkgi_get_storage_device());
+	return zs;
+}
+
+static int stream_output(zip_stream* zs, const uint8_t* data, uint32_t size)
+{
+	zs->out_crc = crc32(zs->out_crc, data, size);
+	zs->out_size += size;
+
+	if (zs->file && !pkgi_write(zs->file, data, size)) {
+		LOG("Error writing '%s'.", zs->name);
+		return 0;
+	}
+	return 1;
+}
+
+static int stream_inflate(zip_stream* zs, const uint8_t* data, uint32_t size)
+{
+	zs->z.next_in = (Bytef*)data;
+	zs->z.avail_in = size;
+
+	do {
+		zs->z.next_out = zs->buffer;
+		zs->z.avail_out = zs->block;
+
+		int ret = inflate(&zs->z, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			LOG("Error inflating '%s' (%d).", zs->name, ret);
+			return 0;
+		}
+
+		if (!stream_output(zs, zs->buffer, zs->block - zs->z.avail_out))
+			return 0;
+
+		if (ret == Z_STREAM_END) {
+			zs->inflate_end = 1;
+			break;
+		}
+	} while (zs->z.avail_in || zs->z.avail_out == 0);
+
+	return 1;
+}
+
+// checks the header before anything of the entry is written, -1 if it can't be streamed
+static int stream_check_header(zip_stream* zs)
+{
+	const uint8_t* h = zs->header;
+	uint32_t flags = get16le(h + 6);
+	uint32_t csize = get32le(h + 18);
+
+	zs->method = get16le(h + 8);
+	zs->crc = get32le(h + 14);
+	zs->size = get32le(h + 22);
+	zs->name_size = get16le(h + 26);
+	zs->extra_size = get16le(h + 28);
+	zs->left = csize;
+
+	if (flags & 0x0009) {
+		LOG("zip entry is encrypted or has a data descriptor (flags %04x).", flags);
+		return -1;
+	}
+	if (zs->method != 0 && zs->method != 8) {
+		LOG("Unsupported zip compression method %u.", zs->method);
+		return -1;
+	}
+	if (csize == 0xffffffff || zs->size == 0xffffffff) {
+		LOG("zip64 entries need the central directory.");
+		return -1;
+	}
+	if (zs->name_size == 0 || zs->name_size >= sizeof(zs->name)) {
+		LOG("Bad zip entry name size %u.", zs->name_size);
+		return -1;
+	}
+	return 1;
+}
+
+static int stream_begin_entry(zip_stream* zs)
+{
+	char path[256];
+
+	zs->name[zs->name_size] = 0;
+	zs->out_size = 0;
+	zs->out_crc = crc32(0, NULL, 0);
+	zs->inflate_end = 0;
+
+	LOG("Unzip [%d] '%s'...", zs->files + 1, zs->name);
+	const char* filename = entry_path(&zs->dirs, zs->name, path, sizeof(path));
+
+	if (filename[0] && filename[strlen(filename) - 1] != '/') {
+		// tracked before it exists, so a failed install never leaves it behind
+		char** created = pkgi_realloc_tag(MemInstall, zs->created, (zs->created_count + 1) * sizeof(char*));
+		if (!created)
+			return 0;
+		zs->created = created;
+		if ((created[zs->created_count] = pkgi_strdup_tag(MemInstall, path)) == NULL)
+			return 0;
+		zs->created_count++;
+
+		zs->file = pkgi_create(path);
+		if (!zs->file) {
+			LOG("Error opening file '%s'.", path);
+			return 0;
+		}
+	}
+
+	if (zs->method == 8) {
+		int ret = zs->inflating ? inflateReset(&zs->z) : inflateInit2(&zs->z, -MAX_WBITS);
+		if (ret != Z_OK) {
+			LOG("Error: zlib initialization error");
+			return 0;
+		}
+		zs->inflating = 1;
+	}
+	return 1;
+}
+
+static int stream_end_entry(zip_stream* zs)
+{
+	if (zs->file) {
+		pkgi_close(zs->file);
+		zs->file = NULL;
+	}
+
+	if ((zs->method == 8 && !zs->inflate_end) || zs->out_size != zs->size || zs->out_crc != zs->crc) {
+		LOG("zip entry '%s' is corrupted.", zs->name);
+		return 0;
+	}
+
+	zs->files++;
+	zs->state = StreamHeader;
+	zs->have = 0;
+	return 1;
+}
+
+// an entry without data has nothing left to wait for
+static int stream_start_data(zip_stream* zs)
+{
+	zs->state = StreamData;
+	return zs->left ? 1 : stream_end_entry(zs);
+}
+
+int zip_stream_write(zip_stream* zs, const uint8_t* data, uint32_t size)
+{
+	while (size) {
+		uint32_t n;
+
+		switch (zs->state) {
+		case StreamHeader:
+			n = min32(ZIP_LOCAL_SIZE - zs->have, size);
+			memcpy(zs->header + zs->have, data, n);
+			zs->have += n;
+
+			if (zs->have >= 4 && get32le(zs->header) != ZIP_LOCAL_MAGIC) {
+				uint32_t magic = get32le(zs->header);
+				if (zs->files && (magic == ZIP_CENTRAL_MAGIC || magic == ZIP_END_MAGIC)) {
+					zs->state = StreamDone;
+					continue;
+				}
+				LOG("Unexpected zip signature %08x.", magic);
+				return -1;
+			}
+
+			if (zs->have == ZIP_LOCAL_SIZE) {
+				int res = stream_check_header(zs);
+				if (res <= 0)
+					return res;
+				zs->state = StreamName;
+				zs->have = 0;
+			}
+			break;
+
+		case StreamName:
+			n = min32(zs->name_size - zs->have, size);
+			memcpy(zs->name + zs->have, data, n);
+			zs->have += n;
+
+			if (zs->have == zs->name_size) {
+				if (!stream_begin_entry(zs))
+					return 0;
+				zs->have = 0;
+				if (zs->extra_size)
+					zs->state = StreamExtra;
+				else if (!stream_start_data(zs))
+					return 0;
+			}
+			break;
+
+		case StreamExtra:
+			n = min32(zs->extra_size - zs->have, size);
+			zs->have += n;
+
+			if (zs->have == zs->extra_size && !stream_start_data(zs))
+				return 0;
+			break;
+
+		case StreamData:
+			n = min32(zs->left, size);
+			if (!(zs->method ? stream_inflate(zs, data, n) : stream_output(zs, data, n)))
+				return 0;
+			zs->left -= n;
+
+			if (zs->left == 0 && !stream_end_entry(zs))
+				return 0;
+			break;
+
+		case StreamDone:
+		default:
+			// central directory, nothing left to extract
+			return 1;
+		}
+
+		data += n;
+		size -= n;
+	}
+
+	return 1;
+}
+
+int zip_stream_close(zip_stream* zs, int keep)
+{
+	int files = (zs->state == StreamDone) ? zs->files : 0;
+
+	if (zs->file)
+		pkgi_close(zs->file);
+	if (zs->inflating)
+		inflateEnd(&zs->z);
+
+	// "ms0:/PSP/GAME" stays, the game folders below it go if they end up empty
+	int remove = (!keep || !files);
+	if (remove && zs->created_count)
+		LOG("removing %u extracted files", zs->created_count);
+
+	for (uint32_t i = 0; i < zs->created_count; i++) {
+		if (remove)
+			pkgi_rm_with_folders(zs->created[i], 2);
+		pkgi_free(zs->created[i]);
+	}
+	pkgi_free(zs->created);
 
+	LOG("zip stream closed, %d files extracted", zs->files);
+	free_dir_cache(&zs->dirs);
+	pkgi_scratch_put(zs->buffer);
+	pkgi_free(zs);
 	return files;
 }
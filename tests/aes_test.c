@@ -0,0 +1,347 @@
+// known answers for the AES modes in pkgi_aes.c, and seeking in the CTR keystream
+#include "pkgi_aes.h"
+
+#include "check.h"
+
+#include <string.h>
+
+// FIPS-197 appendix C.1
+static void test_ecb_vector(void)
+{
+    uint8_t key[16], plain[16], cipher[16], out[16];
+    test_unhex(key, "000102030405060708090a0b0c0d0e0f", 16);
+    test_unhex(plain, "00112233445566778899aabbccddeeff", 16);
+    test_unhex(cipher, "69c4e0d86a7b0430d8cdb78070b4c55a", 16);
+
+    aes128_ctx ctx;
+    aes128_init(&ctx, key);
+    aes128_ecb_encrypt(&ctx, plain, out);
+    CHECK(memcmp(out, cipher, 16) == 0);
+    aes128_free(&ctx);
+
+    aes128_init_dec(&ctx, key);
+    aes128_ecb_decrypt(&ctx, cipher, out);
+    CHECK(memcmp(out, plain, 16) == 0);
+    aes128_free(&ctx);
+}
+
+// the decryption key schedule undoes the encryption one for any key
+static void test_ecb_random(void)
+{
+    for (uint32_t run = 0; run < 10000; run++)
+    {
+        uint8_t key[16], plain[16], cipher[16], out[16];
+        test_fill(key, 16);
+        test_fill(plain, 16);
+
+        aes128_ctx enc, dec;
+        aes128_init(&enc, key);
+        aes128_init_dec(&dec, key);
+        aes128_ecb_encrypt(&enc, plain, cipher);
+        aes128_ecb_decrypt(&dec, cipher, out);
+        aes128_free(&enc);
+        aes128_free(&dec);
+
+        CHECK(memcmp(cipher, plain, 16) != 0);
+        CHECK(memcmp(out, plain, 16) == 0);
+        if (memcmp(out, plain, 16) != 0)
+        {
+            break;
+        }
+    }
+}
+
+// NIST SP 800-38A F.5.1
+static const char* ctr_key = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char* ctr_iv = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char* ctr_plain =
+    "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710";
+static const char* ctr_cipher =
+    "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+    "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee";
+
+static void test_ctr_vectors(void)
+{
+    uint8_t key[16], iv[16], data[64], cipher[64];
+    test_unhex(key, ctr_key, 16);
+    test_unhex(iv, ctr_iv, 16);
+    test_unhex(cipher, ctr_cipher, 64);
+
+    aes128_ctx ctx;
+    aes128_init(&ctx, key);
+
+    test_unhex(data, ctr_plain, 64);
+    aes128_ctr_xor(&ctx, iv, 0, data, 64);
+    CHECK(memcmp(data, cipher, 64) == 0);
+
+    // the last two blocks alone, seeking to block 2
+    test_unhex(data, ctr_plain, 64);
+    aes128_ctr_xor(&ctx, iv, 2, data + 32, 32);
+    CHECK(memcmp(data + 32, cipher + 32, 32) == 0);
+
+    // a tail shorter than a block leaves the bytes after it alone
+    uint8_t plain[64];
+    test_unhex(plain, ctr_plain, 64);
+    memcpy(data, plain, 64);
+    aes128_ctr_xor(&ctx, iv, 1, data + 16, 21);
+    CHECK(memcmp(data + 16, cipher + 16, 21) == 0);
+    CHECK(memcmp(data + 37, plain + 37, 27) == 0);
+
+    aes128_free(&ctx);
+}
+
+// the low half of the counter wrapping into the high half, as computed by openssl
+static void test_ctr_carry(void)
+{
+    uint8_t key[16], iv[16], cipher[48], data[48];
+    test_unhex(key, "000102030405060708090a0b0c0d0e0f", 16);
+    test_unhex(iv, "0123456789abcdefffffffffffffffff", 16);
+    test_unhex(cipher,
+        "7e1c1530745987a52bf39cf230cc6296" "17cc3eed19e116bd4a042ac83dc428a6"
+        "7de9e1b54d9a8095f78b2ebab23dcf35", 48);
+
+    aes128_ctx ctx;
+    aes128_init(&ctx, key);
+
+    memset(data, 0, sizeof(data));
+    aes128_ctr_xor(&ctx, iv, 0, data, 48);
+    CHECK(memcmp(data, cipher, 48) == 0);
+
+    memset(data, 0, sizeof(data));
+    aes128_ctr_xor(&ctx, iv, 1, data, 32);
+    CHECK(memcmp(data, cipher + 16, 32) == 0);
+
+    aes128_free(&ctx);
+}
+
+// RFC 4493 section 4, on the SP 800-38A key and plaintext
+static void test_cmac_vectors(void)
+{
+    static const struct
+    {
+        uint32_t size;
+        const char* mac;
+    } vectors[] =
+    {
+        { 0, "bb1d6929e95937287fa37d129b756746" },
+        { 16, "070a16b46b4d4144f79bdd9dd04a287c" },
+        { 40, "dfa66747de9ae63030ca32611497c827" },
+        { 64, "51f0bebf7e3b9d92fc49741779363cfe" },
+    };
+
+    uint8_t key[16], data[64];
+    test_unhex(key, ctr_key, 16);
+    test_unhex(data, ctr_plain, 64);
+
+    for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        uint8_t expect[16], mac[16];
+        test_unhex(expect, vectors[i].mac, 16);
+        aes128_cmac(key, data, vectors[i].size, mac);
+        CHECK(memcmp(mac, expect, 16) == 0);
+    }
+}
+
+// one ecb call per counter, the way the keystream was made before the batching
+static void ctr_reference(aes128_ctx* ctx, const uint8_t* iv, uint64_t block, uint8_t* buffer, uint32_t size)
+{
+    uint8_t counter[16];
+    memcpy(counter, iv, 16);
+
+    // add block to the 128-bit big endian counter a byte at a time
+    uint64_t add = block;
+    uint32_t carry = 0;
+    for (int i = 15; i >= 0; i--)
+    {
+        uint32_t sum = counter[i] + (uint32_t)(add & 0xff) + carry;
+        counter[i] = (uint8_t)sum;
+        carry = sum >> 8;
+        add >>= 8;
+    }
+
+    for (uint32_t i = 0; i < size; i += 16)
+    {
+        uint8_t ks[16];
+        aes128_ecb_encrypt(ctx, counter, ks);
+        for (uint32_t k = 0; k < 16 && i + k < size; k++)
+        {
+            buffer[i + k] ^= ks[k];
+        }
+        for (int k = 15; k >= 0 && ++counter[k] == 0; k--)
+        {
+        }
+    }
+}
+
+// random keys, ivs, block indexes and sizes against the reference, including batch
+// boundaries and counters next to both 64-bit wraps
+static void test_ctr_random(void)
+{
+    static uint8_t data[4096 + 16], expect[4096 + 16];
+
+    for (uint32_t run = 0; run < 2000; run++)
+    {
+        uint8_t key[16], iv[16];
+        test_fill(key, 16);
+        test_fill(iv, 16);
+        if (run % 4 == 1)
+        {
+            memset(iv + 8, 0xff, 8);
+        }
+        else if (run % 4 == 2)
+        {
+            memset(iv, 0xff, 16);
+        }
+
+        uint64_t block = ((uint64_t)test_rand() << 32 | test_rand()) >> (test_rand() % 64);
+        uint32_t size = test_rand() % 4096 + 1;
+
+        test_fill(data, size);
+        memcpy(expect, data, size);
+
+        aes128_ctx ctx;
+        aes128_init(&ctx, key);
+        aes128_ctr_xor(&ctx, iv, block, data, size);
+        ctr_reference(&ctx, iv, block, expect, size);
+        aes128_free(&ctx);
+
+        CHECK(memcmp(data, expect, size) == 0);
+        if (memcmp(data, expect, size) != 0)
+        {
+            break;
+        }
+    }
+}
+
+// key 000102..0f, iv a0a1..ab, zeros decrypted from index 0 and 7, computed with openssl
+static void test_psp_vectors(void)
+{
+    static const struct
+    {
+        uint32_t index;
+        const char* out;
+    } vectors[] =
+    {
+        { 0, "1ff888a861adb15c655d51adfa0c8ab7" "e1e3ea7f51d52805417d59d5baa0ce9d" "6cb422dc900bae42d61b056150825a33" },
+        { 7, "6622690f58f35f6d4f5adf297aa6aa1a" "0a22aa3e8ece27545b589bc07a961e32" "bd624f07d7bdae1a61b2bb095ddb0707" },
+    };
+
+    uint8_t key[16], iv[16];
+    test_unhex(key, "000102030405060708090a0b0c0d0e0f", 16);
+    test_unhex(iv, "a0a1a2a3a4a5a6a7a8a9aaab00000000", 16);
+
+    aes128_ctx ctx;
+    aes128_init_dec(&ctx, key);
+
+    for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        uint8_t data[48], expect[48];
+        test_unhex(expect, vectors[i].out, 48);
+
+        memset(data, 0, sizeof(data));
+        aes128_psp_decrypt(&ctx, iv, vectors[i].index, data, 48);
+        CHECK(memcmp(data, expect, 48) == 0);
+
+        // the same run in two calls
+        memset(data, 0, sizeof(data));
+        aes128_psp_decrypt(&ctx, iv, vectors[i].index, data, 16);
+        aes128_psp_decrypt(&ctx, iv, vectors[i].index + 1, data + 16, 32);
+        CHECK(memcmp(data, expect, 48) == 0);
+    }
+
+    aes128_free(&ctx);
+}
+
+// the block at a time loop aes128_psp_decrypt() had before the batching
+static void psp_reference(aes128_ctx* ctx, const uint8_t* iv, uint32_t index, uint8_t* buffer, uint32_t size)
+{
+    uint8_t prev[16];
+    uint8_t block[16];
+
+    if (index == 0)
+    {
+        memset(prev, 0, 16);
+    }
+    else
+    {
+        memcpy(prev, iv, 12);
+        set32le(prev + 12, index);
+    }
+
+    memcpy(block, iv, 16);
+    set32le(block + 12, index);
+
+    for (uint32_t i = 0; i < size; i += 16)
+    {
+        set32le(block + 12, get32le(block + 12) + 1);
+
+        uint8_t out[16];
+        aes128_ecb_decrypt(ctx, block, out);
+
+        for (size_t k = 0; k < 16; k++)
+        {
+            *buffer++ ^= prev[k] ^ out[k];
+        }
+        memcpy(prev, block, 16);
+    }
+}
+
+// random runs against the reference: index 0, the 32-bit counter wrap, sizes around the
+// batch of 16 blocks and buffers at every alignment
+static void test_psp_random(void)
+{
+    static uint8_t data[8192 + 16], expect[8192 + 16];
+
+    for (uint32_t run = 0; run < 5000; run++)
+    {
+        uint8_t key[16], iv[16];
+        test_fill(key, 16);
+        test_fill(iv, 16);
+
+        uint32_t index = test_rand();
+        if (run % 4 == 0)
+        {
+            index = 0;
+        }
+        else if (run % 4 == 1)
+        {
+            index = 0xffffffff - test_rand() % 600;
+        }
+
+        uint32_t size = (run % 3 == 0 ? test_rand() % 8192 : test_rand() % 64 * 16 + 240) / 16 * 16;
+        uint32_t align = run % 16;
+
+        test_fill(data + align, size);
+        memcpy(expect + align, data + align, size);
+
+        aes128_ctx ctx;
+        aes128_init_dec(&ctx, key);
+        aes128_psp_decrypt(&ctx, iv, index, data + align, size);
+        psp_reference(&ctx, iv, index, expect + align, size);
+        aes128_free(&ctx);
+
+        CHECK(memcmp(data + align, expect + align, size) == 0);
+        if (memcmp(data + align, expect + align, size) != 0)
+        {
+            break;
+        }
+    }
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "ecb vector", test_ecb_vector },
+        { "ecb random keys", test_ecb_random },
+        { "ctr vectors", test_ctr_vectors },
+        { "ctr counter carry", test_ctr_carry },
+        { "ctr random against reference", test_ctr_random },
+        { "cmac vectors", test_cmac_vectors },
+        { "psp decrypt vectors", test_psp_vectors },
+        { "psp decrypt random against reference", test_psp_random },
+    };
+
+    return run_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
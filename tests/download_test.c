@@ -0,0 +1,452 @@
+// drives pkgi_download() against the fake http server in tests/host, built with the
+// statics of pkgi_download.c in reach
+#include "../source/pkgi_download.c"
+
+#include "check.h"
+#include "host.h"
+#include "fake_http.h"
+#include "fake_install.h"
+
+#include <stdio.h>
+
+#define TEST_CONTENT "UP0000-TEST00000_00-0000000000000000"
+#define TEST_SIZE (3 * 1024 * 1024 + 1234)
+
+static uint8_t body[TEST_SIZE];
+static uint8_t digest[SHA256_DIGEST_SIZE];
+static uint8_t bad_digest[SHA256_DIGEST_SIZE];
+
+static DbItem make_item(const char* extension, const uint8_t* sum)
+{
+    static char url[256];
+    snprintf(url, sizeof(url), "http://127.0.0.1/%s.%s", TEST_CONTENT, extension);
+
+    DbItem item = { 0 };
+    item.content = TEST_CONTENT;
+    item.type = ContentGame;
+    item.url = url;
+    item.digest = sum;
+    item.size = TEST_SIZE;
+    return item;
+}
+
+static void setup(void)
+{
+    host_reset();
+    fake_reset(body, TEST_SIZE);
+    fake_install_reset(TEST_SIZE);
+}
+
+static int64_t file_size(const char* name)
+{
+    char path[256];
+    host_path(path, sizeof(path), name);
+    return pkgi_get_size(path);
+}
+
+static int file_matches_body(const char* name)
+{
+    static uint8_t data[TEST_SIZE + 1];
+    return host_read_file(name, data, sizeof(data)) == TEST_SIZE && memcmp(data, body, TEST_SIZE) == 0;
+}
+
+static int streamed_body(void)
+{
+    uint8_t check[SHA256_DIGEST_SIZE];
+    sha256_finish(&streamed.sha, check);
+    return streamed.size == TEST_SIZE && memcmp(check, digest, sizeof(check)) == 0;
+}
+
+static void test_plain_download(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(streamed.opens == 0);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+    CHECK(file_size(TEST_CONTENT ".resume") < 0);
+}
+
+// the write callback must hand the data to the stream, there is no file to write to
+static void test_stream_callback(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    db_item = &item;
+    stream_type = StreamPkg;
+    stream = stream_open();
+    item_file = NULL;
+    download_offset = 0;
+    sha256_init(&sha);
+
+    CHECK(write_verify_data(body, 1, 4096, NULL) == 4096);
+    CHECK(streamed.size == 4096);
+    CHECK(download_offset == 4096);
+
+    stream_close(0);
+}
+
+static void test_stream_pkg(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_PKG) == 1);
+    CHECK(host_errors == 0);
+    CHECK(streamed.opens == 1 && streamed.closes == 1 && streamed.keep == 1);
+    CHECK(streamed_body());
+    CHECK(file_size(TEST_CONTENT ".pkg") < 0);
+    CHECK(pkgi_install(0, 0, 1) == 1);
+}
+
+static void test_stream_zip(void)
+{
+    setup();
+    DbItem item = make_item("zip", digest);
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_ZIP) == 1);
+    CHECK(host_errors == 0);
+    CHECK(streamed.opens == 1 && streamed.closes == 1 && streamed.keep == 1);
+    CHECK(streamed_body());
+    CHECK(file_size(TEST_CONTENT ".zip") < 0);
+}
+
+// a wrong hash takes the installed files out again
+static void test_stream_bad_digest(void)
+{
+    setup();
+    DbItem item = make_item("pkg", bad_digest);
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_PKG) == 0);
+    CHECK(host_errors == 1);
+    CHECK(streamed.closes == 1 && streamed.keep == 0);
+}
+
+// a pkg that can't be streamed is downloaded to a file for pkgi_install()
+static void test_stream_fallback(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    streamed.write_result = -1;
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_PKG) == 1);
+    CHECK(host_errors == 0);
+    CHECK(streamed.closes == 1 && streamed.keep == 0);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+    CHECK(fake.requests == 2);
+}
+
+// a checkpoint as save_resume_checkpoint() leaves it after offset bytes
+static void write_checkpoint(const char* name, const DbItem* item, uint64_t offset, const char* validator)
+{
+    ResumeData r;
+    memset(&r, 0, sizeof(r));
+    r.magic = PKGI_RESUME_MAGIC;
+    r.version = PKGI_RESUME_VERSION;
+    r.offset = offset;
+    r.total_size = TEST_SIZE;
+    sha256_init(&r.sha);
+    sha256_update(&r.sha, body, offset);
+    pkgi_strncpy(r.url, sizeof(r.url), item->url);
+    pkgi_strncpy(r.validator, sizeof(r.validator), validator);
+
+    CHECK(host_write_file(name, &r, sizeof(r)));
+}
+
+// the partial pkg, with size - offset bytes past the checkpoint that must be dropped
+static void write_partial(uint64_t offset, uint64_t size)
+{
+    static uint8_t data[TEST_SIZE];
+    memcpy(data, body, offset);
+    memset(data + offset, 0xee, size - offset);
+    CHECK(host_write_file(TEST_CONTENT ".pkg", data, (uint32_t)size));
+}
+
+static void test_resume(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    write_partial(1000000, 1200000);
+    write_checkpoint(TEST_CONTENT ".resume", &item, 1000000, "ETag \"1\"");
+    pkgi_strncpy(fake.validator, sizeof(fake.validator), "ETag \"1\"");
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_PKG) == 1);
+    CHECK(host_errors == 0);
+    CHECK(streamed.opens == 0);
+    CHECK(fake.first_offset == 1000000);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+    CHECK(file_size(TEST_CONTENT ".resume") < 0);
+}
+
+// a crash between removing .resume and renaming the temp file
+static void test_resume_from_temp(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    write_partial(2000000, 2000000);
+    write_checkpoint(TEST_CONTENT ".resume.tmp", &item, 2000000, "");
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(fake.first_offset == 2000000);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+    CHECK(file_size(TEST_CONTENT ".resume.tmp") < 0);
+}
+
+// a torn .resume is ignored and the download starts over
+static void test_truncated_checkpoint(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    write_partial(1000000, 1000000);
+    write_checkpoint(TEST_CONTENT ".resume", &item, 1000000, "");
+
+    ResumeData r;
+    CHECK(host_read_file(TEST_CONTENT ".resume", &r, sizeof(r)) == sizeof(r));
+    CHECK(host_write_file(TEST_CONTENT ".resume", &r, sizeof(r) / 2));
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(fake.first_offset == 0);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+}
+
+static void test_validator_mismatch(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    write_partial(1000000, 1000000);
+    write_checkpoint(TEST_CONTENT ".resume", &item, 1000000, "ETag \"old\"");
+    pkgi_strncpy(fake.validator, sizeof(fake.validator), "ETag \"new\"");
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 1 && strstr(host_last_error, "changed"));
+    CHECK(fake.served == 0);
+    CHECK(file_size(TEST_CONTENT ".resume") < 0);
+}
+
+// the pkg file lost data the checkpoint covers
+static void test_short_file(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    write_partial(500000, 500000);
+    write_checkpoint(TEST_CONTENT ".resume", &item, 1000000, "");
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 1);
+    CHECK(fake.requests == 0);
+    CHECK(file_size(TEST_CONTENT ".resume") < 0);
+}
+
+// failed checkpoints wait for the next interval instead of retrying on every write
+static void test_checkpoint_failures(void)
+{
+    uint32_t size = 3 * PKGI_RESUME_INTERVAL - 1000;
+    uint8_t* big = malloc(size);
+    uint8_t sum[SHA256_DIGEST_SIZE];
+    for (uint32_t i = 0; i < size; i++)
+    {
+        big[i] = (uint8_t)(i ^ (i >> 11));
+    }
+    sha256(big, size, sum);
+
+    setup();
+    fake_reset(big, size);
+    DbItem item = make_item("pkg", sum);
+    host_fail_flush = 1000;
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_flush_calls == 2);
+    CHECK(host_save_calls == 0);
+
+    setup();
+    fake_reset(big, size);
+    host_fail_save = 1;
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_flush_calls == 2);
+    CHECK(host_save_calls == 2);
+
+    free(big);
+}
+
+// lost connections pick up where they stopped, with the backoff in between
+static void test_dropped_connections(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.drop_at[fake.drops++] = 500000;
+    fake.drop_at[fake.drops++] = 1500000;
+    fake.drop_at[fake.drops++] = 2500000;
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(fake.requests == 4);
+    CHECK(fake.offsets[0] == 0 && fake.offsets[1] == 500000);
+    CHECK(fake.offsets[2] == 1500000 && fake.offsets[3] == 2500000);
+    CHECK(fake.served == TEST_SIZE);
+    CHECK(retry_total == 3);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+}
+
+// the same on a streamed install, which must not see any byte twice
+static void test_dropped_stream(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.drop_at[fake.drops++] = 123457;
+    fake.drop_at[fake.drops++] = 2000000;
+
+    CHECK(pkgi_download(&item, PKGI_STREAM_PKG) == 1);
+    CHECK(host_errors == 0);
+    CHECK(fake.requests == 3);
+    CHECK(streamed.opens == 1 && streamed.keep == 1);
+    CHECK(streamed_body());
+}
+
+// only attempts in a row without progress count against PKGI_RETRY_MAX
+static void test_drops_with_progress(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    for (uint32_t i = 0; i < 3 * PKGI_RETRY_MAX; i++)
+    {
+        fake.drop_at[fake.drops++] = (i + 1) * 200000;
+    }
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(retry_total == 3 * PKGI_RETRY_MAX);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+}
+
+// every wait lands between half and all of the doubled delay, plus one sleep step
+static void test_backoff(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.refuse = 4;
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(fake.requests == 5);
+    for (uint32_t i = 1; i < 5; i++)
+    {
+        uint32_t delay = PKGI_RETRY_DELAY << (i - 1);
+        uint32_t waited = fake.times[i] - fake.times[i - 1];
+        CHECK(waited >= delay / 2 && waited < delay + 100);
+    }
+    CHECK(host_slept >= (1000 + 2000 + 4000 + 8000) / 2);
+    CHECK(host_slept < 1000 + 2000 + 4000 + 8000 + 4 * 100);
+}
+
+static void test_retries_exhausted(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.refuse = 100;
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 1 && strcmp(host_last_error, "HTTP download error") == 0);
+    CHECK(fake.requests == PKGI_RETRY_MAX + 1);
+    CHECK(fake.served == 0);
+}
+
+// a reconnect that gets a different length is a different pkg
+static void test_length_changed(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.drop_at[fake.drops++] = 1000000;
+    fake.length_error = 1;
+    fake.length_after = 1;
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 1 && strstr(host_last_error, "changed"));
+    CHECK(fake.requests == 2);
+    CHECK(fake.served == 1000000);
+}
+
+// cancelling during the backoff returns right away, without an error
+static void test_cancel_during_backoff(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    fake.refuse = 1;
+    host_cancel = 1;
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 0);
+    CHECK(fake.requests == 1);
+    CHECK(host_slept == 0);
+}
+
+// a cancelled download leaves a checkpoint at the cancel, and the next one continues from it
+static void test_cancel_and_resume(void)
+{
+    setup();
+    DbItem item = make_item("pkg", digest);
+    pkgi_strncpy(fake.validator, sizeof(fake.validator), "ETag \"1\"");
+    fake.cancel_at = 1234567;
+
+    CHECK(pkgi_download(&item, 0) == 0);
+    CHECK(host_errors == 0);
+    uint64_t stopped = fake.served;
+    CHECK(stopped >= 1234567 && stopped < TEST_SIZE);
+    CHECK(file_size(TEST_CONTENT ".resume") == sizeof(ResumeData));
+    CHECK(file_size(TEST_CONTENT ".pkg") == (int64_t)stopped);
+
+    fake.cancel_at = 0;
+    fake.requests = 0;
+    fake.served = 0;
+    host_cancel = 0;
+
+    CHECK(pkgi_download(&item, 0) == 1);
+    CHECK(host_errors == 0);
+    CHECK(fake.first_offset == stopped);
+    CHECK(fake.served == TEST_SIZE - stopped);
+    CHECK(file_matches_body(TEST_CONTENT ".pkg"));
+    CHECK(file_size(TEST_CONTENT ".resume") < 0);
+}
+
+int main(void)
+{
+    for (uint32_t i = 0; i < TEST_SIZE; i++)
+    {
+        body[i] = (uint8_t)((i * 2654435761u) >> 13);
+    }
+    sha256(body, TEST_SIZE, digest);
+    memcpy(bad_digest, digest, sizeof(digest));
+    bad_digest[0] ^= 1;
+
+    static const TestCase tests[] =
+    {
+        { "plain download", test_plain_download },
+        { "stream write callback", test_stream_callback },
+        { "stream pkg", test_stream_pkg },
+        { "stream zip", test_stream_zip },
+        { "stream with wrong hash", test_stream_bad_digest },
+        { "stream fallback to file", test_stream_fallback },
+        { "resume from checkpoint", test_resume },
+        { "resume from temp checkpoint", test_resume_from_temp },
+        { "truncated checkpoint", test_truncated_checkpoint },
+        { "validator mismatch", test_validator_mismatch },
+        { "file shorter than checkpoint", test_short_file },
+        { "failed checkpoints", test_checkpoint_failures },
+        { "dropped connections", test_dropped_connections },
+        { "dropped connections while streaming", test_dropped_stream },
+        { "drops that make progress", test_drops_with_progress },
+        { "backoff between refused connections", test_backoff },
+        { "retries exhausted", test_retries_exhausted },
+        { "length changed on reconnect", test_length_changed },
+        { "cancel during backoff", test_cancel_during_backoff },
+        { "cancel and resume", test_cancel_and_resume },
+    };
+
+    int result = run_tests(tests, PKGI_COUNTOF(tests));
+    host_cleanup();
+
+    return result;
+}
@@ -0,0 +1,221 @@
+// checks unpack_psp_edat() of pkg2iso.c on synthetic edat files inside a theme pkg. the
+// data is encrypted here one 16 byte block at a time, the way the old loop decrypted it
+#include "../source/pkg2iso.c"
+
+#include "check.h"
+#include "host.h"
+
+#include <stdlib.h>
+
+#define TEST_PKG        "theme.pkg"
+#define TEST_ENC_OFFSET 0x200
+#define TEST_KEY_HEADER 0x90    // where the PGD header starts in the edat
+#define TEST_DATA_START (TEST_KEY_HEADER + 0x90)
+
+// https://wiki.henkaku.xyz/vita/Packages#AES_Keys
+static const uint8_t psp_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
+
+static uint32_t progress_calls;
+
+// pkgi_install() is not under test here
+void update_install_progress(const char* filename, int64_t progress)
+{
+    PKGI_UNUSED(filename);
+    PKGI_UNUSED(progress);
+    progress_calls++;
+}
+
+static uint8_t data_byte(uint32_t offset)
+{
+    return (uint8_t)(offset * 13 + (offset >> 11));
+}
+
+// the header iv comes from the cmac of the first 0x70 bytes and the seed at 0x70, which
+// the cmac doesn't cover. so pick the iv, encrypt with it, and solve for the seed
+static void build_key_header(uint8_t* header, uint8_t* mac, uint32_t data_size)
+{
+    test_fill(header, 0xa0);
+    memcpy(header, "\x00PGD", 4);
+    set32le(header + 4, 1);     // key index
+    set32le(header + 8, 1);     // drm type
+
+    uint8_t plain[0x30];
+    test_fill(plain, sizeof(plain));
+    set32le(plain + 0x44 - 0x30, data_size);
+    set32le(plain + 0x4c - 0x30, 0x90);
+
+    uint8_t iv[16];
+    test_fill(iv, sizeof(iv));
+
+    aes128_ctx key;
+    aes128_init_dec(&key, kirk7_key63);
+    memcpy(header + 0x30, plain, sizeof(plain));
+    aes128_psp_decrypt(&key, iv, 0, header + 0x30, sizeof(plain));
+    aes128_free(&key);
+
+    aes128_cmac(kirk7_key38, header, 0x70, mac);
+
+    uint8_t seed[16];
+    for (size_t i = 0; i < 16; i++)
+    {
+        seed[i] = iv[i] ^ amctl_hashkey_4[i];
+    }
+    aes128_ctx aes;
+    aes128_init(&aes, kirk7_key39);
+    aes128_ecb_encrypt(&aes, seed, seed);
+    aes128_free(&aes);
+    for (size_t i = 0; i < 16; i++)
+    {
+        seed[i] ^= mac[i] ^ header[0x10 + i] ^ amctl_hashkey_3[i] ^ amctl_hashkey_5[i];
+    }
+    aes128_init(&aes, kirk7_key38);
+    aes128_ecb_encrypt(&aes, seed, header + 0x70);
+    aes128_free(&aes);
+
+    // the way unpack_psp_edat() gets it back
+    uint8_t check[16];
+    init_psp_decrypt(&key, check, 0, mac, header, 0x70, 0x10);
+    aes128_free(&key);
+    CHECK(memcmp(check, iv, 16) == 0);
+}
+
+// a pkg with just the edat as item data at the start of the encrypted area, returns its size
+static uint32_t build_edat_pkg(uint8_t* pkg, uint32_t data_size)
+{
+    uint32_t item_size = TEST_DATA_START + ((data_size + 15) & ~15u);
+    uint32_t pkg_size = TEST_ENC_OFFSET + item_size;
+
+    memset(pkg, 0, TEST_ENC_OFFSET);
+    memcpy(pkg, "\x7FPKG\x80\x00\x00\x02", 8);
+    set32be(pkg + 8, 0x100);                // metadata offset
+    set32be(pkg + 12, 1);                   // metadata count
+    set64be(pkg + 24, pkg_size);
+    set64be(pkg + 32, TEST_ENC_OFFSET);
+    set64be(pkg + 40, item_size);
+    memcpy(pkg + 0x30, "UP0000-TEST00000_00-0000000000000000", 36);
+    test_fill(pkg + 0x70, 16);              // data iv
+
+    // content type 9, a theme
+    set32be(pkg + 0x100, 2);
+    set32be(pkg + 0x104, 4);
+    set32be(pkg + 0x108, 9);
+
+    uint8_t* edat = pkg + TEST_ENC_OFFSET;
+    test_fill(edat, TEST_KEY_HEADER);
+    memcpy(edat, "\x00PSPEDAT", 8);
+    edat[0xc] = TEST_KEY_HEADER;
+
+    uint8_t* header = edat + TEST_KEY_HEADER;
+    uint8_t mac[16];
+    build_key_header(header, mac, data_size);
+
+    // the data iv is taken from the decrypted header
+    uint8_t plain_header[0xa0];
+    memcpy(plain_header, header, sizeof(plain_header));
+    aes128_ctx key;
+    uint8_t iv[16];
+    init_psp_decrypt(&key, iv, 0, mac, plain_header, 0x70, 0x10);
+    aes128_psp_decrypt(&key, iv, 0, plain_header + 0x30, 0x30);
+    aes128_free(&key);
+    init_psp_decrypt(&key, iv, 0, mac, plain_header, 0x70, 0x30);
+
+    uint8_t* data = edat + TEST_DATA_START;
+    uint32_t blocks = (data_size + 15) / 16;
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        uint8_t* block = data + i * 16;
+        for (uint32_t k = 0; k < 16; k++)
+        {
+            block[k] = i * 16 + k < data_size ? data_byte(i * 16 + k) : (uint8_t)test_rand();
+        }
+        // the keystream is xored in, so decrypting encrypts
+        aes128_psp_decrypt(&key, iv, i, block, 16);
+    }
+    aes128_free(&key);
+
+    // and the whole item under the pkg key
+    aes128_ctx pkg_key;
+    aes128_init(&pkg_key, psp_key);
+    aes128_ctr_xor(&pkg_key, pkg + 0x70, 0, edat, item_size);
+    aes128_free(&pkg_key);
+
+    return pkg_size;
+}
+
+static void check_edat(uint32_t data_size)
+{
+    host_reset();
+    progress_calls = 0;
+
+    uint8_t* pkg_data = malloc(TEST_ENC_OFFSET + TEST_DATA_START + data_size + 16);
+    uint32_t pkg_size = build_edat_pkg(pkg_data, data_size);
+    CHECK(host_write_file(TEST_PKG, pkg_data, pkg_size));
+    free(pkg_data);
+
+    char pkg_path[256];
+    char out_path[256];
+    host_path(pkg_path, sizeof(pkg_path), TEST_PKG);
+    host_path(out_path, sizeof(out_path), "THEME.PTF");
+
+    PkgFile pkg;
+    CHECK(pkgi_pkg_open(&pkg, pkg_path));
+
+    PkgItem item;
+    memset(&item, 0, sizeof(item));
+    item.data_size = pkg_size - TEST_ENC_OFFSET;
+    item.psp_type = PKG_ITEM_PSP;
+
+    unpack_psp_edat(out_path, &pkg, &item);
+    pkgi_pkg_close(&pkg);
+
+    CHECK(pkgi_get_size(out_path) == data_size);
+
+    uint8_t* out = malloc(data_size + 1);
+    CHECK(pkgi_load(out_path, out, data_size + 1) == (int)data_size);
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < data_size; i++)
+    {
+        wrong += out[i] != data_byte(i);
+    }
+    CHECK(wrong == 0);
+    free(out);
+
+    // one progress update per chunk
+    CHECK(progress_calls == (data_size + EDAT_CHUNK_SIZE - 1) / EDAT_CHUNK_SIZE);
+}
+
+static void test_small(void)
+{
+    check_edat(1);
+    check_edat(16);
+    check_edat(1000);
+}
+
+static void test_chunks(void)
+{
+    check_edat(EDAT_CHUNK_SIZE - 16);
+    check_edat(EDAT_CHUNK_SIZE);
+    check_edat(EDAT_CHUNK_SIZE + 1);
+    check_edat(3 * EDAT_CHUNK_SIZE + 12345);
+}
+
+static void test_theme_size(void)
+{
+    // about what a theme carries
+    check_edat(4 * 1024 * 1024 + 7);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "edat under a chunk", test_small },
+        { "edat around chunk edges", test_chunks },
+        { "edat of a theme's size", test_theme_size },
+    };
+
+    int result = run_tests(tests, PKGI_COUNTOF(tests));
+    host_cleanup();
+
+    return result;
+}
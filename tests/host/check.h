@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the small test runner shared by the host tests: CHECK() counts failures, run_tests()
+// prints one line per test and gives the exit code
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { failures++; printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+typedef struct
+{
+    const char* name;
+    void (*run)(void);
+} TestCase;
+
+static inline int run_tests(const TestCase* tests, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int before = failures;
+        tests[i].run();
+        printf("%-40s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+    }
+    return failures ? 1 : 0;
+}
+
+// xorshift32, the same sequence on every run
+static uint32_t test_seed = 2463534242u;
+
+static inline uint32_t test_rand(void)
+{
+    test_seed ^= test_seed << 13;
+    test_seed ^= test_seed >> 17;
+    test_seed ^= test_seed << 5;
+    return test_seed;
+}
+
+static inline void test_fill(uint8_t* data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)test_rand();
+    }
+}
+
+// size bytes from a hex string
+static inline void test_unhex(uint8_t* out, const char* hex, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        unsigned int byte;
+        sscanf(hex + 2 * i, "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+}
@@ -0,0 +1,185 @@
+#include "fake_http.h"
+#include "host.h"
+
+#include <string.h>
+
+typedef enum {
+    FakeOk,
+    FakeConnectError,   // like CURLE_COULDNT_CONNECT
+    FakeRecvError,      // like CURLE_RECV_ERROR
+    FakeWriteError,     // write callback took less than it was given
+    FakeAborted,        // progress callback asked to stop
+} FakeResult;
+
+struct pkgi_http
+{
+    int used;
+    uint64_t offset;
+    FakeResult res;
+    char validator[PKGI_HTTP_VALIDATOR_MAX];
+};
+
+typedef size_t (*fake_write_func)(void* buffer, size_t size, size_t nmemb, void* userdata);
+typedef int (*fake_xferinfo_func)(void* p, int64_t dltotal, int64_t dlnow, int64_t ultotal, int64_t ulnow);
+
+fake_server fake;
+static pkgi_http fake_http;
+
+void fake_reset(const uint8_t* body, uint64_t size)
+{
+    memset(&fake, 0, sizeof(fake));
+    fake.body = body;
+    fake.size = size;
+}
+
+int pkgi_validate_url(const char* url)
+{
+    return url && url[0];
+}
+
+pkgi_http* pkgi_http_get(const char* url, const char* content, uint64_t offset)
+{
+    PKGI_UNUSED(content);
+
+    if (!pkgi_validate_url(url) || fake_http.used)
+    {
+        return NULL;
+    }
+
+    if (fake.requests == 0)
+    {
+        fake.first_offset = offset;
+    }
+    if (fake.requests < FAKE_REQUESTS_MAX)
+    {
+        fake.offsets[fake.requests] = offset;
+        fake.times[fake.requests] = host_time;
+    }
+    fake.requests++;
+    fake.last_offset = offset;
+
+    memset(&fake_http, 0, sizeof(fake_http));
+    fake_http.used = 1;
+    fake_http.offset = offset;
+    return &fake_http;
+}
+
+int pkgi_http_response_length(pkgi_http* http, int64_t* length)
+{
+    host_time += fake.latency;
+
+    if (fake.refuse)
+    {
+        fake.refuse--;
+        http->res = FakeConnectError;
+        return 0;
+    }
+
+    http->res = FakeOk;
+    pkgi_strncpy(http->validator, sizeof(http->validator), fake.validator);
+    *length = (int64_t)(fake.size - http->offset) + (fake.requests > fake.length_after ? fake.length_error : 0);
+    return 1;
+}
+
+// the nearest unused drop after offset, removed once it is hit
+static uint64_t next_drop(uint64_t offset, uint32_t* slot)
+{
+    uint64_t drop = (uint64_t)-1;
+    for (uint32_t i = 0; i < fake.drops; i++)
+    {
+        if (fake.drop_at[i] > offset && fake.drop_at[i] < drop)
+        {
+            drop = fake.drop_at[i];
+            *slot = i;
+        }
+    }
+    return drop;
+}
+
+int pkgi_http_read(pkgi_http* http, void* write_func, void* xferinfo_func)
+{
+    fake_write_func write = (fake_write_func)write_func;
+    fake_xferinfo_func xferinfo = (fake_xferinfo_func)xferinfo_func;
+    uint32_t chunk = fake.chunk ? fake.chunk : 16 * 1024;
+    uint8_t buffer[64 * 1024];
+
+    if (chunk > sizeof(buffer))
+    {
+        chunk = sizeof(buffer);
+    }
+
+    uint32_t slot = 0;
+    uint64_t drop = next_drop(http->offset, &slot);
+
+    while (http->offset < fake.size)
+    {
+        uint64_t n = fake.size - http->offset;
+        if (n > chunk)
+        {
+            n = chunk;
+        }
+        if (http->offset + n > drop)
+        {
+            n = drop - http->offset;
+        }
+
+        if (n)
+        {
+            if (fake.rate)
+            {
+                host_time += (uint32_t)((n + fake.rate - 1) / fake.rate);
+            }
+            if (!fake.first_byte)
+            {
+                fake.first_byte = host_time;
+            }
+
+            // through a copy, like curl's receive buffer
+            memcpy(buffer, fake.body + http->offset, n);
+            size_t taken = write(buffer, 1, n, NULL);
+            if (taken != n)
+            {
+                http->res = FakeWriteError;
+                return 0;
+            }
+            http->offset += n;
+            fake.served += n;
+        }
+
+        if (fake.cancel_at && http->offset >= fake.cancel_at)
+        {
+            host_cancel = 1;
+        }
+
+        if (xferinfo && xferinfo(NULL, 0, 0, 0, 0))
+        {
+            http->res = FakeAborted;
+            return 0;
+        }
+
+        if (http->offset == drop)
+        {
+            fake.drop_at[slot] = fake.drop_at[--fake.drops];
+            http->res = FakeRecvError;
+            return 0;
+        }
+    }
+
+    http->res = FakeOk;
+    return 1;
+}
+
+int pkgi_http_can_retry(pkgi_http* http)
+{
+    return http->res == FakeConnectError || http->res == FakeRecvError;
+}
+
+const char* pkgi_http_validator(pkgi_http* http)
+{
+    return http->validator;
+}
+
+void pkgi_http_close(pkgi_http* http)
+{
+    http->used = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "pkgi.h"
+
+#define FAKE_DROPS_MAX 16
+#define FAKE_REQUESTS_MAX 32
+
+// what the pkgi_http_* stand-ins serve, and how they misbehave. transfers advance
+// host_time by the latency and by the rate, so timings come out the same on every run
+typedef struct
+{
+    const uint8_t* body;
+    uint64_t size;
+    char validator[PKGI_HTTP_VALIDATOR_MAX];
+
+    uint32_t chunk;         // bytes per write callback, 16 KiB when 0
+    uint32_t latency;       // msec before the response of every request
+    uint32_t rate;          // bytes per msec, 0 for no limit
+
+    // a transfer reaching one of these offsets loses its connection, each is used once
+    uint64_t drop_at[FAKE_DROPS_MAX];
+    uint32_t drops;
+    uint32_t refuse;        // the next requests fail to connect
+    int64_t length_error;   // added to the length of the responses after the first length_after
+    uint32_t length_after;
+    uint64_t cancel_at;     // the user cancels once the transfer reaches this offset, 0 never
+
+    // filled in by the server
+    uint32_t requests;
+    uint64_t first_offset;  // range start of the first request
+    uint64_t last_offset;   // range start of the last request
+    uint64_t offsets[FAKE_REQUESTS_MAX];    // range start of every request
+    uint32_t times[FAKE_REQUESTS_MAX];      // host_time when it was sent
+    uint64_t served;        // body bytes handed to the write callback
+    uint32_t first_byte;    // host_time when the first body byte went out, 0 before
+} fake_server;
+
+extern fake_server fake;
+
+void fake_reset(const uint8_t* body, uint64_t size);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "pkgi.h"
+#include "pkgi_download.h"
+#include "pkgi_sha256.h"
+
+// what the download fed to the zip or pkg stream
+typedef struct
+{
+    int opens;
+    int closes;
+    int keep;
+    uint64_t size;
+    uint64_t expect;    // closing with fewer bytes than this fails the install
+    sha256_ctx sha;
+    int write_result;   // returned by every write, 1 takes the data
+} fake_stream_log;
+
+extern fake_stream_log streamed;
+
+void fake_install_reset(uint64_t expect);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// host stand-ins for the psp side of pkgi, files go through stdio below host_root
+// and the clock only moves when pkgi_sleep() or the fake server advance it
+
+extern char host_root[256];         // storage device, a temp folder on the host
+extern uint32_t host_time;          // pkgi_time_msec()
+extern uint32_t host_slept;         // msec spent in pkgi_sleep()
+extern int host_cancel;             // pkgi_dialog_is_cancelled()
+
+extern uint32_t host_errors;        // pkgi_dialog_error() calls
+extern char host_last_error[256];
+
+// fault injection, each counts down and fails that many calls
+extern uint32_t host_fail_flush;
+extern uint32_t host_fail_save;
+extern uint32_t host_flush_calls;
+extern uint32_t host_save_calls;
+extern uint32_t host_mkdirs_calls;
+
+// sceIo async calls, see pspiofilemgr.h
+extern uint32_t host_async_reads;
+extern uint32_t host_async_writes;
+extern uint32_t host_async_misuse;          // starts while busy, waits with nothing started, closes while busy
+extern uint32_t host_fail_async_write_at;   // this async write (counting from 1) fails, 0 for none
+
+// creates a fresh host_root and resets everything above
+void host_reset(void);
+// removes host_root and everything in it
+void host_cleanup(void);
+
+void host_path(char* path, uint32_t size, const char* name);
+int host_write_file(const char* name, const void* data, uint32_t size);
+// returns the size read, -1 if the file doesn't exist
+int64_t host_read_file(const char* name, void* data, uint32_t size);
@@ -0,0 +1,372 @@
+#include "host.h"
+#include "pkgi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+char host_root[256];
+uint32_t host_time;
+uint32_t host_slept;
+int host_cancel;
+
+uint32_t host_errors;
+char host_last_error[256];
+
+uint32_t host_fail_flush;
+uint32_t host_fail_save;
+uint32_t host_flush_calls;
+uint32_t host_save_calls;
+uint32_t host_mkdirs_calls;
+
+void host_reset(void)
+{
+    if (host_root[0])
+    {
+        host_cleanup();
+    }
+
+    strcpy(host_root, "/tmp/pkgi-test.XXXXXX");
+    if (!mkdtemp(host_root))
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+
+    char path[256];
+    host_path(path, sizeof(path), "");
+    mkdir(path, 0777);
+
+    host_time = 1000;
+    host_slept = 0;
+    host_cancel = 0;
+    host_errors = 0;
+    host_last_error[0] = 0;
+    host_fail_flush = 0;
+    host_fail_save = 0;
+    host_flush_calls = 0;
+    host_save_calls = 0;
+    host_mkdirs_calls = 0;
+    host_async_reads = 0;
+    host_async_writes = 0;
+    host_async_misuse = 0;
+    host_fail_async_write_at = 0;
+}
+
+void host_cleanup(void)
+{
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", host_root);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "cannot remove %s\n", host_root);
+    }
+    host_root[0] = 0;
+}
+
+// the folder pkgi_download() keeps its files in
+void host_path(char* path, uint32_t size, const char* name)
+{
+    snprintf(path, size, "%s%s/%s", host_root, pkgi_get_temp_folder(), name);
+}
+
+int host_write_file(const char* name, const void* data, uint32_t size)
+{
+    char path[256];
+    host_path(path, sizeof(path), name);
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, f) == size;
+    fclose(f);
+    return ok;
+}
+
+int64_t host_read_file(const char* name, void* data, uint32_t size)
+{
+    char path[256];
+    host_path(path, sizeof(path), name);
+
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        return -1;
+    }
+    int64_t read = fread(data, 1, size, f);
+    fclose(f);
+    return read;
+}
+
+// pkgi.h
+
+int pkgi_snprintf(char* buffer, uint32_t size, const char* msg, ...)
+{
+    va_list args;
+    va_start(args, msg);
+    int len = vsnprintf(buffer, size, msg, args);
+    va_end(args);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+void pkgi_vsnprintf(char* buffer, uint32_t size, const char* msg, va_list args)
+{
+    vsnprintf(buffer, size, msg, args);
+}
+
+char* pkgi_strstr(const char* str, const char* sub)
+{
+    return strstr(str, sub);
+}
+
+int pkgi_stricmp(const char* a, const char* b)
+{
+    return strcasecmp(a, b);
+}
+
+void pkgi_strncpy(char* dst, uint32_t size, const char* src)
+{
+    strncpy(dst, src, size);
+}
+
+char* pkgi_strrchr(const char* str, char ch)
+{
+    return strrchr(str, ch);
+}
+
+uint32_t pkgi_strlen(const char* str)
+{
+    return strlen(str);
+}
+
+int64_t pkgi_strtoll(const char* str)
+{
+    return strtoll(str, NULL, 10);
+}
+
+void pkgi_memcpy(void* dst, const void* src, uint32_t size)
+{
+    memcpy(dst, src, size);
+}
+
+void pkgi_memmove(void* dst, const void* src, uint32_t size)
+{
+    memmove(dst, src, size);
+}
+
+int pkgi_memequ(const void* a, const void* b, uint32_t size)
+{
+    return memcmp(a, b, size) == 0;
+}
+
+void* pkgi_malloc_tag(MemTag tag, uint32_t size)
+{
+    PKGI_UNUSED(tag);
+    return malloc(size);
+}
+
+void* pkgi_calloc_tag(MemTag tag, uint32_t count, uint32_t size)
+{
+    PKGI_UNUSED(tag);
+    return calloc(count, size);
+}
+
+void* pkgi_realloc_tag(MemTag tag, void* ptr, uint32_t size)
+{
+    PKGI_UNUSED(tag);
+    return realloc(ptr, size);
+}
+
+char* pkgi_strdup_tag(MemTag tag, const char* str)
+{
+    PKGI_UNUSED(tag);
+    return strdup(str);
+}
+
+void pkgi_free(void* ptr)
+{
+    free(ptr);
+}
+
+uint32_t pkgi_time_msec(void)
+{
+    return host_time;
+}
+
+void pkgi_sleep(uint32_t msec)
+{
+    host_time += msec;
+    host_slept += msec;
+}
+
+const char* pkgi_get_storage_device(void)
+{
+    return host_root;
+}
+
+const char* pkgi_get_temp_folder(void)
+{
+    return "/pkgi";
+}
+
+int pkgi_check_free_space(uint64_t http_length)
+{
+    PKGI_UNUSED(http_length);
+    return 1;
+}
+
+int pkgi_load(const char* name, void* data, uint32_t max)
+{
+    FILE* f = fopen(name, "rb");
+    if (!f)
+    {
+        return -1;
+    }
+    int read = fread(data, 1, max, f);
+    fclose(f);
+    return read;
+}
+
+int pkgi_save(const char* name, const void* data, uint32_t size)
+{
+    host_save_calls++;
+    if (host_fail_save)
+    {
+        host_fail_save--;
+        return 0;
+    }
+
+    FILE* f = fopen(name, "wb");
+    if (!f)
+    {
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, f) == size;
+    fclose(f);
+    return ok;
+}
+
+int pkgi_mkdirs(const char* dir)
+{
+    host_mkdirs_calls++;
+
+    char path[256];
+    pkgi_snprintf(path, sizeof(path), "%s", dir);
+
+    for (char* ptr = path + 1; *ptr; ptr++)
+    {
+        if (*ptr == '/')
+        {
+            *ptr = 0;
+            mkdir(path, 0777);
+            *ptr = '/';
+        }
+    }
+    mkdir(path, 0777);
+
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void pkgi_rm(const char* file)
+{
+    unlink(file);
+}
+
+void pkgi_rm_with_folders(const char* file, int keep)
+{
+    PKGI_UNUSED(keep);
+    unlink(file);
+}
+
+int pkgi_rename(const char* from, const char* to)
+{
+    return rename(from, to) == 0;
+}
+
+int pkgi_truncate(const char* path, uint64_t size)
+{
+    return truncate(path, (off_t)size) == 0;
+}
+
+int64_t pkgi_get_size(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        return -1;
+    }
+    return st.st_size;
+}
+
+void* pkgi_create(const char* path)
+{
+    return fopen(path, "wb");
+}
+
+void* pkgi_open(const char* path)
+{
+    return fopen(path, "rb");
+}
+
+void* pkgi_append(const char* path)
+{
+    return fopen(path, "ab");
+}
+
+int pkgi_read(void* f, void* buffer, uint32_t size)
+{
+    return fread(buffer, 1, size, (FILE*)f);
+}
+
+int pkgi_write(void* f, const void* buffer, uint32_t size)
+{
+    return fwrite(buffer, size, 1, (FILE*)f) == 1;
+}
+
+int pkgi_flush(void* f)
+{
+    host_flush_calls++;
+    if (host_fail_flush)
+    {
+        host_fail_flush--;
+        return 0;
+    }
+    return fflush((FILE*)f) == 0;
+}
+
+void pkgi_close(void* f)
+{
+    fclose((FILE*)f);
+}
+
+// pkgi_dialog.h
+
+int pkgi_dialog_is_cancelled(void)
+{
+    return host_cancel;
+}
+
+void pkgi_dialog_error(const char* text)
+{
+    host_errors++;
+    snprintf(host_last_error, sizeof(host_last_error), "%s", text);
+}
+
+void pkgi_dialog_set_progress_title(const char* title)
+{
+    PKGI_UNUSED(title);
+}
+
+void pkgi_dialog_update_progress(const char* text, const char* extra, const char* eta, float progress)
+{
+    PKGI_UNUSED(text);
+    PKGI_UNUSED(extra);
+    PKGI_UNUSED(eta);
+    PKGI_UNUSED(progress);
+}
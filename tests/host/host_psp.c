@@ -0,0 +1,124 @@
+#include "pspiofilemgr.h"
+#include "host.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOST_FDS 256
+
+typedef struct
+{
+    int pending;
+    int write;
+    void* data;
+    SceSize size;
+    uint32_t number;    // of the async write
+} HostAsync;
+
+static HostAsync host_async[HOST_FDS];
+
+uint32_t host_async_reads;
+uint32_t host_async_writes;
+uint32_t host_async_misuse;
+uint32_t host_fail_async_write_at;
+
+SceUID sceIoOpen(const char* file, int flags, SceMode mode)
+{
+    int oflags = (flags & PSP_O_RDWR) == PSP_O_RDWR ? O_RDWR : (flags & PSP_O_WRONLY) ? O_WRONLY : O_RDONLY;
+    oflags |= (flags & PSP_O_APPEND) ? O_APPEND : 0;
+    oflags |= (flags & PSP_O_CREAT) ? O_CREAT : 0;
+    oflags |= (flags & PSP_O_TRUNC) ? O_TRUNC : 0;
+
+    int fd = open(file, oflags, mode);
+    if (fd >= HOST_FDS)
+    {
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0)
+    {
+        host_async[fd].pending = 0;
+    }
+    return fd;
+}
+
+int sceIoClose(SceUID fd)
+{
+    if (fd >= 0 && fd < HOST_FDS && host_async[fd].pending)
+    {
+        // whatever was in flight is lost
+        host_async_misuse++;
+        host_async[fd].pending = 0;
+    }
+    return close(fd);
+}
+
+int sceIoRead(SceUID fd, void* data, SceSize size)
+{
+    return (int)read(fd, data, size);
+}
+
+int sceIoWrite(SceUID fd, const void* data, SceSize size)
+{
+    return (int)write(fd, data, size);
+}
+
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence)
+{
+    return lseek(fd, offset, whence == PSP_SEEK_END ? SEEK_END : whence == PSP_SEEK_CUR ? SEEK_CUR : SEEK_SET);
+}
+
+static int start_async(SceUID fd, int write, void* data, SceSize size)
+{
+    if (fd < 0 || fd >= HOST_FDS || host_async[fd].pending)
+    {
+        host_async_misuse++;
+        return -1;
+    }
+    host_async[fd].pending = 1;
+    host_async[fd].write = write;
+    host_async[fd].data = data;
+    host_async[fd].size = size;
+    host_async[fd].number = host_async_writes;
+    return 0;
+}
+
+int sceIoReadAsync(SceUID fd, void* data, SceSize size)
+{
+    host_async_reads++;
+    int res = start_async(fd, 0, data, size);
+    if (res == 0)
+    {
+        // the buffer is the read's from now on, whatever was in it is gone
+        memset(data, 0xa5, size);
+    }
+    return res;
+}
+
+int sceIoWriteAsync(SceUID fd, const void* data, SceSize size)
+{
+    host_async_writes++;
+    return start_async(fd, 1, (void*)data, size);
+}
+
+int sceIoWaitAsync(SceUID fd, SceInt64* res)
+{
+    if (fd < 0 || fd >= HOST_FDS || !host_async[fd].pending)
+    {
+        host_async_misuse++;
+        return -1;
+    }
+
+    HostAsync* op = &host_async[fd];
+    op->pending = 0;
+
+    if (op->write && op->number == host_fail_async_write_at)
+    {
+        *res = -1;
+        return 0;
+    }
+
+    *res = op->write ? write(fd, op->data, op->size) : read(fd, op->data, op->size);
+    return 0;
+}
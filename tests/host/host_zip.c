@@ -0,0 +1,262 @@
+#include "zip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define ZIP_END_SIZE     22
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE   30
+
+typedef struct
+{
+    char* name;
+    uint32_t method;
+    uint32_t crc;
+    uint32_t comp_size;
+    uint32_t size;
+    uint32_t local_offset;
+} HostZipEntry;
+
+struct zip
+{
+    FILE* f;
+    uint32_t count;
+    HostZipEntry* entries;
+};
+
+struct zip_file
+{
+    struct zip* archive;
+    const HostZipEntry* entry;
+    uint64_t offset;        // of the next compressed byte in the archive
+    uint32_t comp_left;
+    uint32_t out;
+    uint32_t crc;
+    z_stream z;
+    uint8_t in[4096];
+};
+
+uint32_t host_zip_open;
+
+static uint32_t get16(const uint8_t* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int read_at(FILE* f, uint64_t offset, void* buffer, uint32_t size)
+{
+    return fseek(f, (long)offset, SEEK_SET) == 0 && fread(buffer, 1, size, f) == size;
+}
+
+struct zip* zip_open(const char* path, int flags, int* errorp)
+{
+    (void)flags;
+    if (errorp)
+    {
+        *errorp = 0;
+    }
+
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        return NULL;
+    }
+
+    // no archive comments, the end record is the last thing in the file
+    uint8_t end[ZIP_END_SIZE];
+    if (fseek(f, -ZIP_END_SIZE, SEEK_END) != 0 || fread(end, 1, sizeof(end), f) != sizeof(end) || get32(end) != 0x06054b50)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    struct zip* archive = calloc(1, sizeof(*archive));
+    host_zip_open++;
+    archive->f = f;
+    archive->count = get16(end + 10);
+    archive->entries = calloc(archive->count, sizeof(HostZipEntry));
+
+    uint64_t offset = get32(end + 16);
+    for (uint32_t i = 0; i < archive->count; i++)
+    {
+        uint8_t h[ZIP_CENTRAL_SIZE];
+        if (!read_at(f, offset, h, sizeof(h)) || get32(h) != 0x02014b50)
+        {
+            zip_close(archive);
+            return NULL;
+        }
+
+        HostZipEntry* e = &archive->entries[i];
+        uint32_t name_size = get16(h + 28);
+        e->method = get16(h + 10);
+        e->crc = get32(h + 16);
+        e->comp_size = get32(h + 20);
+        e->size = get32(h + 24);
+        e->local_offset = get32(h + 42);
+        e->name = calloc(1, name_size + 1);
+        if (!read_at(f, offset + ZIP_CENTRAL_SIZE, e->name, name_size))
+        {
+            zip_close(archive);
+            return NULL;
+        }
+
+        offset += ZIP_CENTRAL_SIZE + name_size + get16(h + 30) + get16(h + 32);
+    }
+
+    return archive;
+}
+
+int zip_close(struct zip* archive)
+{
+    for (uint32_t i = 0; i < archive->count; i++)
+    {
+        free(archive->entries[i].name);
+    }
+    free(archive->entries);
+    fclose(archive->f);
+    free(archive);
+    host_zip_open--;
+    return 0;
+}
+
+int zip_get_num_files(struct zip* archive)
+{
+    return (int)archive->count;
+}
+
+const char* zip_get_name(struct zip* archive, zip_uint64_t index, zip_flags_t flags)
+{
+    (void)flags;
+    return index < archive->count ? archive->entries[index].name : NULL;
+}
+
+int zip_stat_index(struct zip* archive, zip_uint64_t index, zip_flags_t flags, struct zip_stat* st)
+{
+    (void)flags;
+    if (index >= archive->count)
+    {
+        return -1;
+    }
+
+    const HostZipEntry* e = &archive->entries[index];
+    memset(st, 0, sizeof(*st));
+    st->name = e->name;
+    st->index = index;
+    st->size = e->size;
+    st->comp_size = e->comp_size;
+    st->crc = e->crc;
+    st->comp_method = (uint16_t)e->method;
+    return 0;
+}
+
+struct zip_file* zip_fopen_index(struct zip* archive, zip_uint64_t index, zip_flags_t flags)
+{
+    (void)flags;
+    if (index >= archive->count)
+    {
+        return NULL;
+    }
+
+    const HostZipEntry* e = &archive->entries[index];
+    uint8_t h[ZIP_LOCAL_SIZE];
+    if ((e->method != 0 && e->method != 8) || !read_at(archive->f, e->local_offset, h, sizeof(h)) || get32(h) != 0x04034b50)
+    {
+        return NULL;
+    }
+
+    struct zip_file* file = calloc(1, sizeof(*file));
+    file->archive = archive;
+    file->entry = e;
+    file->offset = e->local_offset + ZIP_LOCAL_SIZE + get16(h + 26) + get16(h + 28);
+    file->comp_left = e->comp_size;
+    file->crc = crc32(0, NULL, 0);
+    if (e->method == 8 && inflateInit2(&file->z, -MAX_WBITS) != Z_OK)
+    {
+        free(file);
+        return NULL;
+    }
+
+    host_zip_open++;
+    return file;
+}
+
+zip_int64_t zip_fread(struct zip_file* file, void* buffer, zip_uint64_t size)
+{
+    const HostZipEntry* e = file->entry;
+    uint8_t* out = buffer;
+    uint32_t done = 0;
+
+    if (size > e->size - file->out)
+    {
+        size = e->size - file->out;
+    }
+
+    while (done < size)
+    {
+        if (e->method == 0)
+        {
+            uint32_t n = (uint32_t)size - done;
+            if (n > file->comp_left || !read_at(file->archive->f, file->offset, out + done, n))
+            {
+                return -1;
+            }
+            file->offset += n;
+            file->comp_left -= n;
+            done += n;
+            continue;
+        }
+
+        if (file->z.avail_in == 0)
+        {
+            uint32_t n = file->comp_left < sizeof(file->in) ? file->comp_left : sizeof(file->in);
+            if (n == 0 || !read_at(file->archive->f, file->offset, file->in, n))
+            {
+                return -1;
+            }
+            file->offset += n;
+            file->comp_left -= n;
+            file->z.next_in = file->in;
+            file->z.avail_in = n;
+        }
+
+        file->z.next_out = out + done;
+        file->z.avail_out = (uint32_t)size - done;
+        int res = inflate(&file->z, Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END)
+        {
+            return -1;
+        }
+        done = (uint32_t)size - file->z.avail_out;
+        if (res == Z_STREAM_END && done < size)
+        {
+            return -1;
+        }
+    }
+
+    file->crc = crc32(file->crc, out, done);
+    file->out += done;
+
+    if (file->out == e->size && file->crc != e->crc)
+    {
+        return -1;
+    }
+    return done;
+}
+
+int zip_fclose(struct zip_file* file)
+{
+    if (file->entry->method == 8)
+    {
+        inflateEnd(&file->z);
+    }
+    free(file);
+    host_zip_open--;
+    return 0;
+}
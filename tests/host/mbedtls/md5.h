@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <openssl/evp.h>
+
+// mbedtls 2.x MD5 calls, as pkg2iso uses them, on top of the host's openssl
+
+typedef struct
+{
+    EVP_MD_CTX* ctx;
+} mbedtls_md5_context;
+
+static inline void mbedtls_md5_init(mbedtls_md5_context* ctx)
+{
+    ctx->ctx = EVP_MD_CTX_new();
+}
+
+static inline void mbedtls_md5_starts(mbedtls_md5_context* ctx)
+{
+    EVP_DigestInit_ex(ctx->ctx, EVP_md5(), NULL);
+}
+
+static inline void mbedtls_md5_update(mbedtls_md5_context* ctx, const unsigned char* input, size_t size)
+{
+    EVP_DigestUpdate(ctx->ctx, input, size);
+}
+
+static inline void mbedtls_md5_finish(mbedtls_md5_context* ctx, unsigned char output[16])
+{
+    EVP_DigestFinal_ex(ctx->ctx, output, NULL);
+}
+
+static inline void mbedtls_md5_free(mbedtls_md5_context* ctx)
+{
+    EVP_MD_CTX_free(ctx->ctx);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <openssl/evp.h>
+
+// mbedtls 2.x SHA1 calls, as pkg2iso uses them, on top of the host's openssl
+
+typedef struct
+{
+    EVP_MD_CTX* ctx;
+} mbedtls_sha1_context;
+
+static inline void mbedtls_sha1_init(mbedtls_sha1_context* ctx)
+{
+    ctx->ctx = EVP_MD_CTX_new();
+}
+
+static inline void mbedtls_sha1_starts(mbedtls_sha1_context* ctx)
+{
+    EVP_DigestInit_ex(ctx->ctx, EVP_sha1(), NULL);
+}
+
+static inline void mbedtls_sha1_update(mbedtls_sha1_context* ctx, const unsigned char* input, size_t size)
+{
+    EVP_DigestUpdate(ctx->ctx, input, size);
+}
+
+static inline void mbedtls_sha1_finish(mbedtls_sha1_context* ctx, unsigned char output[20])
+{
+    EVP_DigestFinal_ex(ctx->ctx, output, NULL);
+}
+
+static inline void mbedtls_sha1_free(mbedtls_sha1_context* ctx)
+{
+    EVP_MD_CTX_free(ctx->ctx);
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// translations are not part of the host tests
+#define _(str) (str)
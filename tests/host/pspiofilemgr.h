@@ -0,0 +1,27 @@
+#pragma once
+
+#include "psptypes.h"
+
+#define PSP_O_RDONLY    0x0001
+#define PSP_O_WRONLY    0x0002
+#define PSP_O_RDWR      (PSP_O_RDONLY | PSP_O_WRONLY)
+#define PSP_O_APPEND    0x0100
+#define PSP_O_CREAT     0x0200
+#define PSP_O_TRUNC     0x0400
+
+#define PSP_SEEK_SET    0
+#define PSP_SEEK_CUR    1
+#define PSP_SEEK_END    2
+
+// the sceIo calls pkgi uses, on top of posix files. async calls take the worst timing
+// the psp allows: a read clobbers its buffer when it starts and fills it when waited for,
+// a write takes the data when waited for. a buffer used too early ends up as wrong data
+SceUID sceIoOpen(const char* file, int flags, SceMode mode);
+int sceIoClose(SceUID fd);
+int sceIoRead(SceUID fd, void* data, SceSize size);
+int sceIoWrite(SceUID fd, const void* data, SceSize size);
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence);
+
+int sceIoReadAsync(SceUID fd, void* data, SceSize size);
+int sceIoWriteAsync(SceUID fd, const void* data, SceSize size);
+int sceIoWaitAsync(SceUID fd, SceInt64* res);
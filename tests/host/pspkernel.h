@@ -0,0 +1,4 @@
+#pragma once
+
+#include "psptypes.h"
+#include "pspiofilemgr.h"
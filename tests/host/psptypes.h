@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int SceUID;
+typedef unsigned int SceSize;
+typedef int SceMode;
+typedef int64_t SceOff;
+typedef int64_t SceInt64;
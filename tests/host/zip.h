@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// the libzip calls extract_zip() uses, on top of stdio and zlib. reads the central directory
+// of stored and deflated entries, and like libzip fails the read that ends an entry whose
+// crc doesn't match
+
+#define ZIP_RDONLY 16
+
+typedef int64_t zip_int64_t;
+typedef uint64_t zip_uint64_t;
+typedef uint32_t zip_flags_t;
+
+struct zip;
+struct zip_file;
+
+struct zip_stat
+{
+    const char* name;
+    zip_uint64_t index;
+    zip_uint64_t size;
+    zip_uint64_t comp_size;
+    uint32_t crc;
+    uint16_t comp_method;
+};
+
+struct zip* zip_open(const char* path, int flags, int* errorp);
+int zip_close(struct zip* archive);
+int zip_get_num_files(struct zip* archive);
+const char* zip_get_name(struct zip* archive, zip_uint64_t index, zip_flags_t flags);
+int zip_stat_index(struct zip* archive, zip_uint64_t index, zip_flags_t flags, struct zip_stat* st);
+struct zip_file* zip_fopen_index(struct zip* archive, zip_uint64_t index, zip_flags_t flags);
+zip_int64_t zip_fread(struct zip_file* file, void* buffer, zip_uint64_t size);
+int zip_fclose(struct zip_file* file);
+
+// archives and entries opened and not closed yet
+extern uint32_t host_zip_open;
@@ -0,0 +1,354 @@
+// checks the image writers of pkg2iso.c: lz4 blocks and the cso, zso and csov2 layouts,
+// decoded here independently of the writer. built with the statics of pkg2iso.c in reach
+#include "../source/pkg2iso.c"
+
+#include "check.h"
+#include "host.h"
+
+#include <stdlib.h>
+
+#define TEST_SECTORS 701    // not a multiple of the csov2 block, the last block is short
+
+// pkgi_install() is not under test here
+void update_install_progress(const char* filename, int64_t progress)
+{
+    PKGI_UNUSED(filename);
+    PKGI_UNUSED(progress);
+}
+
+// lz4 block decoder after the format description, including the end of block rules: the
+// last 5 bytes are literals and the last match starts at least 12 bytes before the end.
+// returns the decoded size or -1
+static int lz4_decode(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t dst_size)
+{
+    const uint8_t* end = src + size;
+    uint32_t out = 0;
+    int64_t last_match = -1;
+    uint32_t last_match_end = 0;
+
+    while (src < end)
+    {
+        uint8_t token = *src++;
+
+        uint32_t literals = token >> 4;
+        if (literals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (src == end)
+                {
+                    return -1;
+                }
+                b = *src++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (uint32_t)(end - src) || out + literals > dst_size)
+        {
+            return -1;
+        }
+        memcpy(dst + out, src, literals);
+        src += literals;
+        out += literals;
+
+        if (src == end)
+        {
+            break;
+        }
+
+        if (end - src < 2)
+        {
+            return -1;
+        }
+        uint32_t offset = src[0] | src[1] << 8;
+        src += 2;
+        if (offset == 0 || offset > out)
+        {
+            return -1;
+        }
+
+        uint32_t length = token & 15;
+        if (length == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (src == end)
+                {
+                    return -1;
+                }
+                b = *src++;
+                length += b;
+            } while (b == 255);
+        }
+        length += 4;
+        if (out + length > dst_size)
+        {
+            return -1;
+        }
+
+        last_match = out;
+        for (uint32_t k = 0; k < length; k++, out++)
+        {
+            dst[out] = dst[out - offset];
+        }
+        last_match_end = out;
+    }
+
+    if (last_match >= 0 && (out - last_match_end < 5 || last_match + 12 > out))
+    {
+        return -1;
+    }
+    return (int)out;
+}
+
+static void fill_sector(uint8_t* sector, uint32_t index)
+{
+    static const char text[] = "PSP GAME SAMPLE TEXT, REPEATED ENOUGH TO COMPRESS WELL. ";
+
+    switch (index % 5)
+    {
+    case 0:
+        memset(sector, 0, ISO_SECTOR_SIZE);
+        break;
+    case 1:
+        test_fill(sector, ISO_SECTOR_SIZE);
+        break;
+    case 2:
+        for (uint32_t k = 0; k < ISO_SECTOR_SIZE; k++)
+        {
+            sector[k] = text[(k + index) % (sizeof(text) - 1)];
+        }
+        break;
+    case 3:
+        memset(sector, 0, ISO_SECTOR_SIZE);
+        test_fill(sector, ISO_SECTOR_SIZE / 2);
+        break;
+    default:
+        for (uint32_t k = 0; k < ISO_SECTOR_SIZE; k++)
+        {
+            sector[k] = (uint8_t)(k * k >> 5);
+        }
+        break;
+    }
+}
+
+static void check_lz4(const uint8_t* data, uint32_t size)
+{
+    // worst case for data that doesn't compress: every 255 literals cost one more byte
+    static uint8_t packed[PKGI_LZ4_MAX_INPUT + PKGI_LZ4_MAX_INPUT / 255 + 16];
+    static uint8_t unpacked[PKGI_LZ4_MAX_INPUT + 1];
+
+    // the writers give it room for size bytes and store the block raw when it says 0
+    uint32_t fitting = pkgi_lz4_compress(data, size, packed, size);
+
+    uint32_t packed_size = pkgi_lz4_compress(data, size, packed, sizeof(packed));
+    CHECK(packed_size != 0);
+    // the room check before each sequence is a worst case, it may give up a few bytes early
+    CHECK(fitting == 0 ? packed_size + 8 > size : fitting == packed_size);
+
+    CHECK(lz4_decode(packed, packed_size, unpacked, sizeof(unpacked)) == (int)size);
+    CHECK(memcmp(unpacked, data, size) == 0);
+
+    // one byte less room than it needs is refused
+    CHECK(pkgi_lz4_compress(data, size, packed, packed_size - 1) == 0);
+}
+
+static void test_lz4_round_trip(void)
+{
+    static uint8_t data[PKGI_LZ4_MAX_INPUT];
+
+    static const uint32_t sizes[] = { 1, 5, 12, 13, 17, 64, 100, ISO_SECTOR_SIZE, CSO2_BLOCK_SIZE, 30000, PKGI_LZ4_MAX_INPUT };
+
+    for (uint32_t i = 0; i < PKGI_COUNTOF(sizes); i++)
+    {
+        uint32_t size = sizes[i];
+
+        memset(data, 0, size);
+        check_lz4(data, size);
+
+        test_fill(data, size);
+        check_lz4(data, size);
+
+        for (uint32_t sector = 0; sector * ISO_SECTOR_SIZE < size; sector++)
+        {
+            uint8_t block[ISO_SECTOR_SIZE];
+            fill_sector(block, sector + i);
+            memcpy(data + sector * ISO_SECTOR_SIZE, block, min32(ISO_SECTOR_SIZE, size - sector * ISO_SECTOR_SIZE));
+        }
+        check_lz4(data, size);
+    }
+
+    // long runs and long literal runs, for the 255 length continuation bytes
+    for (uint32_t run = 0; run < 300; run++)
+    {
+        uint32_t size = test_rand() % PKGI_LZ4_MAX_INPUT + 1;
+        uint32_t pos = 0;
+        while (pos < size)
+        {
+            uint32_t n = min32(size - pos, test_rand() % 2000 + 1);
+            if (test_rand() % 2)
+            {
+                memset(data + pos, (uint8_t)test_rand(), n);
+            }
+            else
+            {
+                test_fill(data + pos, n);
+            }
+            pos += n;
+        }
+        check_lz4(data, size);
+    }
+}
+
+// reads the image back the way the psp side does, from the header and the index alone
+static int decode_image(const uint8_t* image, uint32_t image_size, ImageFormat format, uint8_t* iso, uint64_t iso_size)
+{
+    if (memcmp(image, format == ImageZso ? "ZISO" : "CISO", 4) != 0 || get32le(image + 4) != CSO_HEADER_SIZE ||
+        get64le(image + 8) != iso_size || image[20] != (format == ImageCso2 ? 2 : 1) || image[21] != 0)
+    {
+        return 0;
+    }
+
+    uint32_t block_size = get32le(image + 16);
+    if (block_size != (format == ImageCso2 ? CSO2_BLOCK_SIZE : ISO_SECTOR_SIZE))
+    {
+        return 0;
+    }
+
+    uint32_t blocks = (uint32_t)((iso_size + block_size - 1) / block_size);
+    const uint8_t* index = image + CSO_HEADER_SIZE;
+    uint32_t data_start = CSO_HEADER_SIZE + (blocks + 1) * 4;
+
+    if ((get32le(index) & 0x7fffffff) != data_start || get32le(index + blocks * 4) != image_size)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        uint32_t entry = get32le(index + i * 4);
+        uint32_t start = entry & 0x7fffffff;
+        uint32_t next = get32le(index + (i + 1) * 4) & 0x7fffffff;
+        uint32_t size = (uint32_t)min64(block_size, iso_size - (uint64_t)i * block_size);
+        uint8_t* out = iso + (uint64_t)i * block_size;
+
+        if (next <= start || next > image_size)
+        {
+            return 0;
+        }
+
+        int stored = (format == ImageCso2) ? (next - start >= block_size) : (entry & 0x80000000) != 0;
+        int lz4 = (format == ImageZso) || (format == ImageCso2 && (entry & 0x80000000));
+
+        if (stored)
+        {
+            if (next - start < size)
+            {
+                return 0;
+            }
+            memcpy(out, image + start, size);
+        }
+        else if (lz4)
+        {
+            if (lz4_decode(image + start, next - start, out, size) != (int)size)
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            z_stream z;
+            memset(&z, 0, sizeof(z));
+            inflateInit2(&z, Z_WBITS_DEFLATE);
+            z.next_in = (uint8_t*)image + start;
+            z.avail_in = next - start;
+            z.next_out = out;
+            z.avail_out = size;
+            int res = inflate(&z, Z_FINISH);
+            inflateEnd(&z);
+            if (res != Z_STREAM_END || z.total_out != size)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void check_image(ImageFormat format, int level)
+{
+    const uint64_t iso_size = (uint64_t)TEST_SECTORS * ISO_SECTOR_SIZE;
+    uint8_t* iso = malloc(iso_size);
+    uint8_t* decoded = malloc(iso_size);
+    for (uint32_t i = 0; i < TEST_SECTORS; i++)
+    {
+        fill_sector(iso + i * ISO_SECTOR_SIZE, i);
+    }
+
+    host_reset();
+    char path[256];
+    host_path(path, sizeof(path), "test.cso");
+
+    // written in pieces that don't line up with the blocks, like psar blocks of any size
+    CsoWriter cso;
+    void* file = pkgi_create(path);
+    CHECK(file && cso_open(&cso, file, format, iso_size, level));
+    uint64_t offset = 0;
+    while (offset < iso_size)
+    {
+        uint32_t n = (uint32_t)min64(iso_size - offset, test_rand() % (3 * CSO2_BLOCK_SIZE) + 1);
+        cso_write(&cso, iso + offset, n);
+        offset += n;
+    }
+    cso_close(&cso);
+    pkgi_close(file);
+
+    int64_t image_size = pkgi_get_size(path);
+    uint8_t* image = malloc(image_size);
+    CHECK(pkgi_load(path, image, image_size) == image_size);
+    CHECK(image_size < (int64_t)iso_size);
+
+    memset(decoded, 0xcc, iso_size);
+    CHECK(decode_image(image, (uint32_t)image_size, format, decoded, iso_size));
+    CHECK(memcmp(decoded, iso, iso_size) == 0);
+
+    free(image);
+    free(decoded);
+    free(iso);
+}
+
+static void test_cso(void)
+{
+    check_image(ImageCso, 1);
+    check_image(ImageCso, 9);
+}
+
+static void test_zso(void)
+{
+    check_image(ImageZso, 0);
+}
+
+static void test_cso2(void)
+{
+    check_image(ImageCso2, 1);
+    check_image(ImageCso2, 9);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "lz4 round trip", test_lz4_round_trip },
+        { "cso layout", test_cso },
+        { "zso layout", test_zso },
+        { "csov2 layout", test_cso2 },
+    };
+
+    int result = run_tests(tests, PKGI_COUNTOF(tests));
+    host_cleanup();
+
+    return result;
+}
@@ -0,0 +1,699 @@
+// checks lzrc_decompress() of pkg2iso.c two ways: streams from a small encoder built on the
+// same model must decode back to their input, and on any input, corrupt or not, it must
+// return the same as the libkirk decoder it replaced, copied below
+#include "../source/pkg2iso.c"
+
+#include "check.h"
+
+#include <stdlib.h>
+
+#define TEST_BLOCK_MAX  PSAR_BLOCK_MAX
+#define TEST_PACKED_MAX (2 * PSAR_BLOCK_MAX)
+
+// pkgi_install() is not under test here
+void update_install_progress(const char* filename, int64_t progress)
+{
+    PKGI_UNUSED(filename);
+    PKGI_UNUSED(progress);
+}
+
+// the decoder as it was before it was reworked, unchanged but for one thing: input past
+// the end reads as zeros, the old one read whatever followed the buffer
+typedef struct {
+    const uint8_t* input;
+    uint32_t in_ptr;
+    uint32_t in_len;
+
+    uint8_t* output;
+    uint32_t out_ptr;
+    uint32_t out_len;
+
+    uint32_t range;
+    uint32_t code;
+    uint32_t out_code;
+    uint8_t lc;
+
+    uint8_t bm_literal[8][256];
+    uint8_t bm_dist_bits[8][39];
+    uint8_t bm_dist[18][8];
+    uint8_t bm_match[8][8];
+    uint8_t bm_len[8][31];
+} ref_decode;
+
+static void ref_init(ref_decode* rc, void* out, int out_len, const void* in, int in_len)
+{
+    rc->input = in;
+    rc->in_len = in_len;
+    rc->in_ptr = 5;
+
+    rc->output = out;
+    rc->out_len = out_len;
+    rc->out_ptr = 0;
+
+    rc->range = 0xffffffff;
+    rc->lc = rc->input[0];
+    rc->code = get32be(rc->input + 1);
+    rc->out_code = 0xffffffff;
+
+    memset(rc->bm_literal, 0x80, sizeof(rc->bm_literal));
+    memset(rc->bm_dist_bits, 0x80, sizeof(rc->bm_dist_bits));
+    memset(rc->bm_dist, 0x80, sizeof(rc->bm_dist));
+    memset(rc->bm_match, 0x80, sizeof(rc->bm_match));
+    memset(rc->bm_len, 0x80, sizeof(rc->bm_len));
+}
+
+static void ref_normalize(ref_decode* rc)
+{
+    if (rc->range < 0x01000000)
+    {
+        rc->range <<= 8;
+        rc->code = (rc->code << 8) + (rc->in_ptr < rc->in_len ? rc->input[rc->in_ptr] : 0);
+        rc->in_ptr++;
+    }
+}
+
+static int ref_bit(ref_decode* rc, uint8_t *prob)
+{
+    uint32_t bound;
+
+    ref_normalize(rc);
+
+    bound = (rc->range >> 8) * (*prob);
+    *prob -= *prob >> 3;
+
+    if (rc->code < bound)
+    {
+        rc->range = bound;
+        *prob += 31;
+        return 1;
+    }
+    else
+    {
+        rc->code -= bound;
+        rc->range -= bound;
+        return 0;
+    }
+}
+
+static int ref_bittree(ref_decode* rc, uint8_t *probs, int limit)
+{
+    int number = 1;
+
+    do
+    {
+        number = (number << 1) + ref_bit(rc, probs + number);
+    }
+    while (number < limit);
+
+    return number;
+}
+
+static int ref_number(ref_decode* rc, uint8_t *prob, uint32_t n)
+{
+    int number = 1;
+
+    if (n > 3)
+    {
+        number = (number << 1) + ref_bit(rc, prob + 3);
+        if (n > 4)
+        {
+            number = (number << 1) + ref_bit(rc, prob + 3);
+            if (n > 5)
+            {
+                // direct bits
+                ref_normalize(rc);
+
+                for (uint32_t i = 0; i < n - 5; i++)
+                {
+                    rc->range >>= 1;
+                    number <<= 1;
+                    if (rc->code < rc->range)
+                    {
+                        number += 1;
+                    }
+                    else
+                    {
+                        rc->code -= rc->range;
+                    }
+                }
+            }
+        }
+    }
+
+    if (n > 0)
+    {
+        number = (number << 1) + ref_bit(rc, prob);
+        if (n > 1)
+        {
+            number = (number << 1) + ref_bit(rc, prob + 1);
+            if (n > 2)
+            {
+                number = (number << 1) + ref_bit(rc, prob + 2);
+            }
+        }
+    }
+
+    return number;
+}
+
+static int ref_decompress(void* out, int out_len, const void* in, int in_len)
+{
+    ref_decode rc;
+    ref_init(&rc, out, out_len, in, in_len);
+
+    if (rc.lc & 0x80)
+    {
+        // plain text
+        memcpy(rc.output, rc.input + 5, rc.code);
+        return rc.code;
+    }
+
+    int rc_state = 0;
+    uint8_t last_byte = 0;
+
+    for (;;)
+    {
+        uint32_t match_step = 0;
+
+        int bit = ref_bit(&rc, &rc.bm_match[rc_state][match_step]);
+        if (bit == 0) // literal
+        {
+            if (rc_state > 0)
+            {
+                rc_state -= 1;
+            }
+
+            int byte = ref_bittree(&rc, &rc.bm_literal[((last_byte >> rc.lc) & 0x07)][0], 0x100);
+            byte -= 0x100;
+
+            if (rc.out_ptr == rc.out_len)
+            {
+                return -1;
+            }
+            rc.output[rc.out_ptr++] = (uint8_t)byte;
+            last_byte = (uint8_t)byte;
+        }
+        else // match
+        {
+            // find bits of match length
+            uint32_t len_bits = 0;
+            for (int i = 0; i < 7; i++)
+            {
+                match_step += 1;
+                bit = ref_bit(&rc, &rc.bm_match[rc_state][match_step]);
+                if (bit == 0)
+                {
+                    break;
+                }
+                len_bits += 1;
+            }
+
+            // find match length
+            uint32_t match_len;
+            if (len_bits == 0)
+            {
+                match_len = 1;
+            }
+            else
+            {
+                uint32_t len_state = ((len_bits - 1) << 2) + ((rc.out_ptr << (len_bits - 1)) & 0x03);
+                match_len = ref_number(&rc, &rc.bm_len[rc_state][len_state], len_bits);
+                if (match_len == 0xFF)
+                {
+                    // end of stream
+                    return rc.out_ptr;
+                }
+            }
+
+            // find number of bits of match distance
+            uint32_t dist_state = 0;
+            uint32_t limit = 8;
+            if (match_len > 2)
+            {
+                dist_state += 7;
+                limit = 44;
+            }
+            int dist_bits = ref_bittree(&rc, &rc.bm_dist_bits[len_bits][dist_state], limit);
+            dist_bits -= limit;
+
+            // find match distance
+            uint32_t match_dist;
+            if (dist_bits > 0)
+            {
+                match_dist = ref_number(&rc, &rc.bm_dist[dist_bits][0], dist_bits);
+            }
+            else
+            {
+                match_dist = 1;
+            }
+
+            // copy match bytes
+            if (match_dist > rc.out_ptr)
+            {
+                return -1;
+            }
+
+            if (rc.out_ptr + match_len + 1 > rc.out_len)
+            {
+                return -1;
+            }
+
+            const uint8_t* match_src = rc.output + rc.out_ptr - match_dist;
+            for (uint32_t i = 0; i <= match_len; i++)
+            {
+                rc.output[rc.out_ptr++] = *match_src++;
+            }
+            last_byte = match_src[-1];
+
+            rc_state = 6 + ((rc.out_ptr + 1) & 1);
+        }
+    }
+}
+
+// range encoder for the same model, the carry handling is the one lzma uses. it keeps
+// the decoder's range so both normalize at the same bits
+typedef struct
+{
+    uint8_t* out;
+    uint32_t size;
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint32_t cache_size;
+    lzrc_probs p;
+} lzrc_encoder;
+
+static void enc_shift_low(lzrc_encoder* e)
+{
+    if ((uint32_t)e->low < 0xff000000 || (e->low >> 32) != 0)
+    {
+        uint8_t carry = (uint8_t)(e->low >> 32);
+        uint8_t temp = e->cache;
+        do
+        {
+            e->out[e->size++] = temp + carry;
+            temp = 0xff;
+        } while (--e->cache_size != 0);
+        e->cache = (uint8_t)(e->low >> 24);
+    }
+    e->cache_size++;
+    e->low = (uint32_t)e->low << 8;
+}
+
+static void enc_normalize(lzrc_encoder* e)
+{
+    if (e->range < 0x01000000)
+    {
+        e->range <<= 8;
+        enc_shift_low(e);
+    }
+}
+
+static void enc_bit(lzrc_encoder* e, uint8_t* prob, uint32_t bit)
+{
+    enc_normalize(e);
+
+    uint32_t bound = (e->range >> 8) * *prob;
+    *prob -= *prob >> 3;
+    if (bit)
+    {
+        e->range = bound;
+        *prob += 31;
+    }
+    else
+    {
+        e->low += bound;
+        e->range -= bound;
+    }
+}
+
+static uint32_t top_bit(uint32_t value)
+{
+    return 31 - __builtin_clz(value);
+}
+
+// the bits of number below its top one, limit <= number < 2 * limit
+static void enc_bittree(lzrc_encoder* e, uint8_t* probs, uint32_t number)
+{
+    uint32_t prefix = 1;
+    for (int i = top_bit(number) - 1; i >= 0; i--)
+    {
+        uint32_t bit = (number >> i) & 1;
+        enc_bit(e, probs + prefix, bit);
+        prefix = (prefix << 1) + bit;
+    }
+}
+
+// the n bits of number below its top one, the first two and last three are modelled
+static void enc_number(lzrc_encoder* e, uint8_t* prob, uint32_t n, uint32_t number)
+{
+    int i = n - 1;
+
+    if (n > 3)
+    {
+        enc_bit(e, prob + 3, (number >> i--) & 1);
+        if (n > 4)
+        {
+            enc_bit(e, prob + 3, (number >> i--) & 1);
+            if (n > 5)
+            {
+                enc_normalize(e);
+                for (uint32_t k = 0; k < n - 5; k++)
+                {
+                    e->range >>= 1;
+                    if (((number >> i--) & 1) == 0)
+                    {
+                        e->low += e->range;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t k = 0; i >= 0; k++)
+    {
+        enc_bit(e, prob + k, (number >> i--) & 1);
+    }
+}
+
+// copies count = match_len + 1 bytes, a match_len of 0xff ends the stream
+static void enc_match(lzrc_encoder* e, uint32_t state, uint32_t pos, uint32_t match_len, uint32_t dist)
+{
+    uint32_t len_bits = match_len == 1 ? 0 : top_bit(match_len);
+
+    enc_bit(e, &e->p.bm_match[state][0], 1);
+    for (uint32_t i = 1; i <= len_bits; i++)
+    {
+        enc_bit(e, &e->p.bm_match[state][i], 1);
+    }
+    if (len_bits < 7)
+    {
+        enc_bit(e, &e->p.bm_match[state][len_bits + 1], 0);
+    }
+
+    if (len_bits)
+    {
+        uint32_t len_state = ((len_bits - 1) << 2) + ((pos << (len_bits - 1)) & 0x03);
+        enc_number(e, &e->p.bm_len[state][len_state], len_bits, match_len);
+    }
+    if (match_len == 0xff)
+    {
+        return;
+    }
+
+    uint32_t limit = match_len > 2 ? 44 : 8;
+    uint32_t dist_bits = dist == 1 ? 0 : top_bit(dist);
+    enc_bittree(e, &e->p.bm_dist_bits[len_bits][match_len > 2 ? 7 : 0], dist_bits + limit);
+    if (dist_bits)
+    {
+        enc_number(e, &e->p.bm_dist[dist_bits][0], dist_bits, dist);
+    }
+}
+
+static uint32_t match_length(const uint8_t* data, uint32_t size, uint32_t pos, uint32_t dist)
+{
+    uint32_t len = 0;
+    while (pos + len < size && len < 255 && data[pos + len] == data[pos + len - dist])
+    {
+        len++;
+    }
+    return len;
+}
+
+// greedy, and not after the best ratio: short and random lengths are taken on purpose so
+// every length and distance code shows up
+static uint32_t lzrc_compress(uint8_t* out, const uint8_t* data, uint32_t size, uint8_t lc)
+{
+    static lzrc_encoder e;
+    static uint32_t head[1 << 12];
+
+    memset(&e, 0, sizeof(e));
+    memset(&e.p, 0x80, sizeof(e.p));
+    memset(head, 0xff, sizeof(head));
+    e.out = out;
+    e.range = 0xffffffff;
+    e.cache_size = 1;
+
+    uint32_t state = 0;
+    uint8_t last_byte = 0;
+    uint32_t pos = 0;
+
+    while (pos < size)
+    {
+        uint32_t candidates[6] = { 1, 2, 4, 7, 8, (uint32_t)-1 };
+        if (pos + 3 <= size)
+        {
+            uint32_t h = (data[pos] * 506832829u + data[pos + 1] * 2654435761u + data[pos + 2]) >> 20;
+            if (head[h] != (uint32_t)-1)
+            {
+                candidates[5] = pos - head[h];
+            }
+            head[h] = pos;
+        }
+
+        uint32_t best_len = 0;
+        uint32_t best_dist = 0;
+        for (uint32_t i = 0; i < PKGI_COUNTOF(candidates); i++)
+        {
+            uint32_t dist = candidates[i];
+            if (dist == 0 || dist > pos)
+            {
+                continue;
+            }
+            uint32_t len = match_length(data, size, pos, dist);
+            if (len < 4 && dist > 255)
+            {
+                // short matches can only reach back 255 bytes
+                len = 0;
+            }
+            if (len > best_len)
+            {
+                best_len = len;
+                best_dist = dist;
+            }
+        }
+
+        if (best_len > 4 && test_rand() % 4 == 0)
+        {
+            best_len = 4 + test_rand() % (best_len - 3);
+        }
+
+        if (best_len >= 2)
+        {
+            enc_match(&e, state, pos, best_len - 1, best_dist);
+            pos += best_len;
+            last_byte = data[pos - 1];
+            state = 6 + ((pos + 1) & 1);
+        }
+        else
+        {
+            enc_bit(&e, &e.p.bm_match[state][0], 0);
+            if (state > 0)
+            {
+                state -= 1;
+            }
+            enc_bittree(&e, &e.p.bm_literal[(last_byte >> lc) & 0x07][0], 0x100 | data[pos]);
+            last_byte = data[pos++];
+        }
+    }
+
+    enc_match(&e, state, pos, 0xff, 0);
+    for (int i = 0; i < 5; i++)
+    {
+        enc_shift_low(&e);
+    }
+
+    // the first byte out of the range coder is always zero, lc goes in its place
+    out[0] = lc;
+    return e.size;
+}
+
+static uint8_t input[TEST_BLOCK_MAX];
+static uint8_t packed[TEST_PACKED_MAX];
+static uint8_t output[TEST_BLOCK_MAX];
+static uint8_t expected[TEST_BLOCK_MAX];
+
+// same return and same bytes written, whatever the input
+static int same_as_reference(const uint8_t* in, uint32_t in_len, uint32_t out_len)
+{
+    memset(output, 0x5a, sizeof(output));
+    memset(expected, 0x5a, sizeof(expected));
+
+    int res = lzrc_decompress(output, out_len, in, in_len);
+    int ref = ref_decompress(expected, out_len, in, in_len);
+
+    return res == ref && memcmp(output, expected, sizeof(output)) == 0;
+}
+
+static void fill_text(uint8_t* data, uint32_t size)
+{
+    static const char* words[] = { "the ", "psp ", "game ", "data ", "of ", "license ", "PARAM.SFO ", "\n", "EBOOT ", "a " };
+    uint32_t pos = 0;
+    while (pos < size)
+    {
+        const char* word = words[test_rand() % PKGI_COUNTOF(words)];
+        while (*word && pos < size)
+        {
+            data[pos++] = *word++;
+        }
+    }
+}
+
+// something like code: small integers, repeated opcodes, pointers into a small range
+static void fill_binary(uint8_t* data, uint32_t size)
+{
+    for (uint32_t i = 0; i + 4 <= size; i += 4)
+    {
+        uint32_t word = test_rand() % 3 == 0 ? 0x08800000 + (test_rand() % 0x4000) * 4 : (test_rand() % 16) << 26 | (test_rand() % 32);
+        memcpy(data + i, &word, 4);
+    }
+    memset(data + (size & ~3u), 0, size & 3);
+}
+
+static uint32_t fill_block(uint8_t* data, uint32_t kind)
+{
+    uint32_t size = kind < 6 ? TEST_BLOCK_MAX : test_rand() % TEST_BLOCK_MAX + 1;
+
+    switch (kind % 6)
+    {
+    case 0:
+        memset(data, 0, size);
+        break;
+    case 1:
+        test_fill(data, size);
+        break;
+    case 2:
+        fill_text(data, size);
+        break;
+    case 3:
+        fill_binary(data, size);
+        break;
+    case 4:
+        // short periods, for overlapping copies
+        for (uint32_t i = 0; i < size; i++)
+        {
+            data[i] = (uint8_t)(i % (kind % 7 + 3) * 37);
+        }
+        break;
+    default:
+        for (uint32_t pos = 0; pos < size; pos += 2048)
+        {
+            uint32_t n = min32(2048, size - pos);
+            if (test_rand() % 2)
+            {
+                fill_text(data + pos, n);
+            }
+            else
+            {
+                test_fill(data + pos, n);
+            }
+        }
+        break;
+    }
+
+    return size;
+}
+
+static void test_round_trip(void)
+{
+    for (uint32_t kind = 0; kind < 60; kind++)
+    {
+        uint32_t size = fill_block(input, kind);
+        uint8_t lc = (uint8_t)(kind % 8);
+
+        uint32_t packed_size = lzrc_compress(packed, input, size, lc);
+        CHECK(packed_size <= sizeof(packed));
+
+        memset(output, 0, sizeof(output));
+        CHECK(lzrc_decompress(output, TEST_BLOCK_MAX, packed, packed_size) == (int)size);
+        CHECK(memcmp(output, input, size) == 0);
+
+        CHECK(same_as_reference(packed, packed_size, TEST_BLOCK_MAX));
+
+        // one byte short of room
+        CHECK(lzrc_decompress(output, size - 1, packed, packed_size) == -1);
+    }
+
+    // nothing but the end marker
+    uint32_t packed_size = lzrc_compress(packed, input, 0, 0);
+    CHECK(lzrc_decompress(output, TEST_BLOCK_MAX, packed, packed_size) == 0);
+}
+
+static void test_plain(void)
+{
+    test_fill(input, 1000);
+
+    packed[0] = 0x85;
+    set32be(packed + 1, 1000);
+    memcpy(packed + 5, input, 1000);
+
+    CHECK(lzrc_decompress(output, TEST_BLOCK_MAX, packed, 1005) == 1000);
+    CHECK(memcmp(output, input, 1000) == 0);
+    CHECK(same_as_reference(packed, 1005, TEST_BLOCK_MAX));
+
+    // longer than the input or the output, the old decoder copied it anyway
+    CHECK(lzrc_decompress(output, TEST_BLOCK_MAX, packed, 1004) == -1);
+    CHECK(lzrc_decompress(output, 999, packed, 1005) == -1);
+    CHECK(lzrc_decompress(output, TEST_BLOCK_MAX, packed, 4) == -1);
+}
+
+static void test_fuzz(void)
+{
+    uint32_t mismatches = 0;
+
+    for (uint32_t run = 0; run < 4000; run++)
+    {
+        uint32_t in_len;
+        uint32_t out_len = test_rand() % 4 ? TEST_BLOCK_MAX : test_rand() % TEST_BLOCK_MAX + 1;
+
+        switch (run % 4)
+        {
+        case 0:
+            in_len = test_rand() % 4096 + 5;
+            test_fill(packed, in_len);
+            break;
+        case 1:
+        case 2:
+        {
+            uint32_t size = fill_block(input, 6 + run % 6);
+            in_len = lzrc_compress(packed, input, min32(size, 4096), (uint8_t)(run % 8));
+            uint32_t flips = test_rand() % 4 + 1;
+            for (uint32_t i = 0; i < flips; i++)
+            {
+                packed[1 + test_rand() % (in_len - 1)] ^= 1 << (test_rand() % 8);
+            }
+            break;
+        }
+        default:
+        {
+            uint32_t size = fill_block(input, 6 + run % 6);
+            in_len = lzrc_compress(packed, input, min32(size, 4096), (uint8_t)(run % 8));
+            in_len = 5 + test_rand() % (in_len - 4);
+            break;
+        }
+        }
+
+        // lc only selects the literal context, and a plain block over the buffers is
+        // the one case where the two are meant to differ
+        packed[0] &= 0x07;
+
+        if (!same_as_reference(packed, in_len, out_len))
+        {
+            mismatches++;
+        }
+    }
+
+    CHECK(mismatches == 0);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "lzrc round trip", test_round_trip },
+        { "lzrc plain block", test_plain },
+        { "lzrc corrupt input as before", test_fuzz },
+    };
+
+    return run_tests(tests, PKGI_COUNTOF(tests));
+}
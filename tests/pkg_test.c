@@ -0,0 +1,586 @@
+// reads synthetic psp pkgs with pkgi_pkg.c: the header, the item table, item names and
+// decrypting reads at any offset, and installs them with the depackager
+#include "pkgi.h"
+#include "pkgi_pkg.h"
+#include "pkgi_download.h"
+#include "pkgi_scratch.h"
+
+#include "check.h"
+#include "host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_CONTENT    "UP0000-TEST00000_00-0000000000000000"
+#define TEST_PKG        "test.pkg"
+#define TEST_ENC_OFFSET 0x200
+#define TEST_TAIL       0x60    // the digests and signature after the encrypted area
+
+// https://wiki.henkaku.xyz/vita/Packages#AES_Keys
+static const uint8_t psp_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
+static const uint8_t ps3_key[] = { 0x2e, 0x7b, 0x71, 0xd7, 0xc9, 0xc9, 0xa1, 0x4e, 0xa3, 0x22, 0x1f, 0x18, 0x88, 0x28, 0xb8, 0xf8 };
+
+typedef struct
+{
+    const char* name;
+    uint32_t size;
+    uint8_t psp_type;
+    uint8_t flags;          // 4 for folders
+} TestItem;
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t size;
+    uint32_t count;
+    PkgItem items[2048];    // where the builder put them
+} TestPkg;
+
+static TestPkg test_pkg;
+
+static uint32_t themes_converted;
+
+// pkgi_install() and the iso converter are not under test here
+void update_install_progress(const char* filename, int64_t progress)
+{
+    PKGI_UNUSED(filename);
+    PKGI_UNUSED(progress);
+}
+
+int convert_psp_pkg_iso(const char* pkg_arg, ImageFormat format, int level)
+{
+    PKGI_UNUSED(pkg_arg);
+    PKGI_UNUSED(format);
+    PKGI_UNUSED(level);
+    themes_converted++;
+    return 1;
+}
+
+static uint8_t item_byte(uint32_t index, uint64_t offset)
+{
+    return (uint8_t)(index * 31 + offset * 7 + (offset >> 9));
+}
+
+static uint32_t align16(uint32_t x)
+{
+    return (x + 15) & ~15u;
+}
+
+// lays out a psp pkg like the ones on the store: header and metadata, then the encrypted
+// item table, the names and the data of every item, and a plain tail
+static void build_pkg(const TestItem* items, uint32_t count)
+{
+    TestPkg* pkg = &test_pkg;
+
+    uint32_t names = count * PKG_ITEM_SIZE;
+    uint32_t data = names;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        data += align16(strlen(items[i].name));
+    }
+    uint32_t enc_size = data;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        enc_size += align16(items[i].size);
+    }
+
+    free(pkg->data);
+    pkg->count = count;
+    pkg->size = TEST_ENC_OFFSET + enc_size + TEST_TAIL;
+    pkg->data = calloc(1, pkg->size);
+
+    uint8_t* h = pkg->data;
+    memcpy(h, "\x7FPKG\x80\x00\x00\x02", 8);
+    set32be(h + 8, 0x100);                  // metadata offset
+    set32be(h + 12, 1);                     // metadata count
+    set32be(h + 20, count);
+    set64be(h + 24, pkg->size);
+    set64be(h + 32, TEST_ENC_OFFSET);
+    set64be(h + 40, enc_size);
+    memcpy(h + 0x30, TEST_CONTENT, strlen(TEST_CONTENT));
+    test_fill(h + 0x70, 16);                // data iv
+
+    // content type 7, a psp game
+    set32be(h + 0x100, 2);
+    set32be(h + 0x104, 4);
+    set32be(h + 0x108, 7);
+
+    aes128_ctx psp, ps3;
+    aes128_init(&psp, psp_key);
+    aes128_init(&ps3, ps3_key);
+
+    uint8_t* enc = pkg->data + TEST_ENC_OFFSET;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PkgItem* item = &pkg->items[i];
+        item->name_offset = names;
+        item->name_size = strlen(items[i].name);
+        item->data_offset = data;
+        item->data_size = items[i].size;
+        item->psp_type = items[i].psp_type;
+        item->flags = items[i].flags;
+
+        uint8_t* entry = enc + i * PKG_ITEM_SIZE;
+        set32be(entry + 0, item->name_offset);
+        set32be(entry + 4, item->name_size);
+        set64be(entry + 8, item->data_offset);
+        set64be(entry + 16, item->data_size);
+        entry[24] = item->psp_type;
+        entry[27] = item->flags;
+
+        memcpy(enc + names, items[i].name, item->name_size);
+        for (uint32_t k = 0; k < item->data_size; k++)
+        {
+            enc[data + k] = item_byte(i, k);
+        }
+
+        aes128_ctx* key = item->psp_type == PKG_ITEM_PSP ? &psp : &ps3;
+        aes128_ctr_xor(key, h + 0x70, names / 16, enc + names, align16(item->name_size));
+        aes128_ctr_xor(key, h + 0x70, data / 16, enc + data, align16(item->data_size));
+
+        names += align16(item->name_size);
+        data += align16(item->data_size);
+    }
+    aes128_ctr_xor(&psp, h + 0x70, 0, enc, count * PKG_ITEM_SIZE);
+
+    aes128_free(&psp);
+    aes128_free(&ps3);
+}
+
+static void write_pkg(char* path, uint32_t size)
+{
+    CHECK(host_write_file(TEST_PKG, test_pkg.data, test_pkg.size));
+    host_path(path, size, TEST_PKG);
+}
+
+static int item_data_matches(uint32_t index, uint64_t offset, const uint8_t* data, uint32_t size)
+{
+    for (uint32_t k = 0; k < size; k++)
+    {
+        if (data[k] != item_byte(index, offset + k))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const TestItem game_items[] =
+{
+    { "USRDIR/CONTENT", 0, PKG_ITEM_PSP, 4 },
+    { "USRDIR/CONTENT/EBOOT.PBP", 700001, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/DOCUMENT.DAT", 123457, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/EMPTY.BIN", 0, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/PS3.BIN", 40000, 0, 0 },
+    { "USRDIR/CONTENT/ICON0.PNG", 15, PKG_ITEM_PSP, 0 },
+};
+
+static int same_item(const PkgItem* a, const PkgItem* b)
+{
+    return a->name_offset == b->name_offset && a->name_size == b->name_size && a->data_offset == b->data_offset &&
+        a->data_size == b->data_size && a->psp_type == b->psp_type && a->flags == b->flags;
+}
+
+static void check_header(PkgFile* pkg)
+{
+    CHECK(pkg->type == PKG_TYPE_PSP);
+    CHECK(pkg->content_type == 7);
+    CHECK(pkg->item_count == test_pkg.count);
+    CHECK(pkg->total_size == test_pkg.size);
+    CHECK(pkg->enc_offset == TEST_ENC_OFFSET);
+    CHECK(strcmp(pkg->content_id, TEST_CONTENT) == 0);
+    CHECK(strcmp(pkg->title_id, "TEST00000") == 0);
+}
+
+static void test_items(void)
+{
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+    char path[256];
+    write_pkg(path, sizeof(path));
+
+    PkgFile pkg;
+    CHECK(pkgi_pkg_open(&pkg, path));
+    check_header(&pkg);
+
+    for (uint32_t i = 0; i < PKGI_COUNTOF(game_items); i++)
+    {
+        PkgItem item;
+        char name[256];
+        CHECK(pkgi_pkg_get_item(&pkg, i, &item));
+        CHECK(same_item(&item, &test_pkg.items[i]));
+        CHECK(pkgi_pkg_item_name(&pkg, &item, name, sizeof(name)));
+        CHECK(strcmp(name, game_items[i].name) == 0);
+    }
+
+    PkgItem item;
+    CHECK(!pkgi_pkg_get_item(&pkg, PKGI_COUNTOF(game_items), &item));
+    pkgi_pkg_close(&pkg);
+}
+
+// reads of any offset and size, through the file and from memory
+static void check_random_reads(PkgFile* pkg)
+{
+    static uint8_t buffer[256 * 1024];
+
+    for (uint32_t run = 0; run < 3000; run++)
+    {
+        uint32_t index = 1 + test_rand() % (PKGI_COUNTOF(game_items) - 1);
+        const PkgItem* item = &test_pkg.items[index];
+        if (!item->data_size)
+        {
+            continue;
+        }
+
+        uint64_t offset = test_rand() % item->data_size;
+        uint32_t size = (uint32_t)(run % 2 ? test_rand() % 40 : test_rand() % sizeof(buffer));
+        if (size > item->data_size - offset)
+        {
+            size = (uint32_t)(item->data_size - offset);
+        }
+
+        memset(buffer, 0, sizeof(buffer));
+        CHECK(pkgi_pkg_read(pkg, item, offset, buffer, size));
+        CHECK(item_data_matches(index, offset, buffer, size));
+        if (!item_data_matches(index, offset, buffer, size))
+        {
+            break;
+        }
+    }
+
+    uint8_t byte;
+    CHECK(!pkgi_pkg_read(pkg, &test_pkg.items[1], test_pkg.items[1].data_size, &byte, 1));
+}
+
+static void test_reads(void)
+{
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+    char path[256];
+    write_pkg(path, sizeof(path));
+
+    PkgFile pkg;
+    CHECK(pkgi_pkg_open(&pkg, path));
+    check_random_reads(&pkg);
+    pkgi_pkg_close(&pkg);
+
+    CHECK(pkgi_pkg_open_memory(&pkg, test_pkg.data, test_pkg.size, test_pkg.size));
+    check_header(&pkg);
+    check_random_reads(&pkg);
+    pkgi_pkg_close(&pkg);
+}
+
+// the installers read raw blocks themselves and decrypt them in place, 16 byte aligned
+static void test_decrypt_blocks(void)
+{
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+
+    PkgFile pkg;
+    CHECK(pkgi_pkg_open_memory(&pkg, test_pkg.data, test_pkg.size, test_pkg.size));
+
+    for (uint32_t index = 1; index < PKGI_COUNTOF(game_items); index++)
+    {
+        const PkgItem* item = &test_pkg.items[index];
+        uint8_t* data = malloc(item->data_size + 1);
+        memcpy(data, test_pkg.data + TEST_ENC_OFFSET + item->data_offset, item->data_size);
+
+        uint64_t offset = 0;
+        while (offset < item->data_size)
+        {
+            uint32_t size = (test_rand() % 8192 + 1) * 16;
+            if (size > item->data_size - offset)
+            {
+                size = (uint32_t)(item->data_size - offset);
+            }
+            pkgi_pkg_decrypt(&pkg, item, offset, data + offset, size);
+            offset += size;
+        }
+
+        CHECK(item_data_matches(index, 0, data, item->data_size));
+        free(data);
+    }
+
+    pkgi_pkg_close(&pkg);
+}
+
+// where the depackager puts an item
+static void installed_path(char* path, uint32_t size, const char* name)
+{
+    snprintf(path, size, "%s%s/TEST00000/%s", host_root, PKGI_INSTALL_FOLDER, name + 15);
+}
+
+// every psp file item is installed with its data, nothing else is
+static int check_installed(const TestItem* items, uint32_t count)
+{
+    int ok = 1;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char path[256];
+        installed_path(path, sizeof(path), items[i].name);
+        int64_t size = pkgi_get_size(path);
+
+        if (items[i].psp_type != PKG_ITEM_PSP || items[i].flags == 4 || items[i].size == 0)
+        {
+            ok &= items[i].flags == 4 || size < 0;
+            continue;
+        }
+
+        uint8_t* data = malloc(items[i].size + 1);
+        int loaded = pkgi_load(path, data, items[i].size + 1);
+        ok &= size == items[i].size && loaded == (int)items[i].size && item_data_matches(i, 0, data, items[i].size);
+        free(data);
+    }
+    return ok;
+}
+
+static TestItem* many_items(uint32_t count)
+{
+    static char names[2048][32];
+    static TestItem items[2048];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "USRDIR/CONTENT/D%02u/F%04u.BIN", i % 7, i);
+        items[i].name = names[i];
+        items[i].size = i * 37 % 3000;
+        items[i].psp_type = PKG_ITEM_PSP;
+        items[i].flags = 0;
+    }
+    return items;
+}
+
+// the table is decrypted a batch at a time, entries are asked for in any order
+static void test_large_table(void)
+{
+    const uint32_t count = 1300;
+    host_reset();
+    TestItem* items = many_items(count);
+    build_pkg(items, count);
+
+    PkgFile pkg;
+    CHECK(pkgi_pkg_open_memory(&pkg, test_pkg.data, test_pkg.size, test_pkg.size));
+    CHECK(pkg.item_count == count);
+
+    for (uint32_t run = 0; run < 5000; run++)
+    {
+        uint32_t index = run < count ? count - 1 - run : test_rand() % count;
+        PkgItem item;
+        char name[64];
+        CHECK(pkgi_pkg_get_item(&pkg, index, &item));
+        CHECK(same_item(&item, &test_pkg.items[index]));
+        CHECK(pkgi_pkg_item_name(&pkg, &item, name, sizeof(name)) && strcmp(name, items[index].name) == 0);
+        if (!same_item(&item, &test_pkg.items[index]))
+        {
+            break;
+        }
+    }
+
+    pkgi_pkg_close(&pkg);
+}
+
+static void test_install(void)
+{
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+    char path[256];
+    write_pkg(path, sizeof(path));
+
+    CHECK(install_psp_pkg(path) == 1);
+    CHECK(check_installed(game_items, PKGI_COUNTOF(game_items)));
+}
+
+static void test_install_large_table(void)
+{
+    const uint32_t count = 1300;
+    host_reset();
+    TestItem* items = many_items(count);
+    build_pkg(items, count);
+    char path[256];
+    write_pkg(path, sizeof(path));
+
+    CHECK(install_psp_pkg(path) == 1);
+    CHECK(check_installed(items, count));
+}
+
+// names up to the size the caller gives, with no fixed buffer in between
+static void test_long_name(void)
+{
+    static char name[1000];
+    memcpy(name, "USRDIR/CONTENT/", 15);
+    memset(name + 15, 'N', sizeof(name) - 16);
+
+    const TestItem items[] =
+    {
+        { name, 100, PKG_ITEM_PSP, 0 },
+    };
+
+    host_reset();
+    build_pkg(items, PKGI_COUNTOF(items));
+
+    PkgFile pkg;
+    PkgItem item;
+    char read_name[1024];
+    CHECK(pkgi_pkg_open_memory(&pkg, test_pkg.data, test_pkg.size, test_pkg.size));
+    CHECK(pkgi_pkg_get_item(&pkg, 0, &item));
+    CHECK(pkgi_pkg_item_name(&pkg, &item, read_name, sizeof(read_name)) && strcmp(read_name, name) == 0);
+    CHECK(!pkgi_pkg_item_name(&pkg, &item, read_name, 999));
+    pkgi_pkg_close(&pkg);
+}
+
+static uint32_t blocks_of(const TestItem* items, uint32_t count, uint32_t block)
+{
+    uint32_t blocks = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (items[i].psp_type == PKG_ITEM_PSP && items[i].flags != 4)
+        {
+            blocks += (items[i].size + block - 1) / block;
+        }
+    }
+    return blocks;
+}
+
+static const TestItem big_items[] =
+{
+    { "USRDIR/CONTENT/EBOOT.PBP", 1024 * 1024 + 17, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/THREE.BIN", 3 * 128 * 1024, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/SHORT.BIN", 128 * 1024 - 1, PKG_ITEM_PSP, 0 },
+    { "USRDIR/CONTENT/TINY.BIN", 5, PKG_ITEM_PSP, 0 },
+};
+
+// reads, decryption and writes overlap over three buffers. the host only carries out an
+// async read or write when it is waited for, so a buffer reused too early shows in the files
+static void test_install_pipeline(void)
+{
+    host_reset();
+    build_pkg(big_items, PKGI_COUNTOF(big_items));
+    char path[256];
+    write_pkg(path, sizeof(path));
+
+    uint32_t blocks = blocks_of(big_items, PKGI_COUNTOF(big_items), pkgi_scratch_io_block());
+    CHECK(install_psp_pkg(path) == 1);
+    CHECK(check_installed(big_items, PKGI_COUNTOF(big_items)));
+    CHECK(host_async_reads == blocks);
+    CHECK(host_async_writes == blocks);
+    CHECK(host_async_misuse == 0);
+}
+
+// a failed write stops the install, with nothing left in flight
+static void test_install_write_error(void)
+{
+    host_reset();
+    build_pkg(big_items, PKGI_COUNTOF(big_items));
+    char path[256];
+    write_pkg(path, sizeof(path));
+    host_fail_async_write_at = 4;
+
+    CHECK(install_psp_pkg(path) == 0);
+    CHECK(host_async_writes == 4);
+    CHECK(host_async_misuse == 0);
+}
+
+// pkg_stream_write() as the download calls it, with whatever sizes curl hands over
+static int stream_pkg(uint32_t max_chunk, uint32_t stop, int keep)
+{
+    pkg_stream* ps = pkg_stream_open();
+    CHECK(ps != NULL);
+    if (!ps)
+    {
+        return 0;
+    }
+
+    uint32_t offset = 0;
+    while (offset < stop)
+    {
+        uint32_t n = test_rand() % max_chunk + 1;
+        if (n > stop - offset)
+        {
+            n = stop - offset;
+        }
+        if (pkg_stream_write(ps, test_pkg.data + offset, n) != 1)
+        {
+            break;
+        }
+        offset += n;
+    }
+    CHECK(offset == stop);
+
+    return pkg_stream_close(ps, keep);
+}
+
+static void test_stream_install(void)
+{
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+    CHECK(stream_pkg(70000, test_pkg.size, 1) == 1);
+    CHECK(check_installed(game_items, PKGI_COUNTOF(game_items)));
+
+    host_reset();
+    build_pkg(big_items, PKGI_COUNTOF(big_items));
+    CHECK(stream_pkg(300000, test_pkg.size, 1) == 1);
+    CHECK(check_installed(big_items, PKGI_COUNTOF(big_items)));
+    CHECK(host_async_writes == blocks_of(big_items, PKGI_COUNTOF(big_items), pkgi_scratch_io_block()));
+    CHECK(host_async_misuse == 0);
+
+    host_reset();
+    build_pkg(big_items, PKGI_COUNTOF(big_items));
+    CHECK(stream_pkg(100, 300000, 1) == 0);
+
+    const uint32_t count = 1300;
+    TestItem* items = many_items(count);
+    host_reset();
+    build_pkg(items, count);
+    CHECK(stream_pkg(5000, test_pkg.size, 1) == 1);
+    CHECK(check_installed(items, count));
+}
+
+// a download that stops early takes the files it installed out again
+static void test_stream_cancel(void)
+{
+    host_reset();
+    build_pkg(big_items, PKGI_COUNTOF(big_items));
+    CHECK(stream_pkg(65536, test_pkg.size - 1000, 1) == 0);
+    CHECK(host_async_misuse == 0);
+
+    for (uint32_t i = 0; i < PKGI_COUNTOF(big_items); i++)
+    {
+        char path[256];
+        installed_path(path, sizeof(path), big_items[i].name);
+        CHECK(pkgi_get_size(path) < 0);
+    }
+
+    // a complete one that is not kept, like after a hash mismatch
+    host_reset();
+    build_pkg(game_items, PKGI_COUNTOF(game_items));
+    CHECK(stream_pkg(65536, test_pkg.size, 0) == 1);
+
+    char path[256];
+    installed_path(path, sizeof(path), game_items[1].name);
+    CHECK(pkgi_get_size(path) < 0);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "header and items", test_items },
+        { "reads at any offset", test_reads },
+        { "decrypt in aligned blocks", test_decrypt_blocks },
+        { "large item table", test_large_table },
+        { "install", test_install },
+        { "install with a large item table", test_install_large_table },
+        { "long item name", test_long_name },
+        { "install pipeline", test_install_pipeline },
+        { "install with a failed write", test_install_write_error },
+        { "streamed install", test_stream_install },
+        { "streamed install stopped early", test_stream_cancel },
+    };
+
+    int result = run_tests(tests, PKGI_COUNTOF(tests));
+    host_cleanup();
+    free(test_pkg.data);
+
+    return result;
+}
@@ -0,0 +1,167 @@
+// known answers for pkgi_sha256.c, and the context surviving a save and load the way
+// .resume files keep it
+#include "pkgi_sha256.h"
+
+#include "check.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int digest_is(const uint8_t* digest, const char* hex)
+{
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    test_unhex(expect, hex, sizeof(expect));
+    return memcmp(digest, expect, sizeof(expect)) == 0;
+}
+
+// FIPS 180-2 appendix B, and the empty message
+static void test_vectors(void)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    sha256((const uint8_t*)"", 0, digest);
+    CHECK(digest_is(digest, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+
+    sha256((const uint8_t*)"abc", 3, digest);
+    CHECK(digest_is(digest, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+    const char* two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    sha256((const uint8_t*)two_blocks, strlen(two_blocks), digest);
+    CHECK(digest_is(digest, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+
+    uint8_t* million = malloc(1000000);
+    memset(million, 'a', 1000000);
+    sha256(million, 1000000, digest);
+    CHECK(digest_is(digest, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+    free(million);
+}
+
+static uint8_t* pattern(uint32_t size)
+{
+    uint8_t* data = malloc(size);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)(i * 7 + 3);
+    }
+    return data;
+}
+
+// lengths around the padding boundaries, digests from python's hashlib
+static void test_padding(void)
+{
+    static const struct
+    {
+        uint32_t size;
+        const char* digest;
+    } vectors[] =
+    {
+        { 55, "e7313d333c272e639f790978283f9eb392e843d0f29b7016828bb1daa4aac70b" },
+        { 56, "4324d65f3c103567f5589c710bc08f8523f929a9272e3af36fc968e52abc6c27" },
+        { 63, "81c80242132f230c3bd41b3e63bbcff16107339549214a99614ff26664625055" },
+        { 64, "39e3d7b6b5d075d37d053ad89b24b41bef4f3c29760c84447cab3f3be1882241" },
+        { 65, "aacca6ff74fdbb296d165a45cecfa04e5127bc008770fbbdd48006f2d2fae95e" },
+        { 119, "9ce7368e4daf32341631b492e80359dc9f594b48453cd0dd5bf0b19279cc177e" },
+        { 120, "7836b787757e95e58b3ca5aec90b1b004e8deba1e50e9675af9cabf1a13a04b5" },
+        { 1000, "1e9bc38cbf860b9ec31918b065f9b52476c549a782e0e7990bed8ce3868d2371" },
+        { 65537, "ad8b370d36508e55e3c9cd44667a6e36e35955d0ff9f8fe59805bb18c2db5dd8" },
+    };
+
+    for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        uint8_t* data = pattern(vectors[i].size);
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256(data, vectors[i].size, digest);
+        CHECK(digest_is(digest, vectors[i].digest));
+        free(data);
+    }
+}
+
+// the download feeds whatever curl hands over, of any size and alignment
+static void test_split_updates(void)
+{
+    const uint32_t size = 200000;
+    uint8_t* data = pattern(size);
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    sha256(data, size, expect);
+
+    for (uint32_t run = 0; run < 200; run++)
+    {
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+
+        uint32_t offset = 0;
+        while (offset < size)
+        {
+            uint32_t n = run % 2 ? test_rand() % 130 : test_rand() % 20000;
+            if (n > size - offset)
+            {
+                n = size - offset;
+            }
+            sha256_update(&ctx, data + offset, n);
+            offset += n;
+        }
+
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_finish(&ctx, digest);
+        CHECK(memcmp(digest, expect, sizeof(digest)) == 0);
+        if (memcmp(digest, expect, sizeof(digest)) != 0)
+        {
+            break;
+        }
+    }
+
+    free(data);
+}
+
+// .resume files written by earlier versions hold an mbedtls 2.x context, byte for byte
+static void test_saved_context(void)
+{
+    CHECK(sizeof(sha256_ctx) == 108);
+    CHECK(offsetof(sha256_ctx, total) == 0);
+    CHECK(offsetof(sha256_ctx, state) == 8);
+    CHECK(offsetof(sha256_ctx, buffer) == 40);
+    CHECK(offsetof(sha256_ctx, is224) == 104);
+
+    const uint32_t size = 100000;
+    uint8_t* data = pattern(size);
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    sha256(data, size, expect);
+
+    for (uint32_t run = 0; run < 100; run++)
+    {
+        uint32_t split = test_rand() % size;
+
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, data, split);
+
+        uint8_t saved[sizeof(sha256_ctx)];
+        memcpy(saved, &ctx, sizeof(saved));
+        CHECK(ctx.total[0] == split && ctx.total[1] == 0);
+
+        sha256_ctx loaded;
+        memset(&loaded, 0xcc, sizeof(loaded));
+        memcpy(&loaded, saved, sizeof(saved));
+        sha256_update(&loaded, data + split, size - split);
+
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_finish(&loaded, digest);
+        CHECK(memcmp(digest, expect, sizeof(digest)) == 0);
+    }
+
+    free(data);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "vectors", test_vectors },
+        { "padding boundaries", test_padding },
+        { "split updates", test_split_updates },
+        { "saved context", test_saved_context },
+    };
+
+    return run_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
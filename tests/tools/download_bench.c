@@ -0,0 +1,131 @@
+// times pkgi_download() against the fake http server, to compare the write pipeline before
+// and after a change. wall clock numbers are the host cpu and disk, the network side runs
+// on the virtual clock of tests/host. run with
+//   download_bench [size in MiB] [runs]
+#include "pkgi_download.h"
+#include "pkgi_sha256.h"
+
+#include "host.h"
+#include "fake_http.h"
+#include "fake_install.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_CONTENT "UP0000-BENCH0000_00-0000000000000000"
+
+typedef struct
+{
+    const char* name;
+    uint32_t stream_flags;
+    uint32_t drops;         // random connection drops over the whole body
+    uint32_t latency;
+    uint32_t rate;
+} Scenario;
+
+static const Scenario scenarios[] =
+{
+    { "file",                   0,               0,  0,   0 },
+    { "file, 8 drops",          0,               8,  0,   0 },
+    { "stream pkg",             PKGI_STREAM_PKG, 0,  0,   0 },
+    { "stream pkg, 8 drops",    PKGI_STREAM_PKG, 8,  0,   0 },
+    { "file, 250ms 1.5MB/s",    0,               0,  250, 1536 },
+};
+
+static uint8_t* body;
+static uint32_t body_size;
+static uint8_t digest[SHA256_DIGEST_SIZE];
+
+static double wall_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void run(const Scenario* s, uint32_t runs)
+{
+    static char url[256];
+    snprintf(url, sizeof(url), "http://127.0.0.1/%s.pkg", BENCH_CONTENT);
+
+    DbItem item = { 0 };
+    item.content = BENCH_CONTENT;
+    item.type = ContentGame;
+    item.url = url;
+    item.digest = digest;
+    item.size = body_size;
+
+    double best = 0;
+    uint32_t ok = 0;
+    uint32_t ttfb = 0;
+    uint32_t elapsed = 0;
+    uint32_t requests = 0;
+
+    for (uint32_t r = 0; r < runs; r++)
+    {
+        host_reset();
+        fake_reset(body, body_size);
+        fake_install_reset(body_size);
+        fake.latency = s->latency;
+        fake.rate = s->rate;
+
+        srand(r + 1);
+        for (uint32_t i = 0; i < s->drops && fake.drops < FAKE_DROPS_MAX; i++)
+        {
+            fake.drop_at[fake.drops++] = 1 + (uint64_t)rand() * rand() % (body_size - 1);
+        }
+
+        uint32_t start = host_time;
+        double wall = wall_msec();
+        int result = pkgi_download(&item, s->stream_flags);
+        wall = wall_msec() - wall;
+
+        // pkgi_download() only succeeds once the sha256 of what it got matched
+        if (result && fake.served >= body_size && host_errors == 0)
+        {
+            ok++;
+        }
+        if (best == 0 || wall < best)
+        {
+            best = wall;
+        }
+        ttfb = fake.first_byte - start;
+        elapsed = host_time - start;
+        requests = fake.requests;
+    }
+
+    printf("%-24s %8.1f MB/s %8u ms %8u ms %5u %5u/%u\n", s->name, body_size / 1048576.0 / (best / 1000.0),
+        ttfb, elapsed, requests, ok, runs);
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t size_mb = argc > 1 ? (uint32_t)atoi(argv[1]) : 64;
+    uint32_t runs = argc > 2 ? (uint32_t)atoi(argv[2]) : 3;
+
+    body_size = size_mb * 1024 * 1024 + 1234;
+    body = malloc(body_size);
+    if (!body || runs == 0)
+    {
+        fprintf(stderr, "usage: %s [size in MiB] [runs]\n", argv[0]);
+        return 1;
+    }
+    for (uint32_t i = 0; i < body_size; i++)
+    {
+        body[i] = (uint8_t)((i * 2654435761u) >> 13);
+    }
+    sha256(body, body_size, digest);
+
+    printf("%u MiB, best of %u runs\n", size_mb, runs);
+    printf("%-24s %13s %11s %11s %5s %7s\n", "", "pipeline", "ttfb", "virtual", "reqs", "ok");
+    for (uint32_t i = 0; i < PKGI_COUNTOF(scenarios); i++)
+    {
+        run(&scenarios[i], runs);
+    }
+
+    host_cleanup();
+    free(body);
+    return 0;
+}
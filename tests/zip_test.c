@@ -0,0 +1,342 @@
+// extracts synthetic zip archives with extract_zip() of zip_util.c, through the libzip
+// stand-in in host/: file contents, the directory cache and the two buffer async writes
+#include "pkgi.h"
+#include "pkgi_download.h"
+#include "pkgi_scratch.h"
+
+#include "check.h"
+#include "host.h"
+#include "zip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define TEST_ZIP "test.zip"
+#define NO_ENTRY ((uint32_t)-1)
+
+typedef struct
+{
+    const char* name;
+    uint32_t size;
+    int deflated;
+} TestEntry;
+
+// zip_util.c reports progress to the installer, not under test here
+void update_install_progress(const char* filename, int64_t progress)
+{
+    PKGI_UNUSED(filename);
+    PKGI_UNUSED(progress);
+}
+
+static uint8_t entry_byte(uint32_t index, uint32_t offset)
+{
+    return (uint8_t)(index * 29 + offset * 11 + (offset >> 10));
+}
+
+static void put16(uint8_t* p, uint32_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t x)
+{
+    put16(p, x);
+    put16(p + 2, x >> 16);
+}
+
+// local headers and data, then the central directory. bad_crc gets a wrong crc in both
+static void write_zip(const TestEntry* entries, uint32_t count, uint32_t bad_crc)
+{
+    uint64_t capacity = 22;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        capacity += 30 + 46 + 2 * strlen(entries[i].name) + compressBound(entries[i].size);
+    }
+    uint8_t* zip = malloc(capacity);
+    uint32_t* offsets = malloc(count * sizeof(uint32_t));
+    uint32_t* crcs = malloc(count * sizeof(uint32_t));
+    uint32_t* comp_sizes = malloc(count * sizeof(uint32_t));
+    uint32_t pos = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const TestEntry* e = &entries[i];
+        uint32_t name_size = strlen(e->name);
+
+        uint8_t* data = malloc(e->size + 1);
+        for (uint32_t k = 0; k < e->size; k++)
+        {
+            data[k] = entry_byte(i, k);
+        }
+        crcs[i] = crc32(crc32(0, NULL, 0), data, e->size) ^ (i == bad_crc);
+
+        uint8_t* out = zip + pos + 30 + name_size;
+        if (e->deflated)
+        {
+            z_stream z;
+            memset(&z, 0, sizeof(z));
+            deflateInit2(&z, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+            z.next_in = data;
+            z.avail_in = e->size;
+            z.next_out = out;
+            z.avail_out = compressBound(e->size);
+            CHECK(deflate(&z, Z_FINISH) == Z_STREAM_END);
+            comp_sizes[i] = z.total_out;
+            deflateEnd(&z);
+        }
+        else
+        {
+            memcpy(out, data, e->size);
+            comp_sizes[i] = e->size;
+        }
+        free(data);
+
+        uint8_t* h = zip + pos;
+        memset(h, 0, 30);
+        put32(h, 0x04034b50);
+        put16(h + 4, 20);
+        put16(h + 8, e->deflated ? 8 : 0);
+        put32(h + 14, crcs[i]);
+        put32(h + 18, comp_sizes[i]);
+        put32(h + 22, e->size);
+        put16(h + 26, name_size);
+        memcpy(h + 30, e->name, name_size);
+
+        offsets[i] = pos;
+        pos += 30 + name_size + comp_sizes[i];
+    }
+
+    uint32_t central = pos;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const TestEntry* e = &entries[i];
+        uint32_t name_size = strlen(e->name);
+
+        uint8_t* h = zip + pos;
+        memset(h, 0, 46);
+        put32(h, 0x02014b50);
+        put16(h + 4, 20);
+        put16(h + 6, 20);
+        put16(h + 10, e->deflated ? 8 : 0);
+        put32(h + 16, crcs[i]);
+        put32(h + 20, comp_sizes[i]);
+        put32(h + 24, e->size);
+        put16(h + 28, name_size);
+        put32(h + 42, offsets[i]);
+        memcpy(h + 46, e->name, name_size);
+        pos += 46 + name_size;
+    }
+
+    uint8_t* end = zip + pos;
+    memset(end, 0, 22);
+    put32(end, 0x06054b50);
+    put16(end + 8, count);
+    put16(end + 10, count);
+    put32(end + 12, pos - central);
+    put32(end + 16, central);
+    pos += 22;
+
+    CHECK(host_write_file(TEST_ZIP, zip, pos));
+
+    free(comp_sizes);
+    free(crcs);
+    free(offsets);
+    free(zip);
+}
+
+static int extract(void)
+{
+    char path[256];
+    host_path(path, sizeof(path), TEST_ZIP);
+    return extract_zip(path);
+}
+
+// where extract_zip() puts an entry, without the leading "/" and "PSP/GAME/"
+static void extracted_path(char* path, uint32_t size, const char* name)
+{
+    if (name[0] == '/')
+    {
+        name++;
+    }
+    if (strncmp(name, "PSP/GAME/", 9) == 0)
+    {
+        name += 9;
+    }
+    snprintf(path, size, "%s/PSP/GAME/%s", host_root, name);
+}
+
+static int extracted(uint32_t index, const TestEntry* e)
+{
+    char path[256];
+    extracted_path(path, sizeof(path), e->name);
+
+    if (pkgi_get_size(path) != e->size)
+    {
+        return 0;
+    }
+
+    uint8_t* data = malloc(e->size + 1);
+    int ok = pkgi_load(path, data, e->size + 1) == (int)e->size;
+    for (uint32_t k = 0; ok && k < e->size; k++)
+    {
+        ok = data[k] == entry_byte(index, k);
+    }
+    free(data);
+    return ok;
+}
+
+static uint32_t async_writes_for(const TestEntry* entries, uint32_t count)
+{
+    uint32_t block = pkgi_scratch_io_block();
+    uint32_t writes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        writes += (entries[i].size + block - 1) / block;
+    }
+    return writes;
+}
+
+static void test_extract(void)
+{
+    static char names[40][32];
+    TestEntry entries[46] =
+    {
+        { "PSP/GAME/HBTEST/", 0, 0 },
+        { "PSP/GAME/HBTEST/EBOOT.PBP", 700001, 1 },
+        { "PSP/GAME/HBTEST/PARAM.SFO", 4000, 0 },
+        { "/HBTEST/DATA/EMPTY.BIN", 0, 0 },
+        { "HBTEST/DATA/SUB/TWO_BLOCKS.BIN", 2 * 128 * 1024, 1 },
+        { "HBTEST/DATA/SUB/ONE_BYTE.BIN", 1, 1 },
+    };
+    uint32_t count = 6;
+    for (uint32_t i = 0; i < 40; i++, count++)
+    {
+        snprintf(names[i], sizeof(names[i]), "HBTEST/DATA/FILE%02u.BIN", i);
+        entries[count].name = names[i];
+        entries[count].size = test_rand() % (300 * 1024);
+        entries[count].deflated = i % 2;
+    }
+
+    host_reset();
+    write_zip(entries, count, NO_ENTRY);
+
+    CHECK(extract() == (int)count);
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        CHECK(extracted(i, &entries[i]));
+    }
+
+    // HBTEST, DATA and SUB once each, however many files they hold
+    CHECK(host_mkdirs_calls == 3);
+
+    CHECK(host_async_writes == async_writes_for(entries, count));
+    CHECK(host_async_misuse == 0);
+    CHECK(host_zip_open == 0);
+}
+
+static void test_dir_cache_full(void)
+{
+    // two files in each folder, more folders than the cache takes
+    static char names[1200][32];
+    static TestEntry entries[1200];
+    for (uint32_t i = 0; i < 1200; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "HBTEST/D%03u/F%u", i / 2, i % 2);
+        entries[i].name = names[i];
+        entries[i].size = i % 7;
+    }
+
+    host_reset();
+    write_zip(entries, 1200, NO_ENTRY);
+
+    CHECK(extract() == 1200);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < 1200; i++)
+    {
+        wrong += !extracted(i, &entries[i]);
+    }
+    CHECK(wrong == 0);
+
+    // the first 512 folders are remembered, the rest are made again for their second file
+    CHECK(host_mkdirs_calls == 512 + 2 * (600 - 512));
+    CHECK(host_zip_open == 0);
+}
+
+static const TestEntry three_entries[] =
+{
+    { "HBTEST/EBOOT.PBP", 300000, 1 },
+    { "HBTEST/DATA.BIN", 500000, 1 },
+    { "HBTEST/LAST.BIN", 1000, 0 },
+};
+
+static void test_bad_crc(void)
+{
+    host_reset();
+    write_zip(three_entries, 3, 1);
+
+    CHECK(extract() == 0);
+
+    // the install stops at the bad entry
+    CHECK(extracted(0, &three_entries[0]));
+    char path[256];
+    extracted_path(path, sizeof(path), three_entries[2].name);
+    CHECK(pkgi_get_size(path) < 0);
+
+    CHECK(host_async_misuse == 0);
+    CHECK(host_zip_open == 0);
+}
+
+static void test_write_error(void)
+{
+    host_reset();
+    write_zip(three_entries, 3, NO_ENTRY);
+
+    // the second write of the first entry, while the next half is being filled
+    host_fail_async_write_at = 2;
+    CHECK(extract() == 0);
+
+    char path[256];
+    extracted_path(path, sizeof(path), three_entries[1].name);
+    CHECK(pkgi_get_size(path) < 0);
+
+    CHECK(host_async_misuse == 0);
+    CHECK(host_zip_open == 0);
+}
+
+static void test_not_a_zip(void)
+{
+    host_reset();
+
+    CHECK(extract() == 0);
+
+    uint8_t junk[1000];
+    test_fill(junk, sizeof(junk));
+    CHECK(host_write_file(TEST_ZIP, junk, sizeof(junk)));
+    CHECK(extract() == 0);
+
+    write_zip(NULL, 0, NO_ENTRY);
+    CHECK(extract() == 0);
+
+    CHECK(host_zip_open == 0);
+}
+
+int main(void)
+{
+    static const TestCase tests[] =
+    {
+        { "zip extract", test_extract },
+        { "zip directory cache full", test_dir_cache_full },
+        { "zip bad crc", test_bad_crc },
+        { "zip write error", test_write_error },
+        { "zip not an archive", test_not_a_zip },
+    };
+
+    int result = run_tests(tests, PKGI_COUNTOF(tests));
+    host_cleanup();
+
+    return result;
+}